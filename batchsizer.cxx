@@ -0,0 +1,50 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "batchsizer.h"
+
+#include <algorithm>
+
+void BatchSizer::configure(const uint32_t newMinimum, const uint32_t newMaximum, const std::chrono::nanoseconds newTarget) {
+    minimum = std::clamp<uint32_t>(newMinimum, 1, cap);
+    maximum = std::clamp<uint32_t>(newMaximum, minimum, cap);
+    target = newTarget;
+    size = std::clamp<uint32_t>(128, minimum, maximum);
+    ceiling = maximum;
+    perObject = 0.0;
+}
+
+void BatchSizer::shrink(const uint32_t requested) {
+    ceiling = std::max(minimum, requested / 2);
+    size = ceiling;
+    perObject = 0.0;
+}
+
+void BatchSizer::record(const uint32_t requested, const uint32_t returned, const std::chrono::nanoseconds elapsed) {
+    // A short batch is the end, and says nothing about the size.  Timeouts
+    // go to recordTimeout.
+    if (returned == 0 || returned < requested) {
+        return;
+    }
+    if (elapsed > target) {
+        shrink(requested);
+        return;
+    }
+    const double current = static_cast<double>(elapsed.count()) / returned;
+    if (perObject == 0.0 || current < perObject) {
+        const uint32_t limit = std::min(maximum, ceiling);
+        size = size > limit / 2 ? limit : size * 2;
+    }
+    perObject = current;
+}
+
+void BatchSizer::recordTimeout(const uint32_t requested, const uint32_t returned, const std::chrono::nanoseconds elapsed) {
+    if (returned == 0 || returned >= requested) {
+        return;
+    }
+    const double projected = static_cast<double>(elapsed.count()) / returned * requested;
+    if (projected > static_cast<double>(target.count())) {
+        shrink(requested);
+    }
+}
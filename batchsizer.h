@@ -0,0 +1,53 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/** Picks the number of objects to ask each Next call for.  The size grows
+ * while the time per object keeps falling, and halves as soon as a batch takes
+ * longer than the target, after which it never grows back past what did fit.
+ * With minimum equal to maximum, the size is fixed.
+ *
+ * Every method takes the elapsed time, so that this doesn't depend on the real
+ * clock.
+ */
+struct BatchSizer {
+    // The largest size ever asked for, whatever the configured maximum, as
+    // each Next call needs a buffer of that many pointers.
+    static constexpr uint32_t cap = 4096;
+
+    uint32_t minimum = 128;
+    uint32_t maximum = 128;
+    std::chrono::nanoseconds target = std::chrono::milliseconds(100);
+
+    uint32_t size = 128;
+    uint32_t ceiling = 128;
+    // Nanoseconds per object of the last full batch, or 0 if unknown.
+    double perObject = 0.0;
+
+    /** Set the bounds, clamped to 1 and cap, and start over at 128 clamped
+     * to them.
+     */
+    void configure(uint32_t newMinimum, uint32_t newMaximum, std::chrono::nanoseconds newTarget);
+
+    /** Adapt to how a call for requested objects went.
+     */
+    void record(uint32_t requested, uint32_t returned, std::chrono::nanoseconds elapsed);
+
+    /** Adapt to a call which timed out after elapsed, with only returned of
+     * requested objects.  This happens whenever a batch takes longer than
+     * the call may wait, such as with a cancel token or prefetching.  If the
+     * whole batch would take longer than the target at the rate the objects
+     * did arrive, the size halves as for a slow full batch.  Otherwise it
+     * says nothing about the size.
+     */
+    void recordTimeout(uint32_t requested, uint32_t returned, std::chrono::nanoseconds elapsed);
+
+private:
+    /** Halve the size from requested, and never grow back past that.
+     */
+    void shrink(uint32_t requested);
+};
@@ -0,0 +1,42 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+/** Minimal timing for the native benchmarks of the Windows-free modules.
+ * They only report, and never fail, as timings depend on the host.
+ */
+
+/** Keep the compiler from optimizing away the computation of value.
+ */
+template <typename T>
+inline void keep(const T &value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+/** Run body, which does operations operations per call, over and over for at
+ * least a quarter of a second, and return the nanoseconds per operation.
+ */
+template <typename Body>
+inline double nanosecondsPer(const size_t operations, Body body) {
+    using Clock = std::chrono::steady_clock;
+    // Warm up caches and allocators first.
+    body();
+    size_t calls = 0;
+    const auto start = Clock::now();
+    auto elapsed = Clock::duration::zero();
+    while (elapsed < std::chrono::milliseconds(250)) {
+        body();
+        ++calls;
+        elapsed = Clock::now() - start;
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(calls) * operations);
+}
+
+inline void report(const char * const name, const double nanoseconds) {
+    std::printf("  %-40s %10.1f ns\n", name, nanoseconds);
+}
@@ -0,0 +1,110 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../datetime.h"
+#include "bench.h"
+
+#include <cstdint>
+#include <cwchar>
+#include <random>
+#include <string>
+#include <vector>
+
+/** Timestamps between 1990 and 2037, with offsets either side of UTC, as
+ * install dates, boot times and last modified times are.
+ */
+static std::vector<std::wstring> timestamps(std::mt19937_64 &random) {
+    std::vector<std::wstring> output;
+    for (int i = 0; i < 4096; ++i) {
+        wchar_t buffer[32];
+        const int offset = static_cast<int>(random() % 1441) - 720;
+        std::swprintf(buffer, 32, L"%04u%02u%02u%02u%02u%02u.%06u%c%03d",
+                static_cast<unsigned>(1990 + random() % 48),
+                static_cast<unsigned>(1 + random() % 12),
+                static_cast<unsigned>(1 + random() % 28),
+                static_cast<unsigned>(random() % 24),
+                static_cast<unsigned>(random() % 60),
+                static_cast<unsigned>(random() % 60),
+                static_cast<unsigned>(random() % 1000000),
+                offset < 0 ? L'-' : L'+',
+                offset < 0 ? -offset : offset);
+        output.push_back(buffer);
+    }
+    return output;
+}
+
+static std::vector<std::wstring> intervals(std::mt19937_64 &random) {
+    std::vector<std::wstring> output;
+    for (int i = 0; i < 4096; ++i) {
+        wchar_t buffer[32];
+        std::swprintf(buffer, 32, L"%08u%02u%02u%02u.%06u:000",
+                static_cast<unsigned>(random() % 100000),
+                static_cast<unsigned>(random() % 24),
+                static_cast<unsigned>(random() % 60),
+                static_cast<unsigned>(random() % 60),
+                static_cast<unsigned>(random() % 1000000));
+        output.push_back(buffer);
+    }
+    return output;
+}
+
+/** Parsing the fields with swscanf, the obvious way to do it, and the same
+ * arithmetic after it.
+ */
+static DatetimeKind scanDatetime(const std::wstring &text, int64_t &microseconds) {
+    unsigned year, month, day, hour, minute, second, fraction;
+    wchar_t sign;
+    int offset;
+    if (std::swscanf(text.c_str(), L"%4u%2u%2u%2u%2u%2u.%6u%lc%3d", &year, &month, &day, &hour, &minute, &second, &fraction, &sign, &offset) != 9) {
+        return DatetimeNone;
+    }
+    if (sign == L':') {
+        const int64_t days = static_cast<int64_t>(year) * 10000 + month * 100 + day;
+        microseconds = (((days * 24 + hour) * 60 + minute) * 60 + second) * 1000000 + fraction;
+        return DatetimeInterval;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > daysInMonth(year, month)) {
+        return DatetimeNone;
+    }
+    const int64_t minutes = (daysFromCivil(year, month, day) * 24 + hour) * 60 + minute - (sign == L'-' ? -offset : offset);
+    microseconds = (minutes * 60 + second) * 1000000 + fraction;
+    return DatetimeTimestamp;
+}
+
+template <typename Parse>
+static double perValue(const std::vector<std::wstring> &values, Parse parse) {
+    return nanosecondsPer(values.size(), [&]() {
+        for (const auto &value: values) {
+            int64_t microseconds = 0;
+            keep(parse(value, microseconds));
+            keep(microseconds);
+        }
+    });
+}
+
+static void compare(const char * const name, const std::vector<std::wstring> &values) {
+    const double parsed = perValue(values, [](const std::wstring &value, int64_t &microseconds) {
+        return parseDatetime(value.c_str(), value.size(), microseconds);
+    });
+    const double scanned = perValue(values, scanDatetime);
+    std::printf("%s, per value:\n", name);
+    report("parseDatetime", parsed);
+    report("swscanf", scanned);
+    std::printf("  %-40s %10.2f x\n", "speedup", scanned / parsed);
+}
+
+int main() {
+    std::mt19937_64 random(48);
+    compare("timestamps", timestamps(random));
+    compare("intervals", intervals(random));
+
+    // Wildcard fields are common in CIM_DATETIME values that only give a
+    // time of day, and are rejected.
+    std::vector<std::wstring> wildcards(4096, L"********143000.000000+000");
+    std::printf("wildcards, per value:\n");
+    report("parseDatetime", perValue(wildcards, [](const std::wstring &value, int64_t &microseconds) {
+        return parseDatetime(value.c_str(), value.size(), microseconds);
+    }));
+    return 0;
+}
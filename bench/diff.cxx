@@ -0,0 +1,53 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../test/fakesource.h"
+#include "bench.h"
+
+#include <random>
+
+/** A poll of size instances of 20 properties each.
+ */
+static FakeSource poll(const size_t size) {
+    FakeSource output;
+    output.instances.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+        FakeInstance instance{L"Win32_Process", L"Win32_Process.Handle=\"" + std::to_wstring(i) + L"\"", {}};
+        for (int p = 0; p < 20; ++p) {
+            instance.properties.emplace_back(L"Property" + std::to_wstring(p), L"Some value " + std::to_wstring(i * p));
+        }
+        output.instances.push_back(std::move(instance));
+    }
+    return output;
+}
+
+int main() {
+    const size_t size = 100000;
+    const FakeSource previous = poll(size);
+    FakeSource current = previous;
+    // One percent modified, and as many replaced.
+    std::mt19937_64 random(1);
+    for (size_t i = 0; i < size / 100; ++i) {
+        current.instances[random() % size].properties[random() % 20].second = L"changed";
+        current.instances[random() % size].path += L"x";
+    }
+    const DiffIndex previousIndex(previous);
+
+    std::printf("diff of %zu instances of 20 properties, per instance:\n", size);
+    report("index", nanosecondsPer(size, [&]() {
+        const DiffIndex index(current);
+        keep(index);
+    }));
+    const DiffIndex currentIndex(current);
+    report("diff of indexed polls", nanosecondsPer(size, [&]() {
+        const auto changes = diffInstances(&previous, previousIndex, current, currentIndex);
+        keep(changes);
+    }));
+    report("session poll, index and diff", nanosecondsPer(size, [&]() {
+        const DiffIndex index(current);
+        const auto changes = diffInstances(&previous, previousIndex, current, index);
+        keep(changes);
+    }));
+    return 0;
+}
@@ -0,0 +1,104 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../invariant.h"
+#include "bench.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cwchar>
+#include <random>
+#include <string>
+#include <vector>
+
+/** Values spread over every magnitude, as property values are: counts,
+ * handles and sizes in bytes.
+ */
+template <typename T>
+static std::vector<T> integers(std::mt19937_64 &random) {
+    std::vector<T> output;
+    for (int i = 0; i < 4096; ++i) {
+        const unsigned bits = random() % (sizeof(T) * 8);
+        output.push_back(static_cast<T>(random() >> (63 - bits)));
+    }
+    return output;
+}
+
+static std::vector<double> doubles(std::mt19937_64 &random) {
+    std::uniform_real_distribution<double> mantissa(1.0, 10.0);
+    std::uniform_int_distribution<int> exponent(-8, 12);
+    std::vector<double> output;
+    for (int i = 0; i < 4096; ++i) {
+        output.push_back(mantissa(random) * std::pow(10.0, exponent(random)));
+    }
+    return output;
+}
+
+/** The per-value cost of formatting, into one string cleared each time as a
+ * property value is, through each formatter.
+ */
+template <typename T, typename Format>
+static double perValue(const std::vector<T> &values, Format format) {
+    std::wstring output;
+    return nanosecondsPer(values.size(), [&]() {
+        for (const T value: values) {
+            output.clear();
+            format(output, value);
+            keep(output);
+        }
+    });
+}
+
+/** The locale-dependent formatting that VariantChangeType stands for outside
+ * Windows.  %.17g and %.9g always round-trip, without searching for the
+ * shortest text as appendFloating does.
+ */
+static void printUnsigned(std::wstring &output, const uint64_t value) {
+    wchar_t buffer[32];
+    output.append(buffer, std::swprintf(buffer, 32, L"%llu", static_cast<unsigned long long>(value)));
+}
+
+static void printSigned(std::wstring &output, const int64_t value) {
+    wchar_t buffer[32];
+    output.append(buffer, std::swprintf(buffer, 32, L"%lld", static_cast<long long>(value)));
+}
+
+static void printDouble(std::wstring &output, const double value) {
+    wchar_t buffer[32];
+    output.append(buffer, std::swprintf(buffer, 32, L"%.17g", value));
+}
+
+static void printFloat(std::wstring &output, const float value) {
+    wchar_t buffer[32];
+    output.append(buffer, std::swprintf(buffer, 32, L"%.9g", static_cast<double>(value)));
+}
+
+static void compare(const char * const name, const double invariant, const double printed) {
+    std::printf("%s, per value:\n", name);
+    report("invariant", invariant);
+    report("swprintf", printed);
+    std::printf("  %-40s %10.2f x\n", "speedup", printed / invariant);
+}
+
+int main() {
+    std::mt19937_64 random(45);
+    const auto unsignedValues = integers<uint64_t>(random);
+    const auto signedValues = integers<int64_t>(random);
+    const auto doubleValues = doubles(random);
+    std::vector<float> floatValues(doubleValues.begin(), doubleValues.end());
+
+    compare("unsigned integers", perValue(unsignedValues, [](std::wstring &output, const uint64_t value) {
+        appendUnsigned(output, value);
+    }), perValue(unsignedValues, printUnsigned));
+    compare("signed integers", perValue(signedValues, [](std::wstring &output, const int64_t value) {
+        appendSigned(output, value);
+    }), perValue(signedValues, printSigned));
+    compare("doubles", perValue(doubleValues, [](std::wstring &output, const double value) {
+        appendFloating(output, value);
+    }), perValue(doubleValues, printDouble));
+    compare("floats", perValue(floatValues, [](std::wstring &output, const float value) {
+        appendFloating(output, value);
+    }), perValue(floatValues, printFloat));
+    return 0;
+}
@@ -0,0 +1,77 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../pipeline.h"
+#include "bench.h"
+
+#include <string>
+
+struct NoScope {
+};
+
+// Each batch keeps the provider busy this long, while the fetching thread
+// waits in Next, and takes about as long again to convert.
+static const auto fetchTime = std::chrono::microseconds(500);
+static constexpr size_t batchSize = 128;
+static constexpr size_t batches = 100;
+
+/** A provider which takes fetchTime to produce each batch.
+ */
+static std::vector<int> fetch(const size_t batch) {
+    std::this_thread::sleep_for(fetchTime);
+    return std::vector<int>(batchSize, static_cast<int>(batch));
+}
+
+/** Formatting and copying standing in for property conversion.
+ */
+static std::vector<std::wstring> convert(std::vector<int> &objects) {
+    std::vector<std::wstring> output;
+    output.reserve(objects.size() * 16);
+    for (const int object: objects) {
+        for (int property = 0; property < 16; ++property) {
+            output.push_back(L"Property value " + std::to_wstring(object * property));
+        }
+    }
+    return output;
+}
+
+int main() {
+    // Calibrate the conversion against the fetch time, so that the two
+    // stages cost about the same.
+    std::vector<int> sample(batchSize, 1);
+    const double convertNs = nanosecondsPer(1, [&]() {
+        keep(convert(sample));
+    });
+    const size_t repeat = std::max<size_t>(1, static_cast<size_t>(std::chrono::nanoseconds(fetchTime).count() / convertNs));
+    const auto work = [repeat](std::vector<int> &objects) {
+        std::vector<std::wstring> output;
+        for (size_t i = 0; i < repeat; ++i) {
+            output = convert(objects);
+        }
+        return output;
+    };
+
+    std::printf("class of %zu batches of %zu, per batch:\n", batches, batchSize);
+    const double sequential = nanosecondsPer(batches, [&]() {
+        for (size_t batch = 0; batch < batches; ++batch) {
+            auto objects = fetch(batch);
+            keep(work(objects));
+        }
+    });
+    report("fetch then convert", sequential);
+    for (const unsigned converters: {1u, 2u}) {
+        ConverterPool<int, std::vector<std::wstring>, NoScope> pool(converters);
+        const double pipelined = nanosecondsPer(batches, [&]() {
+            ConvertPipeline<int, std::vector<std::wstring>, NoScope> pipeline(pool, work);
+            for (size_t batch = 0; batch < batches; ++batch) {
+                pipeline.push(fetch(batch));
+            }
+            keep(pipeline.finish());
+        });
+        const std::string name = "pipelined, " + std::to_string(converters) + (converters == 1 ? " converter" : " converters");
+        report(name.c_str(), pipelined);
+        std::printf("  %-40s %10.2f x\n", "speedup", sequential / pipelined);
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../prefetch.h"
+#include "bench.h"
+
+#include <string>
+#include <vector>
+
+struct NoScope {
+};
+
+// Each batch keeps the provider busy this long, while the caller waits in
+// Next, and takes about as long again for the caller to process.
+static const auto fetchTime = std::chrono::microseconds(500);
+static constexpr size_t batchSize = 128;
+static constexpr int batches = 100;
+
+/** A provider of batches, which takes fetchTime for each.
+ */
+struct FakeProvider {
+    int produced = 0;
+
+    std::optional<std::vector<int>> operator()(long) {
+        if (produced == batches) {
+            return std::nullopt;
+        }
+        std::this_thread::sleep_for(fetchTime);
+        return std::make_optional<std::vector<int>>(batchSize, produced++);
+    }
+};
+
+/** Formatting standing in for converting a batch.
+ */
+static size_t process(const std::vector<int> &batch) {
+    size_t output = 0;
+    for (const int object: batch) {
+        for (int property = 0; property < 16; ++property) {
+            output += (L"Property value " + std::to_wstring(object * property)).size();
+        }
+    }
+    return output;
+}
+
+int main() {
+    // Calibrate the processing against the fetch time, so that the two cost
+    // about the same.
+    const std::vector<int> sample(batchSize, 1);
+    const double processNs = nanosecondsPer(1, [&]() {
+        keep(process(sample));
+    });
+    const size_t repeat = std::max<size_t>(1, static_cast<size_t>(std::chrono::nanoseconds(fetchTime).count() / processNs));
+    const auto work = [repeat](const std::vector<int> &batch) {
+        size_t output = 0;
+        for (size_t i = 0; i < repeat; ++i) {
+            output += process(batch);
+        }
+        return output;
+    };
+
+    std::printf("class of %d batches of %zu, per batch:\n", batches, batchSize);
+    const double direct = nanosecondsPer(batches, [&]() {
+        FakeProvider provider;
+        for (auto batch = provider(waitInfinite); batch; batch = provider(waitInfinite)) {
+            keep(work(*batch));
+        }
+    });
+    report("fetch on demand", direct);
+    for (const size_t depth: {1, 2, 4}) {
+        const double prefetched = nanosecondsPer(batches, [&]() {
+            FakeProvider provider;
+            Prefetcher<std::vector<int>, NoScope> prefetch(std::ref(provider), depth);
+            for (auto batch = prefetch.next(); batch; batch = prefetch.next()) {
+                keep(work(*batch));
+            }
+        });
+        const std::string name = "prefetch depth " + std::to_string(depth);
+        report(name.c_str(), prefetched);
+        std::printf("  %-40s %10.2f x\n", "speedup", direct / prefetched);
+    }
+    return 0;
+}
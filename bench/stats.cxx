@@ -0,0 +1,78 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../scopedtimer.h"
+#include "bench.h"
+
+#include <regex>
+#include <string>
+#include <vector>
+
+/** The counters stats add to for every property.
+ */
+struct PropertyStats {
+    uint64_t properties = 0;
+    uint64_t propertyTime = 0;
+    uint64_t regexMatches = 0;
+    uint64_t regexTime = 0;
+    uint64_t conversions = 0;
+    uint64_t conversionTime = 0;
+};
+
+/** The per-property loop of instance conversion, with the same timers and
+ * counters as stats, and a regex match and number formatting standing in for
+ * the work they time.
+ */
+static void convert(const std::vector<std::wstring> &names, const std::wregex &filter, std::wstring &output, PropertyStats * const stats) {
+    uint64_t value = 0;
+    for (const auto &name: names) {
+        {
+            ScopedTimer timer(stats ? &stats->propertyTime : nullptr);
+            if (stats) {
+                ++stats->properties;
+            }
+            value += name.size();
+        }
+        bool matches;
+        {
+            ScopedTimer timer(stats ? &stats->regexTime : nullptr);
+            if (stats) {
+                ++stats->regexMatches;
+            }
+            matches = std::regex_match(name, filter);
+        }
+        if (matches) {
+            ScopedTimer timer(stats ? &stats->conversionTime : nullptr);
+            if (stats) {
+                ++stats->conversions;
+            }
+            output.assign(std::to_wstring(value));
+        }
+    }
+}
+
+int main() {
+    std::vector<std::wstring> names;
+    for (int i = 0; i < 64; ++i) {
+        names.push_back(L"PropertyName" + std::to_wstring(i));
+    }
+    const std::wregex filter(L"Property.*");
+    std::wstring output;
+    PropertyStats stats;
+
+    std::printf("stats overhead, per property:\n");
+    const double disabled = nanosecondsPer(names.size(), [&]() {
+        convert(names, filter, output, nullptr);
+        keep(output);
+    });
+    const double enabled = nanosecondsPer(names.size(), [&]() {
+        convert(names, filter, output, &stats);
+        keep(output);
+    });
+    report("stats disabled", disabled);
+    report("stats enabled", enabled);
+    report("overhead", enabled - disabled);
+    std::printf("  %-40s %10.1f %%\n", "overhead relative", 100.0 * (enabled - disabled) / disabled);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "circuitbreaker.h"
+
+#include <algorithm>
+
+bool CircuitBreakers::enabled() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return threshold > 0;
+}
+
+BreakerState CircuitBreakers::allow(const std::wstring &className, const Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (threshold == 0) {
+        return BreakerClosed;
+    }
+    const auto it = breakers.find(className);
+    if (it == breakers.end() || it->second.trips == 0) {
+        return BreakerClosed;
+    }
+    auto &breaker = it->second;
+    // Only one probe at a time.
+    if (now < breaker.openUntil || breaker.probing) {
+        return BreakerOpen;
+    }
+    breaker.probing = true;
+    return BreakerHalfOpen;
+}
+
+void CircuitBreakers::succeed(const std::wstring &className) {
+    std::lock_guard<std::mutex> lock(mutex);
+    breakers.erase(className);
+}
+
+void CircuitBreakers::fail(const std::wstring &className, const Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (threshold == 0) {
+        return;
+    }
+    auto &breaker = breakers[className];
+    ++breaker.failures;
+    if (breaker.probing || breaker.failures >= threshold) {
+        breaker.probing = false;
+        ++breaker.trips;
+        auto window = backoff;
+        for (unsigned i = 1; i < breaker.trips && window < maxBackoff; ++i) {
+            window *= 2;
+        }
+        breaker.openUntil = now + std::min(window, maxBackoff);
+    }
+}
+
+void CircuitBreakers::abandon(const std::wstring &className) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = breakers.find(className);
+    if (it != breakers.end()) {
+        it->second.probing = false;
+    }
+}
+
+BreakerState CircuitBreakers::state(const std::wstring &className, const Clock::time_point now) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = breakers.find(className);
+    if (it == breakers.end() || it->second.trips == 0) {
+        return BreakerClosed;
+    }
+    if (now < it->second.openUntil) {
+        return BreakerOpen;
+    }
+    return BreakerHalfOpen;
+}
@@ -0,0 +1,68 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/** The state of a class's circuit breaker.  These match WmiBreakerState, and
+ * are kept separate from it so that this has no dependency on Windows.
+ */
+enum BreakerState : int {
+    // Enumerated normally.
+    BreakerClosed = 0,
+    // Quarantined after failing, and skipped.
+    BreakerOpen = 1,
+    // Done with its backoff, and enumerated once as a probe.
+    BreakerHalfOpen = 2,
+};
+
+/** Session-level circuit breakers for classes whose providers keep failing or
+ * hanging.  After enough consecutive failures a class is open, and skipped
+ * entirely, for a backoff window that doubles each time it trips.  When the
+ * window is over, the class is half open, and a single probe enumeration is
+ * let through to decide whether to close it again.
+ *
+ * Every method takes the current time, so that the state machine doesn't
+ * depend on the real clock.
+ */
+struct CircuitBreakers {
+    using Clock = std::chrono::steady_clock;
+
+    struct Breaker {
+        unsigned failures = 0;
+        unsigned trips = 0;
+        Clock::time_point openUntil;
+        bool probing = false;
+    };
+
+    // Zero disables the breakers.
+    unsigned threshold = 0;
+    // Zero waits forever.
+    std::chrono::milliseconds timeout{0};
+    std::chrono::milliseconds backoff{30000};
+    std::chrono::milliseconds maxBackoff{600000};
+    std::unordered_map<std::wstring, Breaker> breakers;
+    mutable std::mutex mutex;
+
+    bool enabled() const;
+
+    /** Decide whether the class may be enumerated now.  Closed and half open
+     * classes may be, and a half open result means that this is the probe.
+     */
+    BreakerState allow(const std::wstring &className, Clock::time_point now);
+
+    void succeed(const std::wstring &className);
+
+    void fail(const std::wstring &className, Clock::time_point now);
+
+    /** Give up on an enumeration without counting it either way, such as when
+     * it is cancelled.  If it was the probe, the next call may probe again.
+     */
+    void abandon(const std::wstring &className);
+
+    BreakerState state(const std::wstring &className, Clock::time_point now) const;
+};
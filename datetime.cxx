@@ -0,0 +1,72 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "datetime.h"
+
+/** Read count digits from text, setting bad if any of them isn't one.
+ */
+static int64_t parseDigits(const wchar_t * const text, const size_t count, unsigned &bad) {
+    int64_t output = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned digit = static_cast<unsigned>(text[i]) - L'0';
+        bad |= digit > 9;
+        output = output * 10 + digit;
+    }
+    return output;
+}
+
+int64_t daysFromCivil(int64_t year, const unsigned month, const unsigned day) {
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned yearOfEra = static_cast<unsigned>(year - era * 400);
+    const unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + static_cast<int64_t>(dayOfEra) - 719468;
+}
+
+unsigned daysInMonth(const int64_t year, const unsigned month) {
+    static constexpr unsigned days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (month == 2) {
+        const bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+        return leap ? 29 : 28;
+    }
+    return days[month - 1];
+}
+
+DatetimeKind parseDatetime(const wchar_t * const text, const size_t length, int64_t &microseconds) {
+    if (length != 25 || text[14] != L'.') {
+        return DatetimeNone;
+    }
+    unsigned bad = 0;
+    const int64_t hour = parseDigits(text + 8, 2, bad);
+    const int64_t minute = parseDigits(text + 10, 2, bad);
+    const int64_t second = parseDigits(text + 12, 2, bad);
+    const int64_t fraction = parseDigits(text + 15, 6, bad);
+    const int64_t offset = parseDigits(text + 22, 3, bad);
+    bad |= hour > 23;
+    bad |= minute > 59;
+    bad |= second > 59;
+    const int64_t time = ((hour * 60 + minute) * 60 + second) * 1000000 + fraction;
+    if (text[21] == L':') {
+        const int64_t days = parseDigits(text, 8, bad);
+        if (bad || offset != 0) {
+            return DatetimeNone;
+        }
+        microseconds = days * 86400000000 + time;
+        return DatetimeInterval;
+    }
+    const int64_t year = parseDigits(text, 4, bad);
+    const int64_t month = parseDigits(text + 4, 2, bad);
+    const int64_t day = parseDigits(text + 6, 2, bad);
+    bad |= text[21] != L'+' && text[21] != L'-';
+    // Checked in turn, as the month must be valid to look up its length.
+    if (bad || month < 1 || month > 12 || day < 1 || day > daysInMonth(year, static_cast<unsigned>(month))) {
+        return DatetimeNone;
+    }
+    // The offset is the local time's minutes ahead of UTC.
+    const int64_t offsetMinutes = text[21] == L'+' ? offset : -offset;
+    microseconds = daysFromCivil(year, static_cast<unsigned>(month), static_cast<unsigned>(day)) * 86400000000
+        + time - offsetMinutes * 60000000;
+    return DatetimeTimestamp;
+}
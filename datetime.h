@@ -0,0 +1,35 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/** What a CIM_DATETIME holds.  These match WmiDatetime, and are kept separate
+ * from it so that this has no dependency on Windows.
+ */
+enum DatetimeKind : int {
+    // Not parseable, such as with wildcard fields.
+    DatetimeNone = 0,
+    // A point in time, in microseconds since the UNIX epoch in UTC.
+    DatetimeTimestamp = 1,
+    // A duration, in microseconds.
+    DatetimeInterval = 2,
+};
+
+/** Days since 1970-01-01 of a proleptic Gregorian date.
+ */
+int64_t daysFromCivil(int64_t year, unsigned month, unsigned day);
+
+/** The number of days in a month of a proleptic Gregorian year.
+ */
+unsigned daysInMonth(int64_t year, unsigned month);
+
+/** Parse a 25 character CIM_DATETIME into microseconds, either since the UNIX
+ * epoch in UTC for a timestamp (yyyymmddHHMMSS.mmmmmmsUUU), or in total for
+ * an interval (ddddddddHHMMSS.mmmmmm:000).  Values with wildcard fields, or
+ * otherwise malformed, such as the 31st of April, give DatetimeNone, and leave
+ * microseconds alone.
+ */
+DatetimeKind parseDatetime(const wchar_t *text, size_t length, int64_t &microseconds);
@@ -0,0 +1,132 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "diff.h"
+
+#include <cwchar>
+
+uint64_t instanceHash(const DiffSource &source, const size_t instance) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const auto add = [&hash](const wchar_t *string) {
+        // Includes the terminator, so that key and value boundaries count.
+        do {
+            hash = (hash ^ static_cast<uint16_t>(*string)) * 0x100000001b3ull;
+        } while (*string++);
+    };
+    const size_t count = source.propertyCount(instance);
+    for (size_t property = 0; property < count; ++property) {
+        add(source.key(instance, property));
+        add(source.value(instance, property));
+    }
+    return hash;
+}
+
+std::wstring instanceIdentity(const DiffSource &source, const size_t instance, const uint64_t hash) {
+    std::wstring output(source.className(instance));
+    output.push_back(L'\0');
+    const wchar_t * const path = source.path(instance);
+    if (*path) {
+        output.append(path);
+    } else {
+        output.push_back(L'#');
+        output.append(std::to_wstring(hash));
+    }
+    return output;
+}
+
+DiffIndex::DiffIndex(const DiffSource &source) {
+    const size_t count = source.instanceCount();
+    identities.reserve(count);
+    hashes.reserve(count);
+    entries.reserve(count);
+    for (size_t instance = 0; instance < count; ++instance) {
+        const uint64_t hash = instanceHash(source, instance);
+        hashes.push_back(hash);
+        identities.push_back(instanceIdentity(source, instance, hash));
+        // Duplicate identities keep the first instance
+        entries.emplace(identities.back(), Entry{instance, hash});
+    }
+}
+
+std::vector<DiffChange> diffInstances(const DiffSource * const previous, const DiffIndex &previousIndex, const DiffSource &current, const DiffIndex &currentIndex) {
+    std::vector<DiffChange> output;
+    const size_t previousCount = previous ? previous->instanceCount() : 0;
+    const size_t currentCount = current.instanceCount();
+    std::vector<bool> matched(previousCount, false);
+
+    const auto allProperties = [](const DiffSource &source, const size_t instance, DiffChange &change) {
+        const size_t count = source.propertyCount(instance);
+        change.properties.reserve(count);
+        for (size_t property = 0; property < count; ++property) {
+            change.properties.emplace_back(source.key(instance, property), source.value(instance, property));
+        }
+    };
+
+    for (size_t instance = 0; instance < currentCount; ++instance) {
+        const auto it = previousIndex.entries.find(currentIndex.identities[instance]);
+        if (it == previousIndex.entries.end() || matched[it->second.instance]) {
+            auto &change = output.emplace_back();
+            change.change = DiffAdded;
+            change.className = current.className(instance);
+            change.path = current.path(instance);
+            allProperties(current, instance, change);
+            continue;
+        }
+        const size_t old = it->second.instance;
+        matched[old] = true;
+        if (it->second.hash == currentIndex.hashes[instance]) {
+            continue;
+        }
+
+        auto &change = output.emplace_back();
+        change.change = DiffModified;
+        change.className = current.className(instance);
+        change.path = current.path(instance);
+
+        // Properties almost always come back in the same order, so check the
+        // same position first and only search when that misses.
+        const size_t oldCount = previous->propertyCount(old);
+        const size_t newCount = current.propertyCount(instance);
+        std::vector<bool> oldSeen(oldCount, false);
+        for (size_t property = 0; property < newCount; ++property) {
+            const wchar_t * const key = current.key(instance, property);
+            const wchar_t * const value = current.value(instance, property);
+            size_t oldProperty = property;
+            if (oldProperty >= oldCount || std::wcscmp(key, previous->key(old, oldProperty)) != 0) {
+                for (oldProperty = 0; oldProperty < oldCount; ++oldProperty) {
+                    if (std::wcscmp(key, previous->key(old, oldProperty)) == 0) {
+                        break;
+                    }
+                }
+            }
+            if (oldProperty < oldCount) {
+                oldSeen[oldProperty] = true;
+                if (std::wcscmp(value, previous->value(old, oldProperty)) == 0) {
+                    continue;
+                }
+            }
+            change.properties.emplace_back(key, value);
+        }
+        for (size_t oldProperty = 0; oldProperty < oldCount; ++oldProperty) {
+            if (!oldSeen[oldProperty]) {
+                change.properties.emplace_back(previous->key(old, oldProperty), std::nullopt);
+            }
+        }
+        // The hash depends on property order, so a reordering with no changed
+        // values gets here, and isn't a modification.
+        if (change.properties.empty()) {
+            output.pop_back();
+        }
+    }
+
+    for (size_t instance = 0; instance < previousCount; ++instance) {
+        if (!matched[instance]) {
+            auto &change = output.emplace_back();
+            change.change = DiffRemoved;
+            change.className = previous->className(instance);
+            change.path = previous->path(instance);
+        }
+    }
+    return output;
+}
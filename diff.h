@@ -0,0 +1,79 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+/** The kind of change to an instance.  These match WmiChange, and are kept
+ * separate from it so that this has no dependency on Windows.
+ */
+enum DiffKind : int {
+    DiffUnchanged = 0,
+    DiffAdded = 1,
+    DiffRemoved = 2,
+    DiffModified = 3,
+};
+
+/** One side of a diff, such as an enum.  None of the strings may be null.
+ */
+struct DiffSource {
+    virtual ~DiffSource() = default;
+    virtual size_t instanceCount() const = 0;
+    virtual const wchar_t *className(size_t instance) const = 0;
+    virtual const wchar_t *path(size_t instance) const = 0;
+    virtual size_t propertyCount(size_t instance) const = 0;
+    virtual const wchar_t *key(size_t instance, size_t property) const = 0;
+    virtual const wchar_t *value(size_t instance, size_t property) const = 0;
+};
+
+/** A single added, removed, or modified instance.  Properties are all of the
+ * properties for an added instance, none for a removed one, and only the
+ * changed ones for a modified one, with no value for properties that are gone.
+ */
+struct DiffChange {
+    DiffKind change;
+    std::wstring className;
+    std::wstring path;
+    std::vector<std::tuple<std::wstring, std::optional<std::wstring>>> properties;
+};
+
+/** 64-bit FNV-1a of all of an instance's keys and values.
+ */
+uint64_t instanceHash(const DiffSource &source, size_t instance);
+
+/** The identity that an instance is tracked across enums by, which is its class
+ * and __RELPATH.  Instances with no path fall back to their hash, so that they
+ * are at least recognized when identical.
+ */
+std::wstring instanceIdentity(const DiffSource &source, size_t instance, uint64_t hash);
+
+/** Index of one side of a diff, mapping each instance's identity to its index
+ * and hash.  Hashes are computed once per instance, so in session mode each
+ * instance is only hashed in the poll that fetched it.
+ */
+struct DiffIndex {
+    struct Entry {
+        size_t instance;
+        uint64_t hash;
+    };
+
+    std::vector<std::wstring> identities;
+    std::vector<uint64_t> hashes;
+    std::unordered_map<std::wstring, Entry> entries;
+
+    DiffIndex() = default;
+
+    explicit DiffIndex(const DiffSource &source);
+};
+
+/** Diff two sources, each with its index.  previous may be null, in which case
+ * everything in current is added.
+ */
+std::vector<DiffChange> diffInstances(const DiffSource *previous, const DiffIndex &previousIndex, const DiffSource &current, const DiffIndex &currentIndex);
@@ -0,0 +1,55 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "invariant.h"
+
+#include <charconv>
+#include <cstddef>
+
+void appendUnsigned(std::wstring &output, uint64_t value) {
+    static constexpr char digitPairs[] =
+        "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+        "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+    wchar_t buffer[20];
+    wchar_t * const end = buffer + 20;
+    wchar_t *position = end;
+    while (value >= 100) {
+        const size_t pair = (value % 100) * 2;
+        value /= 100;
+        *--position = digitPairs[pair + 1];
+        *--position = digitPairs[pair];
+    }
+    if (value >= 10) {
+        const size_t pair = value * 2;
+        *--position = digitPairs[pair + 1];
+        *--position = digitPairs[pair];
+    } else {
+        *--position = static_cast<wchar_t>(L'0' + value);
+    }
+    output.append(position, end);
+}
+
+void appendSigned(std::wstring &output, const int64_t value) {
+    if (value < 0) {
+        output.push_back(L'-');
+        appendUnsigned(output, 0 - static_cast<uint64_t>(value));
+    } else {
+        appendUnsigned(output, static_cast<uint64_t>(value));
+    }
+}
+
+template <typename T>
+static void appendShortest(std::wstring &output, const T value) {
+    char buffer[32];
+    const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    output.append(buffer, result.ptr);
+}
+
+void appendFloating(std::wstring &output, const float value) {
+    appendShortest(output, value);
+}
+
+void appendFloating(std::wstring &output, const double value) {
+    appendShortest(output, value);
+}
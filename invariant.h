@@ -0,0 +1,22 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/** Append value in decimal, two digits at a time.
+ */
+void appendUnsigned(std::wstring &output, uint64_t value);
+
+/** Append value in decimal, with a leading '-' if it is negative.
+ */
+void appendSigned(std::wstring &output, int64_t value);
+
+/** Append the shortest text that reads back as exactly value, without regard
+ * to the thread locale.  Infinities are "inf" and "-inf", and NaN is "nan",
+ * with a '-' if its sign bit is set.
+ */
+void appendFloating(std::wstring &output, float value);
+void appendFloating(std::wstring &output, double value);
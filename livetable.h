@@ -0,0 +1,99 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/** The live instances of a class, keyed by path, kept up to date by events
+ * that can arrive from any thread, including while the table is being seeded
+ * by the initial enumeration.
+ *
+ * Events are always newer than the enumeration, so seeding never replaces an
+ * instance an event created, nor brings back one an event deleted.
+ */
+template <typename Instance>
+class LiveTable {
+    private:
+        mutable std::mutex mutex;
+        std::unordered_map<std::wstring, std::shared_ptr<const Instance>> instances;
+
+        bool seeding = true;
+        // Paths deleted while seeding, and not created again since.
+        std::unordered_set<std::wstring> deletedWhileSeeding;
+
+        // Set once, on the first failure.
+        std::optional<std::string> failure;
+
+    public:
+        /** Apply a creation or modification event.
+         */
+        void upsert(const std::wstring &path, std::shared_ptr<const Instance> instance) {
+            std::lock_guard<std::mutex> lock(mutex);
+            instances[path] = std::move(instance);
+            if (seeding) {
+                deletedWhileSeeding.erase(path);
+            }
+        }
+
+        /** Apply a deletion event.
+         */
+        void erase(const std::wstring &path) {
+            std::lock_guard<std::mutex> lock(mutex);
+            instances.erase(path);
+            if (seeding) {
+                deletedWhileSeeding.insert(path);
+            }
+        }
+
+        /** Add the initial enumeration, and end seeding.  Each element of
+         * seed is a pair of path and instance.
+         */
+        template <typename Seed>
+        void seed(const Seed &seed) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto &[path, instance]: seed) {
+                if (deletedWhileSeeding.count(path) == 0) {
+                    instances.emplace(path, instance);
+                }
+            }
+            deletedWhileSeeding.clear();
+            seeding = false;
+        }
+
+        /** Record a failure, unless there already is one.
+         */
+        void fail(std::string message) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!failure) {
+                failure = std::make_optional<std::string>(std::move(message));
+            }
+        }
+
+        /** The first failure, or null.  It is never changed once set, so the
+         * pointer lives as long as the table.
+         */
+        const char *error() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return failure ? failure->c_str() : nullptr;
+        }
+
+        /** All the current instances, in no particular order.
+         */
+        std::vector<std::shared_ptr<const Instance>> snapshot() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<std::shared_ptr<const Instance>> output;
+            output.reserve(instances.size());
+            for (const auto &[path, instance]: instances) {
+                output.push_back(instance);
+            }
+            return output;
+        }
+};
@@ -0,0 +1,84 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+/** Intrusive multiple producer, single consumer queue, after Dmitry Vyukov's
+ * design.  Producers never lock or wait, and the single consumer pops in FIFO
+ * order.  pop may miss a push that is still in progress, so producers should
+ * wake the consumer after pushing.
+ */
+template <typename T>
+class MpscQueue {
+    private:
+        struct Node {
+            std::atomic<Node *> next{nullptr};
+            T value;
+        };
+
+        std::atomic<Node *> head;
+        Node *tail;
+        Node stub;
+
+        void pushNode(Node * const node) {
+            node->next.store(nullptr, std::memory_order_relaxed);
+            Node * const previous = head.exchange(node, std::memory_order_acq_rel);
+            previous->next.store(node, std::memory_order_release);
+        }
+
+    public:
+        MpscQueue() : head(&stub), tail(&stub) {
+        }
+
+        MpscQueue(const MpscQueue &) = delete;
+        MpscQueue &operator=(const MpscQueue &) = delete;
+
+        ~MpscQueue() {
+            while (pop()) {
+            }
+        }
+
+        /** Safe to call from any number of threads at once.
+         */
+        void push(T value) {
+            Node * const node = new Node();
+            node->value = std::move(value);
+            pushNode(node);
+        }
+
+        /** Only ever call from one thread at a time.
+         */
+        std::optional<T> pop() {
+            Node *first = tail;
+            Node *next = first->next.load(std::memory_order_acquire);
+            if (first == &stub) {
+                if (!next) {
+                    return std::nullopt;
+                }
+                tail = next;
+                first = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+            if (!next) {
+                if (first != head.load(std::memory_order_acquire)) {
+                    // A push is halfway done.
+                    return std::nullopt;
+                }
+                // first is the last node, so put the stub behind it so that it
+                // can be unlinked.
+                pushNode(&stub);
+                next = first->next.load(std::memory_order_acquire);
+                if (!next) {
+                    return std::nullopt;
+                }
+            }
+            tail = next;
+            std::optional<T> output(std::move(first->value));
+            delete first;
+            return output;
+        }
+};
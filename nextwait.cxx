@@ -0,0 +1,30 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "nextwait.h"
+
+#include <algorithm>
+
+NextWaits::NextWaits(const std::chrono::milliseconds timeout, const std::function<bool()> &cancelled, std::string timeoutMessage) :
+    timeout(timeout),
+    deadline(std::chrono::steady_clock::now() + timeout),
+    cancelled(cancelled),
+    timeoutMessage(std::move(timeoutMessage)) {
+}
+
+long NextWaits::next() const {
+    if (cancelled && cancelled()) {
+        throw CancelledError("Enumeration cancelled.");
+    }
+    long output = cancelled ? cancelInterval : waitInfinite;
+    if (timeout.count() != 0) {
+        // Rounded up, so that the timeout is never cut short.
+        const auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) {
+            throw TimeoutError(timeoutMessage);
+        }
+        output = cancelled ? std::min<long>(output, left) : left;
+    }
+    return output;
+}
@@ -0,0 +1,60 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+/** Thrown when a provider takes too long.
+ */
+struct TimeoutError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+/** Thrown when an enumeration is given up on from elsewhere.
+ */
+struct CancelledError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Longest wait in milliseconds for a single Next call that may be cancelled.
+constexpr long cancelInterval = 50;
+
+// A Next call which waits as long as it takes, the same as WBEM_INFINITE.
+constexpr long waitInfinite = -1;
+
+/** How long each Next call of one enumeration may wait.  Each may only wait
+ * for what is left of the timeout, and not too long to notice a cancellation.
+ */
+class NextWaits {
+    private:
+        const std::chrono::milliseconds timeout;
+        const std::chrono::steady_clock::time_point deadline;
+        const std::function<bool()> &cancelled;
+        const std::string timeoutMessage;
+
+    public:
+        /** timeout of 0 is none, and cancelled may be empty.  It is checked
+         * before every Next call, and must outlive this.
+         */
+        NextWaits(std::chrono::milliseconds timeout, const std::function<bool()> &cancelled, std::string timeoutMessage);
+
+        /** The wait in milliseconds for the next Next call, or waitInfinite.
+         * Throws CancelledError or TimeoutError instead if it is too late.
+         */
+        long next() const;
+};
+
+/** Call next with the wait for each call until it returns nullopt, and pass
+ * every batch to consume.  next is the enumerator, returning an optional
+ * batch, which is empty if nothing arrived in time.
+ */
+template <typename Next, typename Consume>
+void drain(const NextWaits &waits, Next &&next, Consume &&consume) {
+    for (auto batch = next(waits.next()); batch; batch = next(waits.next())) {
+        consume(*batch);
+    }
+}
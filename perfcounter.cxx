@@ -0,0 +1,237 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "perfcounter.h"
+
+bool perfCounterSupported(const uint32_t type) {
+    switch (type) {
+        case PerfRawCountHex:
+        case PerfLargeRawCountHex:
+        case PerfRawCount:
+        case PerfLargeRawCount:
+        case PerfDelta:
+        case PerfLargeDelta:
+        case PerfQueueLength:
+        case PerfLargeQueueLength:
+        case Perf100NsQueueLength:
+        case PerfObjectTimeQueueLength:
+        case PerfCounter:
+        case PerfBulkCount:
+        case PerfRawFraction:
+        case PerfLargeRawFraction:
+        case PerfTimer:
+        case PerfPrecisionSystemTimer:
+        case Perf100NsTimer:
+        case PerfPrecision100NsTimer:
+        case PerfObjectTimeTimer:
+        case PerfPrecisionObjectTimer:
+        case PerfSampleFraction:
+        case PerfTimerInverse:
+        case Perf100NsTimerInverse:
+        case PerfMultiTimer:
+        case Perf100NsMultiTimer:
+        case PerfMultiTimerInverse:
+        case Perf100NsMultiTimerInverse:
+        case PerfAverageTimer:
+        case PerfElapsedTime:
+        case PerfAverageBulk:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool perfCounterHasBase(const uint32_t type) {
+    switch (type) {
+        case PerfRawFraction:
+        case PerfLargeRawFraction:
+        case PerfPrecisionSystemTimer:
+        case PerfPrecision100NsTimer:
+        case PerfPrecisionObjectTimer:
+        case PerfSampleFraction:
+        case PerfMultiTimer:
+        case Perf100NsMultiTimer:
+        case PerfMultiTimerInverse:
+        case Perf100NsMultiTimerInverse:
+        case PerfAverageTimer:
+        case PerfAverageBulk:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool perfCounterNeedsPrevious(const uint32_t type) {
+    switch (type) {
+        case PerfRawCountHex:
+        case PerfLargeRawCountHex:
+        case PerfRawCount:
+        case PerfLargeRawCount:
+        case PerfRawFraction:
+        case PerfLargeRawFraction:
+        case PerfElapsedTime:
+            return false;
+        default:
+            return perfCounterSupported(type);
+    }
+}
+
+/** Difference between two counter readings, or nothing if the counter went
+ * backwards.
+ */
+static std::optional<double> delta(const uint64_t previous, const uint64_t current) {
+    if (current < previous) {
+        return std::nullopt;
+    }
+    return static_cast<double>(current - previous);
+}
+
+/** Difference between two timestamps, or nothing if no time passed.
+ */
+static std::optional<double> interval(const uint64_t previous, const uint64_t current) {
+    if (current <= previous) {
+        return std::nullopt;
+    }
+    return static_cast<double>(current - previous);
+}
+
+std::optional<double> perfCounterCook(const uint32_t type, const PerfRawSample &previous, const PerfRawSample &current) {
+    // Most types are some value over some time, and only differ in which
+    // timer they use.
+    const auto perfInterval = interval(previous.perfTime, current.perfTime);
+    const auto sys100NsInterval = interval(previous.sys100NsTime, current.sys100NsTime);
+    const auto objectInterval = interval(previous.objectTime, current.objectTime);
+    const auto valueDelta = delta(previous.value, current.value);
+    const auto baseDelta = interval(previous.base, current.base);
+
+    switch (type) {
+        case PerfRawCountHex:
+        case PerfLargeRawCountHex:
+        case PerfRawCount:
+        case PerfLargeRawCount:
+            return static_cast<double>(current.value);
+
+        case PerfDelta:
+        case PerfLargeDelta:
+            return valueDelta;
+
+        case PerfQueueLength:
+        case PerfLargeQueueLength:
+            if (valueDelta && perfInterval) {
+                return *valueDelta / *perfInterval;
+            }
+            return std::nullopt;
+
+        case Perf100NsQueueLength:
+            if (valueDelta && sys100NsInterval) {
+                return *valueDelta / *sys100NsInterval;
+            }
+            return std::nullopt;
+
+        case PerfObjectTimeQueueLength:
+            if (valueDelta && objectInterval) {
+                return *valueDelta / *objectInterval;
+            }
+            return std::nullopt;
+
+        case PerfCounter:
+        case PerfBulkCount:
+            if (valueDelta && perfInterval && current.perfFrequency > 0) {
+                return *valueDelta / (*perfInterval / current.perfFrequency);
+            }
+            return std::nullopt;
+
+        case PerfRawFraction:
+        case PerfLargeRawFraction:
+            if (current.base > 0) {
+                return 100.0 * current.value / current.base;
+            }
+            return std::nullopt;
+
+        case PerfTimer:
+            if (valueDelta && perfInterval) {
+                return 100.0 * *valueDelta / *perfInterval;
+            }
+            return std::nullopt;
+
+        case Perf100NsTimer:
+            if (valueDelta && sys100NsInterval) {
+                return 100.0 * *valueDelta / *sys100NsInterval;
+            }
+            return std::nullopt;
+
+        case PerfObjectTimeTimer:
+            if (valueDelta && objectInterval) {
+                return 100.0 * *valueDelta / *objectInterval;
+            }
+            return std::nullopt;
+
+        case PerfPrecisionSystemTimer:
+        case PerfPrecision100NsTimer:
+        case PerfPrecisionObjectTimer:
+        case PerfSampleFraction:
+            if (valueDelta && baseDelta) {
+                return 100.0 * *valueDelta / *baseDelta;
+            }
+            return std::nullopt;
+
+        case PerfTimerInverse:
+            if (valueDelta && perfInterval) {
+                return 100.0 * (1.0 - *valueDelta / *perfInterval);
+            }
+            return std::nullopt;
+
+        case Perf100NsTimerInverse:
+            if (valueDelta && sys100NsInterval) {
+                return 100.0 * (1.0 - *valueDelta / *sys100NsInterval);
+            }
+            return std::nullopt;
+
+        case PerfMultiTimer:
+            if (valueDelta && perfInterval && current.base > 0) {
+                return 100.0 * (*valueDelta / *perfInterval) / current.base;
+            }
+            return std::nullopt;
+
+        case Perf100NsMultiTimer:
+            if (valueDelta && sys100NsInterval && current.base > 0) {
+                return 100.0 * (*valueDelta / *sys100NsInterval) / current.base;
+            }
+            return std::nullopt;
+
+        case PerfMultiTimerInverse:
+            if (valueDelta && perfInterval && current.base > 0) {
+                return 100.0 * (current.base - *valueDelta / *perfInterval) / current.base;
+            }
+            return std::nullopt;
+
+        case Perf100NsMultiTimerInverse:
+            if (valueDelta && sys100NsInterval && current.base > 0) {
+                return 100.0 * (current.base - *valueDelta / *sys100NsInterval) / current.base;
+            }
+            return std::nullopt;
+
+        case PerfAverageTimer:
+            if (valueDelta && baseDelta && current.perfFrequency > 0) {
+                return (*valueDelta / current.perfFrequency) / *baseDelta;
+            }
+            return std::nullopt;
+
+        case PerfAverageBulk:
+            if (valueDelta && baseDelta) {
+                return *valueDelta / *baseDelta;
+            }
+            return std::nullopt;
+
+        case PerfElapsedTime:
+            // The value is the start time, in the object's timer.
+            if (current.objectFrequency > 0 && current.objectTime >= current.value) {
+                return static_cast<double>(current.objectTime - current.value) / current.objectFrequency;
+            }
+            return std::nullopt;
+
+        default:
+            return std::nullopt;
+    }
+}
@@ -0,0 +1,110 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+/** The counter types from winperf.h which can be cooked, as found in the
+ * CounterType qualifier of Win32_PerfRawData properties.  These are kept
+ * separate from winperf.h so that this has no dependency on Windows.
+ */
+enum PerfCounterType : uint32_t {
+    // PERF_COUNTER_RAWCOUNT_HEX
+    PerfRawCountHex = 0x00000000,
+    // PERF_COUNTER_LARGE_RAWCOUNT_HEX
+    PerfLargeRawCountHex = 0x00000100,
+    // PERF_COUNTER_RAWCOUNT
+    PerfRawCount = 0x00010000,
+    // PERF_COUNTER_LARGE_RAWCOUNT
+    PerfLargeRawCount = 0x00010100,
+    // PERF_COUNTER_DELTA
+    PerfDelta = 0x00400400,
+    // PERF_COUNTER_LARGE_DELTA
+    PerfLargeDelta = 0x00400500,
+    // PERF_COUNTER_QUEUELEN_TYPE
+    PerfQueueLength = 0x00450400,
+    // PERF_COUNTER_LARGE_QUEUELEN_TYPE
+    PerfLargeQueueLength = 0x00450500,
+    // PERF_COUNTER_100NS_QUEUELEN_TYPE
+    Perf100NsQueueLength = 0x00550500,
+    // PERF_COUNTER_OBJ_TIME_QUEUELEN_TYPE
+    PerfObjectTimeQueueLength = 0x00650500,
+    // PERF_COUNTER_COUNTER
+    PerfCounter = 0x10410400,
+    // PERF_COUNTER_BULK_COUNT
+    PerfBulkCount = 0x10410500,
+    // PERF_RAW_FRACTION
+    PerfRawFraction = 0x20020400,
+    // PERF_LARGE_RAW_FRACTION
+    PerfLargeRawFraction = 0x20020500,
+    // PERF_COUNTER_TIMER
+    PerfTimer = 0x20410500,
+    // PERF_PRECISION_SYSTEM_TIMER
+    PerfPrecisionSystemTimer = 0x20470500,
+    // PERF_100NSEC_TIMER
+    Perf100NsTimer = 0x20510500,
+    // PERF_PRECISION_100NS_TIMER
+    PerfPrecision100NsTimer = 0x20570500,
+    // PERF_OBJ_TIME_TIMER
+    PerfObjectTimeTimer = 0x20610500,
+    // PERF_PRECISION_OBJECT_TIMER
+    PerfPrecisionObjectTimer = 0x20670500,
+    // PERF_SAMPLE_FRACTION
+    PerfSampleFraction = 0x20c20400,
+    // PERF_COUNTER_TIMER_INV
+    PerfTimerInverse = 0x21410500,
+    // PERF_100NSEC_TIMER_INV
+    Perf100NsTimerInverse = 0x21510500,
+    // PERF_COUNTER_MULTI_TIMER
+    PerfMultiTimer = 0x22410500,
+    // PERF_100NSEC_MULTI_TIMER
+    Perf100NsMultiTimer = 0x22510500,
+    // PERF_COUNTER_MULTI_TIMER_INV
+    PerfMultiTimerInverse = 0x23410500,
+    // PERF_100NSEC_MULTI_TIMER_INV
+    Perf100NsMultiTimerInverse = 0x23510500,
+    // PERF_AVERAGE_TIMER
+    PerfAverageTimer = 0x30020400,
+    // PERF_ELAPSED_TIME
+    PerfElapsedTime = 0x30240500,
+    // PERF_AVERAGE_BULK
+    PerfAverageBulk = 0x40020500,
+};
+
+/** One raw sample of a counter, with its base if it has one, and the
+ * timestamps and frequencies of the object it was sampled from, as found in
+ * the Timestamp_* and Frequency_* properties.
+ */
+struct PerfRawSample {
+    uint64_t value = 0;
+    uint64_t base = 0;
+    uint64_t perfTime = 0;
+    uint64_t perfFrequency = 0;
+    uint64_t sys100NsTime = 0;
+    uint64_t sys100NsFrequency = 0;
+    uint64_t objectTime = 0;
+    uint64_t objectFrequency = 0;
+};
+
+/** Whether the counter type can be cooked at all.
+ */
+bool perfCounterSupported(uint32_t type);
+
+/** Whether the counter type uses a base value, which is conventionally the
+ * property of the same name with a "_Base" suffix.
+ */
+bool perfCounterHasBase(uint32_t type);
+
+/** Whether cooking the counter type needs a previous sample.  If not, the
+ * previous sample is ignored.
+ */
+bool perfCounterNeedsPrevious(uint32_t type);
+
+/** Compute the formatted value of a counter from two raw samples, the same way
+ * the Win32_PerfFormattedData provider does.  Returns nothing if the type isn't
+ * supported, or if the samples can't produce a value, such as when no time
+ * passed between them, or the counter went backwards because it was reset.
+ */
+std::optional<double> perfCounterCook(uint32_t type, const PerfRawSample &previous, const PerfRawSample &current);
@@ -0,0 +1,238 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+template <typename Object, typename Output, typename ThreadScope>
+class ConvertPipeline;
+
+/** Converter threads shared by every class of one enumeration, so that they
+ * are started once per call rather than once per class.  Fetching threads
+ * push raw batches of Objects through a single bounded queue, and each batch
+ * is converted for the ConvertPipeline of its class.
+ *
+ * Each thread holds a ThreadScope for as long as it runs, such as the COM
+ * library.  If constructing it throws, every batch the thread takes fails with
+ * that error, rather than leave its fetcher waiting.
+ */
+template <typename Object, typename Output, typename ThreadScope>
+class ConverterPool {
+    public:
+        using Pipeline = ConvertPipeline<Object, Output, ThreadScope>;
+
+    private:
+        struct Batch {
+            Pipeline *pipeline;
+            size_t sequence;
+            std::vector<Object> objects;
+        };
+
+        std::mutex mutex;
+        std::condition_variable notFull;
+        std::condition_variable notEmpty;
+        std::deque<Batch> queue;
+        // Room for one waiting batch per converter, so that none of them has
+        // to wait for a fetcher while it is in Next.
+        const size_t capacity;
+        bool closed = false;
+        std::vector<std::thread> threads;
+
+        void run() {
+            std::exception_ptr scopeError;
+            std::optional<ThreadScope> scope;
+            try {
+                scope.emplace();
+            } catch (...) {
+                scopeError = std::current_exception();
+            }
+            while (true) {
+                Batch batch;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    notEmpty.wait(lock, [this]() { return !queue.empty() || closed; });
+                    if (queue.empty()) {
+                        return;
+                    }
+                    batch = std::move(queue.front());
+                    queue.pop_front();
+                }
+                notFull.notify_one();
+                batch.pipeline->convertBatch(batch.sequence, batch.objects, scopeError);
+            }
+        }
+
+    public:
+        explicit ConverterPool(const unsigned converters) : capacity(converters) {
+            for (unsigned converter = 0; converter < converters; ++converter) {
+                threads.emplace_back([this]() {
+                    run();
+                });
+            }
+        }
+
+        ConverterPool(const ConverterPool &) = delete;
+        ConverterPool &operator=(const ConverterPool &) = delete;
+
+        ~ConverterPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                closed = true;
+            }
+            notEmpty.notify_all();
+            for (auto &thread: threads) {
+                thread.join();
+            }
+        }
+
+        /** Hand over a batch, waiting while the queue is full.
+         */
+        void push(Pipeline * const pipeline, const size_t sequence, std::vector<Object> objects) {
+            std::unique_lock<std::mutex> lock(mutex);
+            notFull.wait(lock, [this]() { return queue.size() < capacity; });
+            queue.push_back(Batch{pipeline, sequence, std::move(objects)});
+            notEmpty.notify_one();
+        }
+
+        /** Take every queued batch of an abandoned class out of the queue, and
+         * return how many there were.
+         */
+        size_t drop(const Pipeline &pipeline) {
+            size_t dropped = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto it = queue.begin(); it != queue.end();) {
+                    if (it->pipeline == &pipeline) {
+                        it = queue.erase(it);
+                        ++dropped;
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            notFull.notify_all();
+            return dropped;
+        }
+};
+
+/** The second stage of a pipelined class enumeration.  The fetching thread
+ * pushes raw batches into the enumeration's ConverterPool, convert turns each
+ * one into an Output on a converter thread, and the outputs are put back in
+ * fetch order at the end.  The objects are released on the converter thread,
+ * once converted.
+ */
+template <typename Object, typename Output, typename ThreadScope>
+class ConvertPipeline {
+    public:
+        using Pool = ConverterPool<Object, Output, ThreadScope>;
+        using Convert = std::function<Output(std::vector<Object> &)>;
+
+    private:
+        Pool &pool;
+        const Convert convert;
+
+        std::mutex mutex;
+        std::condition_variable idle;
+        // Batches pushed and not yet converted or dropped.
+        size_t outstanding = 0;
+        std::exception_ptr error;
+
+        // Indexed by sequence.  A deque, so that converters' elements stay put
+        // while the fetcher adds more.
+        std::deque<Output> converted;
+
+        // Called with the mutex held.
+        void done() {
+            if (--outstanding == 0) {
+                idle.notify_all();
+            }
+        }
+
+    public:
+        ConvertPipeline(Pool &pool, Convert convert) : pool(pool), convert(std::move(convert)) {
+        }
+
+        ConvertPipeline(const ConvertPipeline &) = delete;
+        ConvertPipeline &operator=(const ConvertPipeline &) = delete;
+
+        /** The converters hold this pipeline's references until its last
+         * batch is done, so an abandoned class drops what is still queued and
+         * waits for the rest.
+         */
+        ~ConvertPipeline() {
+            const size_t dropped = pool.drop(*this);
+            std::unique_lock<std::mutex> lock(mutex);
+            outstanding -= dropped;
+            idle.wait(lock, [this]() { return outstanding == 0; });
+        }
+
+        /** Hand over a batch, waiting while the pool's queue is full.
+         * Rethrows the first converter error, so that fetching stops with it.
+         */
+        void push(std::vector<Object> objects) {
+            size_t sequence;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+                sequence = converted.size();
+                converted.emplace_back();
+                ++outstanding;
+            }
+            pool.push(this, sequence, std::move(objects));
+        }
+
+        /** Wait for everything to be converted, and take the outputs in fetch
+         * order.  Rethrows the first converter error.
+         */
+        std::deque<Output> finish() {
+            std::unique_lock<std::mutex> lock(mutex);
+            idle.wait(lock, [this]() { return outstanding == 0; });
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            return std::move(converted);
+        }
+
+        /** Convert one batch on a converter thread.  Nothing is converted
+         * after the first error, but every batch is still accounted for.
+         */
+        void convertBatch(const size_t sequence, std::vector<Object> &objects, const std::exception_ptr &scopeError) {
+            try {
+                if (scopeError) {
+                    std::rethrow_exception(scopeError);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (error) {
+                        objects.clear();
+                        done();
+                        return;
+                    }
+                }
+                Output output = convert(objects);
+                objects.clear();
+                std::lock_guard<std::mutex> lock(mutex);
+                converted[sequence] = std::move(output);
+                done();
+            } catch (...) {
+                objects.clear();
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                done();
+            }
+        }
+};
@@ -0,0 +1,129 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include "nextwait.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+/** Keeps calling fetch on a background thread up to depth batches ahead of
+ * the caller, so that the provider produces the next batch while the caller
+ * is busy with the current one.  A depth of 1 is double buffering.
+ *
+ * fetch is called with a timeout in milliseconds, and returns an empty batch
+ * if nothing arrived within it, or nullopt at the end.  It is always given
+ * cancelInterval, so that stopping is noticed.  The thread holds a ThreadScope
+ * for as long as it runs, such as the COM library.
+ */
+template <typename Batch, typename ThreadScope>
+class Prefetcher {
+    public:
+        using Fetch = std::function<std::optional<Batch>(long timeout)>;
+
+    private:
+        const Fetch fetch;
+        const size_t depth;
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        // A nullopt batch marks the end.
+        std::deque<std::optional<Batch>> ready;
+        std::exception_ptr error;
+        bool stopping = false;
+
+        std::thread thread;
+
+        void run() {
+            try {
+                [[maybe_unused]] ThreadScope scope;
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [this]() { return ready.size() < depth || stopping; });
+                        if (stopping) {
+                            return;
+                        }
+                    }
+                    std::optional<Batch> batch = fetch(cancelInterval);
+                    if (batch && batch->empty()) {
+                        continue;
+                    }
+                    const bool end = !batch;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        ready.push_back(std::move(batch));
+                    }
+                    changed.notify_all();
+                    if (end) {
+                        return;
+                    }
+                }
+            } catch (...) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    error = std::current_exception();
+                }
+                changed.notify_all();
+            }
+        }
+
+    public:
+        Prefetcher(Fetch fetch, const size_t depth) : fetch(std::move(fetch)), depth(depth) {
+            thread = std::thread([this]() {
+                run();
+            });
+        }
+
+        Prefetcher(const Prefetcher &) = delete;
+        Prefetcher &operator=(const Prefetcher &) = delete;
+
+        ~Prefetcher() {
+            stop();
+        }
+
+        /** Stop the background thread, and wait for it.  After this, fetch is
+         * never called again.
+         */
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            changed.notify_all();
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+
+        /** The same as calling fetch, but taking what the background thread
+         * has already fetched.  timeout may be waitInfinite.
+         */
+        std::optional<Batch> next(const long timeout = waitInfinite) {
+            std::unique_lock<std::mutex> lock(mutex);
+            const auto available = [this]() { return !ready.empty() || error; };
+            if (timeout == waitInfinite) {
+                changed.wait(lock, available);
+            } else if (!changed.wait_for(lock, std::chrono::milliseconds(timeout), available)) {
+                return std::make_optional<Batch>();
+            }
+            // Fetched batches are handed over before any error after them.
+            if (ready.empty()) {
+                std::rethrow_exception(error);
+            }
+            std::optional<Batch> output = std::move(ready.front());
+            ready.pop_front();
+            lock.unlock();
+            changed.notify_all();
+            return output;
+        }
+};
@@ -0,0 +1,55 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "propertyfilter.h"
+
+#include <atomic>
+#include <unordered_map>
+
+// Ids start at 1, so that no filter matches a thread's empty memo.
+static std::atomic<uint64_t> lastId{0};
+
+// A filter over every class with every property could otherwise remember
+// every property name in the namespace.
+static constexpr size_t memoLimit = 4096;
+
+PropertyFilter::PropertyFilter() : id(++lastId) {
+}
+
+PropertyFilter::PropertyFilter(const std::wregex &regex) : regexes{&regex}, id(++lastId) {
+}
+
+PropertyFilter::PropertyFilter(const std::wregex &regex, const std::wstring &pattern) : PropertyFilter() {
+    add(regex, pattern);
+}
+
+void PropertyFilter::add(const std::wregex &regex, const std::wstring &pattern) {
+    regexes.push_back(&regex);
+    key.append(pattern);
+    key.push_back(L'\0');
+    // Whatever was remembered under the old id no longer holds.
+    id = ++lastId;
+}
+
+bool PropertyFilter::matches(const std::wstring &property) const {
+    thread_local uint64_t memoId = 0;
+    thread_local std::unordered_map<std::wstring, bool> memo;
+    if (memoId != id || memo.size() >= memoLimit) {
+        memo.clear();
+        memoId = id;
+    }
+    const auto found = memo.find(property);
+    if (found != memo.end()) {
+        return found->second;
+    }
+    bool output = false;
+    for (const auto regex: regexes) {
+        if (std::regex_match(property, *regex)) {
+            output = true;
+            break;
+        }
+    }
+    memo.emplace(property, output);
+    return output;
+}
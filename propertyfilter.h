@@ -0,0 +1,43 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <vector>
+
+/** The properties to keep from each instance, which are those matching any one
+ * of a set of regexes.  Usually there is just one, but a coalesced scheduler
+ * pass fetches the union of several jobs' properties at once.
+ */
+struct PropertyFilter {
+    // Only to be changed directly before the first match; add otherwise.
+    std::vector<const std::wregex *> regexes;
+
+    // Identifies the filter in the result cache: each added pattern, followed
+    // by a null.  Empty for a filter made straight from a regex, which must
+    // not be cached.
+    std::wstring key;
+
+    // Identifies this set of regexes in each thread's memo of matches.
+    uint64_t id;
+
+    PropertyFilter();
+
+    PropertyFilter(const std::wregex &regex);
+
+    PropertyFilter(const std::wregex &regex, const std::wstring &pattern);
+
+    /** Also keep properties matching regex, which was built from pattern.
+     */
+    void add(const std::wregex &regex, const std::wstring &pattern);
+
+    /** Every instance of a class asks about the same few dozen names, and
+     * regex_match allocates on every call, so each thread remembers the
+     * answers for the last filter it used.  Once a name has been seen, this
+     * neither allocates nor runs a regex.
+     */
+    bool matches(const std::wstring &property) const;
+};
@@ -0,0 +1,35 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/** The per-property loop of instance conversion, for an object which has
+ * already begun enumerating its properties.
+ *
+ * next(name, value, type) overwrites name, value and type in place with the
+ * next property, and returns false at the end.  matches(name) says whether to
+ * keep a property, and store(property, name, value, type) writes a kept one
+ * into the element just added to properties.
+ *
+ * The name is scratch space reused by every instance converted on this
+ * thread, the value and type live on the stack, and properties is reserved to
+ * the count of the last instance, so once warmed up, the only allocations are
+ * the ones store makes for what it keeps.
+ */
+template <typename Value, typename Type, typename Properties, typename Next, typename Matches, typename Store>
+void convertProperties(Properties &properties, Next &&next, Matches &&matches, Store &&store) {
+    thread_local std::wstring name;
+    thread_local size_t lastPropertyCount = 0;
+    Value value;
+    Type type;
+    properties.reserve(lastPropertyCount);
+    while (next(name, value, type)) {
+        if (matches(name)) {
+            store(properties.emplace_back(), name, value, type);
+        }
+    }
+    lastPropertyCount = properties.size();
+}
@@ -0,0 +1,142 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** How a sampled integer property is read and widened.  Mirrors the CIM
+ * integer types, which are mapped onto this in wmienumall.cxx.
+ */
+enum SampleKind : int {
+    SampleUnsigned32 = 0,
+    SampleSigned32 = 1,
+    Sample64 = 2,
+};
+
+/** The latest values of one class registered with a refresher.  Property
+ * handles are resolved once, from the first instance seen, and the values are
+ * kept in a flat array which is only reallocated when the instance count
+ * grows, so that once warmed up a refresh doesn't allocate.
+ *
+ * Traits is the refresher's interface, as static functions:
+ *
+ *     using Enum;    // The refreshed enum of instances
+ *     using Object;  // One refreshed instance, which has to be released
+ *     // Fill objects, or return false with returned set to the number needed.
+ *     static bool objects(Enum &, Object *objects, size_t capacity, size_t &returned);
+ *     static void release(Object);
+ *     static long handle(Object, const wchar_t *key, SampleKind &kind);
+ *     static bool nameHandle(Object, long &handle);
+ *     static uint32_t readDword(Object, long handle);
+ *     static uint64_t readQword(Object, long handle);
+ *     // Fill buffer, or return false if it is too small.  length is in
+ *     // characters, including the terminator, either way.
+ *     static bool readString(Object, long handle, wchar_t *buffer, size_t capacity, size_t &length);
+ *
+ * Anything may throw, and every object is still released.
+ */
+template <typename Traits>
+struct SampledClass {
+    using Object = typename Traits::Object;
+
+    // The matching integer properties, from the class definition.
+    std::vector<std::wstring> keys;
+    std::vector<SampleKind> kinds;
+
+    std::vector<long> handles;
+    long nameHandle = 0;
+    bool hasName = false;
+    bool resolved = false;
+
+    // Scratch space for the objects, reused on every refresh.
+    std::vector<Object> objects;
+
+    size_t instanceCount = 0;
+    // instanceCount rows of keys.size() values
+    std::vector<uint64_t> values;
+    std::vector<std::wstring> names;
+
+    /** Resolve property handles from an instance of the class.
+     */
+    void resolve(const Object object) {
+        handles.resize(keys.size());
+        for (size_t property = 0; property < keys.size(); ++property) {
+            handles[property] = Traits::handle(object, keys[property].c_str(), kinds[property]);
+        }
+        hasName = Traits::nameHandle(object, nameHandle);
+        resolved = true;
+    }
+
+    /** Read all the values of one instance into its row.
+     */
+    void read(const Object object, const size_t instance) {
+        uint64_t * const row = values.data() + instance * keys.size();
+        for (size_t property = 0; property < keys.size(); ++property) {
+            switch (kinds[property]) {
+                case Sample64:
+                    row[property] = Traits::readQword(object, handles[property]);
+                    break;
+                case SampleSigned32:
+                    row[property] = static_cast<uint64_t>(static_cast<int64_t>(static_cast<int32_t>(Traits::readDword(object, handles[property]))));
+                    break;
+                default:
+                    row[property] = Traits::readDword(object, handles[property]);
+                    break;
+            }
+        }
+        if (hasName) {
+            auto &name = names[instance];
+            // Strings grow to fit, and then keep their capacity, so this only
+            // allocates until the longest name has been seen.
+            name.resize(std::max<size_t>(name.capacity(), 64));
+            size_t length = 0;
+            if (!Traits::readString(object, nameHandle, name.data(), name.size(), length)) {
+                name.resize(length);
+                Traits::readString(object, nameHandle, name.data(), name.size(), length);
+            }
+            name.resize(length > 0 ? length - 1 : 0);
+        }
+    }
+
+    /** Fetch the current instances from the refreshed enum and read them.
+     */
+    void refresh(typename Traits::Enum &source) {
+        size_t returned = 0;
+        if (objects.empty()) {
+            objects.resize(16);
+        }
+        while (!Traits::objects(source, objects.data(), objects.size(), returned)) {
+            objects.resize(returned);
+        }
+
+        // Every returned object has to be released, even if reading fails.
+        struct Releaser {
+            Object *objects;
+            size_t count;
+            ~Releaser() {
+                for (size_t i = 0; i < count; ++i) {
+                    Traits::release(objects[i]);
+                }
+            }
+        } releaser{objects.data(), returned};
+
+        if (returned > 0 && !resolved) {
+            resolve(objects[0]);
+        }
+        instanceCount = returned;
+        if (values.size() < instanceCount * keys.size()) {
+            values.resize(instanceCount * keys.size());
+        }
+        if (hasName && names.size() < instanceCount) {
+            names.resize(instanceCount);
+        }
+        for (size_t instance = 0; instance < instanceCount; ++instance) {
+            read(objects[instance], instance);
+        }
+    }
+};
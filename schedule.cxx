@@ -0,0 +1,89 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "schedule.h"
+
+#include <algorithm>
+
+Schedule::Clock::duration Schedule::randomDelay(const std::chrono::milliseconds max) {
+    if (max.count() <= 0) {
+        return Clock::duration::zero();
+    }
+    std::uniform_int_distribution<int64_t> distribution(0, std::chrono::duration_cast<Clock::duration>(max).count());
+    return Clock::duration(distribution(random));
+}
+
+size_t Schedule::add(const std::wstring &classRegex, const std::wstring &propertyRegex, const std::chrono::milliseconds interval, const Clock::time_point now) {
+    ScheduledJob job{0, propertyRegex, std::wregex(classRegex), std::wregex(propertyRegex), interval, {}, {}};
+    job.id = nextId++;
+    job.base = now + randomDelay(interval);
+    job.due = job.base;
+    jobs.push_back(std::move(job));
+    return jobs.back().id;
+}
+
+bool Schedule::remove(const size_t id) {
+    const auto it = std::find_if(jobs.begin(), jobs.end(), [id](const ScheduledJob &job) {
+        return job.id == id;
+    });
+    if (it == jobs.end()) {
+        return false;
+    }
+    jobs.erase(it);
+    return true;
+}
+
+std::optional<Schedule::Clock::time_point> Schedule::earliest() const {
+    if (jobs.empty()) {
+        return std::nullopt;
+    }
+    return std::min_element(jobs.begin(), jobs.end(), [](const ScheduledJob &a, const ScheduledJob &b) {
+        return a.due < b.due;
+    })->due;
+}
+
+std::vector<ScheduledJob> Schedule::takeDue(const Clock::time_point now) {
+    std::vector<ScheduledJob> output;
+    for (auto &job: jobs) {
+        if (job.due <= now + window) {
+            output.push_back(job);
+            // Scheduled from the previous unjittered time, so jobs don't
+            // drift, unless they are so late that they would run back to
+            // back.
+            job.base = std::max(job.base + job.interval, now);
+            job.due = job.base + randomDelay(jitter);
+        }
+    }
+    return output;
+}
+
+PassCounts runSchedulePass(
+        const std::vector<ScheduledJob> &due,
+        const std::function<bool(std::wstring &className)> &nextClass,
+        const std::function<bool(const std::wstring &className, const PassClass &wanting)> &fetch) {
+    PassCounts output;
+    std::wstring className;
+    while (nextClass(className)) {
+        // The jobs that want this class, and their property patterns, each
+        // only once.
+        PassClass wanting;
+        for (size_t job = 0; job < due.size(); ++job) {
+            if (std::regex_match(className, due[job].cRegex)) {
+                wanting.jobs.push_back(job);
+                const auto &pattern = due[job].propertyPattern;
+                if (std::none_of(wanting.patterns.begin(), wanting.patterns.end(), [&due, &pattern](const size_t p) { return due[p].propertyPattern == pattern; })) {
+                    wanting.patterns.push_back(job);
+                }
+            }
+        }
+        if (wanting.jobs.empty()) {
+            continue;
+        }
+        output.classRequests += wanting.jobs.size();
+        if (fetch(className, wanting)) {
+            ++output.classFetches;
+        }
+    }
+    return output;
+}
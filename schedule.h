@@ -0,0 +1,94 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+/** A periodic job, as far as its timing and what it fetches go.
+ */
+struct ScheduledJob {
+    size_t id;
+    std::wstring propertyPattern;
+    std::wregex cRegex;
+    std::wregex pRegex;
+    std::chrono::milliseconds interval;
+    // When the job would be due without jitter, which advances by exactly the
+    // interval each run, so that jitter never accumulates.
+    std::chrono::steady_clock::time_point base;
+    std::chrono::steady_clock::time_point due;
+};
+
+/** The jobs of a scheduler and when each is due.  This has no threads and
+ * never reads the clock, as every method takes the current time, so that it
+ * can be driven by a virtual clock.
+ */
+struct Schedule {
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<ScheduledJob> jobs;
+    size_t nextId = 1;
+    std::chrono::milliseconds window{500};
+    std::chrono::milliseconds jitter{0};
+    std::mt19937_64 random{std::random_device()()};
+
+    /** A random delay from 0 up to and including max.
+     */
+    Clock::duration randomDelay(std::chrono::milliseconds max);
+
+    /** Add a job and return its id.  The first run is spread over a whole
+     * interval, so that a fleet of agents started together doesn't poll in
+     * lockstep.  Throws std::regex_error on a bad regex.
+     */
+    size_t add(const std::wstring &classRegex, const std::wstring &propertyRegex, std::chrono::milliseconds interval, Clock::time_point now);
+
+    /** Remove a job, returning false if there is none with the id.
+     */
+    bool remove(size_t id);
+
+    /** When the earliest job is due, or nothing if there are no jobs.
+     */
+    std::optional<Clock::time_point> earliest() const;
+
+    /** Take every job due by now plus the coalescing window, and move their due
+     * times on.
+     */
+    std::vector<ScheduledJob> takeDue(Clock::time_point now);
+};
+
+/** The jobs of a pass that want one class.
+ */
+struct PassClass {
+    // Indices into the pass's jobs.
+    std::vector<size_t> jobs;
+    // Indices into the pass's jobs of the first job with each distinct
+    // property pattern among them.
+    std::vector<size_t> patterns;
+};
+
+/** Counts from one pass.  Class requests count each class once per job that
+ * wanted it, and class fetches once per pass.
+ */
+struct PassCounts {
+    uint64_t classRequests = 0;
+    uint64_t classFetches = 0;
+};
+
+/** Run one coalesced pass over the due jobs.  nextClass sets the name of each
+ * class in turn, and returns false at the end.  fetch is called at most once
+ * per class that any job wants, with all of those jobs, and returns whether it
+ * fetched the class, as opposed to skipping it, such as a class known to be
+ * empty.
+ */
+PassCounts runSchedulePass(
+        const std::vector<ScheduledJob> &due,
+        const std::function<bool(std::wstring &className)> &nextClass,
+        const std::function<bool(const std::wstring &className, const PassClass &wanting)> &fetch);
@@ -0,0 +1,32 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/** Scoped timer, which adds the elapsed nanoseconds to a counter when it goes
+ * out of scope.  If the counter is null, this does nothing, so disabled stats
+ * cost only a branch.
+ */
+struct ScopedTimer {
+        uint64_t *counter;
+        std::chrono::steady_clock::time_point start;
+
+        ScopedTimer(uint64_t *counter) : counter(counter) {
+            if (counter) {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+        ~ScopedTimer() {
+            if (counter) {
+                *counter += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+            }
+        }
+};
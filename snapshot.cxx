@@ -0,0 +1,152 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "snapshot.h"
+
+#include <cstring>
+#include <stdexcept>
+
+const char snapshotMagic[8] = {'W', 'M', 'I', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t snapshotVersion = 3;
+
+SnapshotView::SnapshotView(const char * const data, const uint64_t size) : data(data), header(reinterpret_cast<const SnapshotHeader *>(data)) {
+    if (size < sizeof(SnapshotHeader)) {
+        throw std::runtime_error("Snapshot is truncated.");
+    }
+    if (std::memcmp(header->magic, snapshotMagic, sizeof(snapshotMagic)) != 0) {
+        throw std::runtime_error("Not a snapshot file.");
+    }
+    if (header->version != snapshotVersion) {
+        throw std::runtime_error("Unsupported snapshot version.");
+    }
+    if (header->fileSize != size
+            || header->classesOffset % alignof(SnapshotClass) != 0
+            || header->instancesOffset % alignof(SnapshotInstance) != 0
+            || header->propertiesOffset % alignof(SnapshotProperty) != 0
+            || header->classesOffset > size
+            || header->classCount > (size - header->classesOffset) / sizeof(SnapshotClass)
+            || header->instancesOffset > size
+            || header->instanceCount > (size - header->instancesOffset) / sizeof(SnapshotInstance)
+            || header->propertiesOffset > size
+            || header->propertyCount > (size - header->propertiesOffset) / sizeof(SnapshotProperty)
+            || header->stringsOffset % sizeof(char16_t) != 0
+            || header->stringsOffset > size - sizeof(char16_t)
+            || *reinterpret_cast<const char16_t *>(data + size - sizeof(char16_t)) != u'\0') {
+        throw std::runtime_error("Snapshot is corrupt.");
+    }
+}
+
+const SnapshotClass *SnapshotView::snapshotClass(const size_t index) const {
+    if (index < header->classCount) {
+        const SnapshotClass * const output = reinterpret_cast<const SnapshotClass *>(data + header->classesOffset) + index;
+        if (output->firstInstance <= header->instanceCount && output->instanceCount <= header->instanceCount - output->firstInstance) {
+            return output;
+        }
+    }
+    return nullptr;
+}
+
+const SnapshotInstance *SnapshotView::instance(const size_t index) const {
+    if (index < header->instanceCount) {
+        return reinterpret_cast<const SnapshotInstance *>(data + header->instancesOffset) + index;
+    }
+    return nullptr;
+}
+
+const SnapshotProperty *SnapshotView::property(const SnapshotInstance &instance, const size_t index) const {
+    if (index < instance.propertyCount && instance.firstProperty + index < header->propertyCount) {
+        return reinterpret_cast<const SnapshotProperty *>(data + header->propertiesOffset) + instance.firstProperty + index;
+    }
+    return nullptr;
+}
+
+const char16_t *SnapshotView::string(const uint64_t offset) const {
+    if (offset >= header->stringsOffset && offset < header->fileSize && offset % sizeof(char16_t) == 0) {
+        return reinterpret_cast<const char16_t *>(data + offset);
+    }
+    return nullptr;
+}
+
+SnapshotWriter::SnapshotWriter(const uint64_t classCount, const uint64_t instanceCount, const uint64_t propertyCount) {
+    std::memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+    header.version = snapshotVersion;
+    header.classCount = classCount;
+    header.classesOffset = sizeof(SnapshotHeader);
+    header.instanceCount = instanceCount;
+    header.instancesOffset = header.classesOffset + classCount * sizeof(SnapshotClass);
+    header.propertyCount = propertyCount;
+    header.propertiesOffset = header.instancesOffset + instanceCount * sizeof(SnapshotInstance);
+    header.stringsOffset = header.propertiesOffset + propertyCount * sizeof(SnapshotProperty);
+    classes.reserve(classCount);
+    instances.reserve(instanceCount);
+    properties.reserve(propertyCount);
+}
+
+void SnapshotWriter::addClass(const char16_t * const className, const uint64_t instanceCount) {
+    classes.push_back(SnapshotClass{
+        internString(className),
+        instances.size(),
+        instanceCount});
+}
+
+void SnapshotWriter::addInstance(const char16_t * const className, const char16_t * const path, const uint64_t propertyCount) {
+    instances.push_back(SnapshotInstance{
+        internString(className),
+        addString(path),
+        properties.size(),
+        propertyCount});
+}
+
+void SnapshotWriter::addProperty(const char16_t * const key, const char16_t * const value) {
+    properties.push_back(SnapshotProperty{internString(key), addString(value)});
+}
+
+std::vector<std::pair<const void *, size_t>> SnapshotWriter::finish() {
+    if (classes.size() != header.classCount || instances.size() != header.instanceCount || properties.size() != header.propertyCount) {
+        throw std::logic_error("Snapshot counts don't match what was added.");
+    }
+    uint64_t nextInstance = 0;
+    for (const auto &snapshotClass: classes) {
+        if (snapshotClass.firstInstance != nextInstance) {
+            throw std::logic_error("Snapshot classes don't match the instances added.");
+        }
+        nextInstance += snapshotClass.instanceCount;
+    }
+    if (nextInstance != header.instanceCount) {
+        throw std::logic_error("Snapshot classes don't match the instances added.");
+    }
+    // The file must always end in a terminator, even with no strings.
+    strings.push_back(u'\0');
+    header.fileSize = header.stringsOffset + strings.size() * sizeof(char16_t);
+    return {
+        {&header, sizeof(header)},
+        {classes.data(), classes.size() * sizeof(SnapshotClass)},
+        {instances.data(), instances.size() * sizeof(SnapshotInstance)},
+        {properties.data(), properties.size() * sizeof(SnapshotProperty)},
+        {strings.data(), strings.size() * sizeof(char16_t)}};
+}
+
+uint64_t SnapshotWriter::addString(const char16_t *string) {
+    if (!string) {
+        // Only possible when resaving a corrupt snapshot
+        string = u"";
+    }
+    const uint64_t offset = header.stringsOffset + strings.size() * sizeof(char16_t);
+    strings.append(string);
+    strings.push_back(u'\0');
+    return offset;
+}
+
+uint64_t SnapshotWriter::internString(const char16_t *string) {
+    if (!string) {
+        string = u"";
+    }
+    const auto it = interned.find(string);
+    if (it != interned.end()) {
+        return it->second;
+    }
+    const uint64_t offset = addString(string);
+    interned.emplace(string, offset);
+    return offset;
+}
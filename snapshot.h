@@ -0,0 +1,133 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Snapshot file layout.  Everything is little-endian and offsets are in bytes
+// from the start of the file.  The header is followed by the class table, then
+// the instance table, then the property table, then all of the strings, which are null-terminated
+// UTF-16.  The strings are last so that the file always ends in a null
+// terminator, which means that an in-range string offset can never read past
+// the end of the mapping, and only offsets need to be checked on access.
+//
+// The class table gives the range of instances of each class, in instance
+// order, so that classes are indexed without reading every instance.
+//
+// Strings are char16_t here, so that this has no dependency on Windows, where
+// they are served directly as wchar_t.
+extern const char snapshotMagic[8];
+extern const uint32_t snapshotVersion;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t classCount;
+    uint64_t classesOffset;
+    uint64_t instanceCount;
+    uint64_t instancesOffset;
+    uint64_t propertyCount;
+    uint64_t propertiesOffset;
+    uint64_t stringsOffset;
+    uint64_t fileSize;
+};
+
+struct SnapshotClass {
+    uint64_t className;
+    uint64_t firstInstance;
+    uint64_t instanceCount;
+};
+
+struct SnapshotInstance {
+    uint64_t className;
+    uint64_t path;
+    uint64_t firstProperty;
+    uint64_t propertyCount;
+};
+
+struct SnapshotProperty {
+    uint64_t key;
+    uint64_t value;
+};
+
+/** Read-only view of a whole snapshot file in memory, such as a mapping of it.
+ * Opening it only checks the header, so it costs the same no matter how big
+ * the snapshot is; every access is then bounds checked against the header.
+ */
+struct SnapshotView {
+    const char *data;
+    const SnapshotHeader *header;
+
+    /** Check the header of size bytes at data, which must be aligned for it.
+     * Throws std::runtime_error if it isn't a valid snapshot.
+     */
+    SnapshotView(const char *data, uint64_t size);
+
+    size_t classCount() const {
+        return header->classCount;
+    }
+
+    size_t instanceCount() const {
+        return header->instanceCount;
+    }
+
+    /** Get a class record, or null on bad index, or if its instances aren't
+     * all in the instance table.
+     */
+    const SnapshotClass *snapshotClass(size_t index) const;
+
+    /** Get an instance record, or null on bad index.
+     */
+    const SnapshotInstance *instance(size_t index) const;
+
+    /** Get a property record of an instance, or null on bad index.
+     */
+    const SnapshotProperty *property(const SnapshotInstance &instance, size_t index) const;
+
+    /** Get a string, or null on bad offset.
+     */
+    const char16_t *string(uint64_t offset) const;
+};
+
+/** Builds a snapshot file in memory.  The number of classes, instances and
+ * properties must be known up front, as the string offsets depend on them.
+ * Null strings are written as empty.
+ */
+struct SnapshotWriter {
+    SnapshotHeader header{};
+    std::vector<SnapshotClass> classes;
+    std::vector<SnapshotInstance> instances;
+    std::vector<SnapshotProperty> properties;
+    std::u16string strings;
+
+    // Class names and keys repeat constantly, so they are stored once.
+    std::unordered_map<std::u16string, uint64_t> interned;
+
+    SnapshotWriter(uint64_t classCount, uint64_t instanceCount, uint64_t propertyCount);
+
+    /** Add a class, whose instanceCount instances must be added next.
+     */
+    void addClass(const char16_t *className, uint64_t instanceCount);
+
+    /** Add an instance, whose propertyCount properties must be added next.
+     */
+    void addInstance(const char16_t *className, const char16_t *path, uint64_t propertyCount);
+
+    void addProperty(const char16_t *key, const char16_t *value);
+
+    /** Finish the file, and return its pieces, in order.  They point into the
+     * writer, so it must outlive them.
+     */
+    std::vector<std::pair<const void *, size_t>> finish();
+
+private:
+    uint64_t addString(const char16_t *string);
+    uint64_t internString(const char16_t *string);
+};
@@ -0,0 +1,154 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../batchsizer.h"
+#include "check.h"
+
+#include <limits>
+
+using namespace std::chrono_literals;
+
+/** Record a full batch of the current size, taking perObject per object.
+ */
+static void full(BatchSizer &sizer, const std::chrono::nanoseconds perObject) {
+    sizer.record(sizer.size, sizer.size, perObject * sizer.size);
+}
+
+static void testDefaultIsFixed() {
+    BatchSizer sizer;
+    CHECK(sizer.size == 128);
+    full(sizer, 1ns);
+    full(sizer, 1ns / 2);
+    CHECK(sizer.size == 128);
+}
+
+static void testConfigureClamps() {
+    BatchSizer sizer;
+    sizer.configure(0, 0, 100ms);
+    CHECK(sizer.minimum == 1);
+    CHECK(sizer.maximum == 1);
+    CHECK(sizer.size == 1);
+
+    sizer.configure(16, 8, 100ms);
+    CHECK(sizer.minimum == 16);
+    CHECK(sizer.maximum == 16);
+    CHECK(sizer.size == 16);
+
+    sizer.configure(1, std::numeric_limits<uint32_t>::max(), 100ms);
+    CHECK(sizer.maximum == BatchSizer::cap);
+    CHECK(sizer.size == 128);
+
+    sizer.configure(std::numeric_limits<uint32_t>::max(), std::numeric_limits<uint32_t>::max(), 100ms);
+    CHECK(sizer.minimum == BatchSizer::cap);
+    CHECK(sizer.size == BatchSizer::cap);
+}
+
+/** Grows by doubling while the time per object falls, and saturates at the
+ * maximum rather than overshooting it.
+ */
+static void testGrow() {
+    BatchSizer sizer;
+    sizer.configure(1, 1000, 100ms);
+    CHECK(sizer.size == 128);
+    // The first full batch has nothing to compare with.
+    full(sizer, 1000ns);
+    CHECK(sizer.size == 256);
+    full(sizer, 900ns);
+    CHECK(sizer.size == 512);
+    // Not faster, so no growth.
+    full(sizer, 900ns);
+    CHECK(sizer.size == 512);
+    full(sizer, 100ns);
+    CHECK(sizer.size == 1000);
+    full(sizer, 50ns);
+    CHECK(sizer.size == 1000);
+}
+
+static void testGrowSaturatesAtCap() {
+    BatchSizer sizer;
+    sizer.configure(3000, std::numeric_limits<uint32_t>::max(), 1h);
+    CHECK(sizer.size == 3000);
+    full(sizer, 10ns);
+    CHECK(sizer.size == BatchSizer::cap);
+    for (int i = 0; i < 64; ++i) {
+        full(sizer, 10ns / (i + 2));
+        CHECK(sizer.size == BatchSizer::cap);
+    }
+}
+
+/** Halves on a slow batch, and never grows back past what fit.
+ */
+static void testShrink() {
+    BatchSizer sizer;
+    sizer.configure(50, 1024, 100ms);
+    full(sizer, 100ns);
+    full(sizer, 90ns);
+    CHECK(sizer.size == 512);
+    sizer.record(512, 512, 200ms);
+    CHECK(sizer.size == 256);
+    CHECK(sizer.ceiling == 256);
+    full(sizer, 10ns);
+    full(sizer, 5ns);
+    CHECK(sizer.size == 256);
+
+    // Never below the minimum.
+    sizer.record(256, 256, 200ms);
+    CHECK(sizer.size == 128);
+    sizer.record(128, 128, 200ms);
+    CHECK(sizer.size == 64);
+    sizer.record(64, 64, 200ms);
+    CHECK(sizer.size == 50);
+    sizer.record(50, 50, 200ms);
+    CHECK(sizer.size == 50);
+}
+
+/** A short batch is the end of the enumeration, or a timeout, and changes
+ * nothing.
+ */
+static void testShortBatchIgnored() {
+    BatchSizer sizer;
+    sizer.configure(1, 1024, 100ms);
+    sizer.record(128, 0, 1s);
+    sizer.record(128, 127, 1s);
+    CHECK(sizer.size == 128);
+    CHECK(sizer.perObject == 0.0);
+}
+
+/** A batch cut short by the wait halves the size if it arrived too slowly to
+ * be filled within the target, and otherwise changes nothing.
+ */
+static void testTimedOutBatch() {
+    BatchSizer sizer;
+    sizer.configure(1, 4096, 100ms);
+    full(sizer, 100ns);
+    CHECK(sizer.size == 256);
+    // 100 of 256 in the 50ms wait would take 128ms for all of them.
+    sizer.recordTimeout(256, 100, 50ms);
+    CHECK(sizer.size == 128);
+    CHECK(sizer.ceiling == 128);
+    CHECK(sizer.perObject == 0.0);
+    // 100 of 128 in 50ms would fill it in 64ms.
+    sizer.recordTimeout(128, 100, 50ms);
+    CHECK(sizer.size == 128);
+    // Nothing at all, or a full batch, says nothing.
+    sizer.recordTimeout(128, 0, 50ms);
+    sizer.recordTimeout(128, 128, 1s);
+    CHECK(sizer.size == 128);
+
+    // Never below the minimum.
+    sizer.configure(100, 4096, 1ms);
+    sizer.recordTimeout(100, 1, 50ms);
+    CHECK(sizer.size == 100);
+}
+
+int main() {
+    testDefaultIsFixed();
+    testConfigureClamps();
+    testGrow();
+    testGrowSaturatesAtCap();
+    testShrink();
+    testShortBatchIgnored();
+    testTimedOutBatch();
+    return checkFailures();
+}
@@ -0,0 +1,36 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include <cmath>
+#include <iostream>
+
+/** Minimal checks for the native tests of the Windows-free modules.  A failed
+ * check is reported and counted, and the test carries on, so that one run
+ * shows every failure.  Tests return checkFailures() from main.
+ */
+inline int &checkFailureCount() {
+    static int count = 0;
+    return count;
+}
+
+inline int checkFailures() {
+    if (checkFailureCount() > 0) {
+        std::cerr << checkFailureCount() << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+#define CHECK(expression) \
+    do { \
+        if (!(expression)) { \
+            std::cerr << __FILE__ << ':' << __LINE__ << ": check failed: " #expression << std::endl; \
+            ++checkFailureCount(); \
+        } \
+    } while (false)
+
+/** Check that an optional double has a value close to expected.
+ */
+#define CHECK_NEAR(optional, expected) CHECK((optional) && std::fabs(*(optional) - (expected)) < 1e-9)
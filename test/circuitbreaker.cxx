@@ -0,0 +1,113 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../circuitbreaker.h"
+#include "check.h"
+
+using namespace std::chrono_literals;
+
+using Clock = CircuitBreakers::Clock;
+
+static const Clock::time_point start = Clock::time_point() + 1h;
+
+/** Breakers that trip after two failures, with a 10 second backoff.
+ */
+static void configure(CircuitBreakers &breakers) {
+    breakers.threshold = 2;
+    breakers.backoff = 10s;
+    breakers.maxBackoff = 40s;
+}
+
+static void testDisabled() {
+    CircuitBreakers breakers;
+    CHECK(!breakers.enabled());
+    breakers.fail(L"Win32_Process", start);
+    breakers.fail(L"Win32_Process", start);
+    CHECK(breakers.allow(L"Win32_Process", start) == BreakerClosed);
+    CHECK(breakers.state(L"Win32_Process", start) == BreakerClosed);
+}
+
+static void testTripsAfterThreshold() {
+    CircuitBreakers breakers;
+    configure(breakers);
+    CHECK(breakers.enabled());
+    breakers.fail(L"Win32_Process", start);
+    CHECK(breakers.allow(L"Win32_Process", start) == BreakerClosed);
+    breakers.fail(L"Win32_Process", start);
+    CHECK(breakers.allow(L"Win32_Process", start) == BreakerOpen);
+    CHECK(breakers.state(L"Win32_Process", start + 9s) == BreakerOpen);
+    CHECK(breakers.state(L"Win32_Process", start + 10s) == BreakerHalfOpen);
+    // Other classes are unaffected.
+    CHECK(breakers.allow(L"Win32_Service", start) == BreakerClosed);
+}
+
+static void testSingleProbe() {
+    CircuitBreakers breakers;
+    configure(breakers);
+    breakers.fail(L"Win32_Process", start);
+    breakers.fail(L"Win32_Process", start);
+    CHECK(breakers.allow(L"Win32_Process", start + 10s) == BreakerHalfOpen);
+    // Only one probe at a time.
+    CHECK(breakers.allow(L"Win32_Process", start + 10s) == BreakerOpen);
+
+    // A successful probe closes the breaker.
+    breakers.succeed(L"Win32_Process");
+    CHECK(breakers.allow(L"Win32_Process", start + 10s) == BreakerClosed);
+    CHECK(breakers.state(L"Win32_Process", start + 10s) == BreakerClosed);
+}
+
+static void testFailedProbeDoublesBackoff() {
+    CircuitBreakers breakers;
+    configure(breakers);
+    breakers.fail(L"Win32_Process", start);
+    breakers.fail(L"Win32_Process", start);
+    CHECK(breakers.allow(L"Win32_Process", start + 10s) == BreakerHalfOpen);
+    breakers.fail(L"Win32_Process", start + 10s);
+    CHECK(breakers.allow(L"Win32_Process", start + 29s) == BreakerOpen);
+    CHECK(breakers.allow(L"Win32_Process", start + 30s) == BreakerHalfOpen);
+
+    // The backoff stops doubling at the maximum.
+    Clock::time_point now = start + 30s;
+    for (int trip = 0; trip < 5; ++trip) {
+        breakers.fail(L"Win32_Process", now);
+        now += 40s;
+        CHECK(breakers.allow(L"Win32_Process", now - 1s) == BreakerOpen);
+        CHECK(breakers.allow(L"Win32_Process", now) == BreakerHalfOpen);
+    }
+}
+
+static void testCancelledProbeAllowsAnother() {
+    CircuitBreakers breakers;
+    configure(breakers);
+    breakers.fail(L"Win32_Process", start);
+    breakers.fail(L"Win32_Process", start);
+    CHECK(breakers.allow(L"Win32_Process", start + 10s) == BreakerHalfOpen);
+
+    // The probe was cancelled, which neither closes nor reopens the breaker.
+    breakers.abandon(L"Win32_Process");
+    CHECK(breakers.state(L"Win32_Process", start + 10s) == BreakerHalfOpen);
+    CHECK(breakers.allow(L"Win32_Process", start + 11s) == BreakerHalfOpen);
+
+    // And that probe can still decide it.
+    breakers.fail(L"Win32_Process", start + 11s);
+    CHECK(breakers.allow(L"Win32_Process", start + 12s) == BreakerOpen);
+}
+
+static void testAbandonWithoutBreaker() {
+    CircuitBreakers breakers;
+    configure(breakers);
+    breakers.abandon(L"Win32_Process");
+    CHECK(breakers.allow(L"Win32_Process", start) == BreakerClosed);
+    CHECK(breakers.breakers.empty());
+}
+
+int main() {
+    testDisabled();
+    testTripsAfterThreshold();
+    testSingleProbe();
+    testFailedProbeDoublesBackoff();
+    testCancelledProbeAllowsAnother();
+    testAbandonWithoutBreaker();
+    return checkFailures();
+}
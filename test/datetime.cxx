@@ -0,0 +1,169 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../datetime.h"
+#include "check.h"
+
+#include <cstdio>
+#include <random>
+#include <string>
+
+static DatetimeKind parse(const std::wstring &text, int64_t &microseconds) {
+    return parseDatetime(text.c_str(), text.size(), microseconds);
+}
+
+static bool parses(const std::wstring &text) {
+    int64_t microseconds;
+    return parse(text, microseconds) != DatetimeNone;
+}
+
+/** The date of a day since 1970-01-01, the inverse of daysFromCivil.
+ */
+static void civilFromDays(int64_t days, int64_t &year, unsigned &month, unsigned &day) {
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned dayOfEra = static_cast<unsigned>(days - era * 146097);
+    const unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const unsigned shiftedMonth = (5 * dayOfYear + 2) / 153;
+    day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+    month = shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9;
+    year = static_cast<int64_t>(yearOfEra) + era * 400 + (month <= 2);
+}
+
+/** A CIM_DATETIME timestamp for microseconds since the epoch, written with an
+ * offset of offsetMinutes.
+ */
+static std::wstring format(const int64_t microseconds, const int offsetMinutes) {
+    const int64_t local = microseconds + offsetMinutes * int64_t(60000000);
+    int64_t days = local / 86400000000;
+    int64_t time = local % 86400000000;
+    if (time < 0) {
+        time += 86400000000;
+        --days;
+    }
+    int64_t year;
+    unsigned month, day;
+    civilFromDays(days, year, month, day);
+    wchar_t buffer[32];
+    std::swprintf(buffer, 32, L"%04lld%02u%02u%02lld%02lld%02lld.%06lld%c%03d",
+            static_cast<long long>(year), month, day,
+            static_cast<long long>(time / 3600000000), static_cast<long long>(time / 60000000 % 60),
+            static_cast<long long>(time / 1000000 % 60), static_cast<long long>(time % 1000000),
+            offsetMinutes < 0 ? L'-' : L'+', offsetMinutes < 0 ? -offsetMinutes : offsetMinutes);
+    return buffer;
+}
+
+static void testKnownValues() {
+    int64_t microseconds = 0;
+    CHECK(parse(L"19700101000000.000000+000", microseconds) == DatetimeTimestamp);
+    CHECK(microseconds == 0);
+    CHECK(parse(L"20190102030405.678901+000", microseconds) == DatetimeTimestamp);
+    CHECK(microseconds == 1546398245678901);
+    // An hour ahead of UTC is an hour earlier in UTC.
+    CHECK(parse(L"19700101010000.000000+060", microseconds) == DatetimeTimestamp);
+    CHECK(microseconds == 0);
+    CHECK(parse(L"19691231230000.000000-060", microseconds) == DatetimeTimestamp);
+    CHECK(microseconds == 0);
+    CHECK(parse(L"00000001020304.000005:000", microseconds) == DatetimeInterval);
+    CHECK(microseconds == 86400000000 + 7384000005);
+}
+
+static void testMalformed() {
+    CHECK(!parses(L""));
+    CHECK(!parses(L"20190102030405.678901+00"));
+    CHECK(!parses(L"20190102030405.678901+0000"));
+    CHECK(!parses(L"20190102030405,678901+000"));
+    CHECK(!parses(L"2019**02030405.678901+000"));
+    CHECK(!parses(L"20190102030405.******+000"));
+    CHECK(!parses(L"20190102240000.000000+000"));
+    CHECK(!parses(L"20190102036000.000000+000"));
+    CHECK(!parses(L"20190102030060.000000+000"));
+    CHECK(!parses(L"20190002030405.678901+000"));
+    CHECK(!parses(L"20191302030405.678901+000"));
+    CHECK(!parses(L"20190100030405.678901+000"));
+    CHECK(!parses(L"20190132030405.678901+000"));
+    CHECK(!parses(L"20190102030405.678901*000"));
+    CHECK(!parses(L"00000001020304.000005:001"));
+
+    int64_t microseconds = 42;
+    CHECK(parse(L"20230231000000.000000+000", microseconds) == DatetimeNone);
+    CHECK(microseconds == 42);
+}
+
+/** Every month's last day parses, and the day after it doesn't, through a
+ * whole 400 year leap cycle.
+ */
+static void testMonthLengths() {
+    CHECK(!parses(L"20230229000000.000000+000"));
+    CHECK(!parses(L"20230231000000.000000+000"));
+    CHECK(!parses(L"20230431000000.000000+000"));
+    CHECK(parses(L"20240229000000.000000+000"));
+    CHECK(!parses(L"19000229000000.000000+000"));
+    CHECK(parses(L"20000229000000.000000+000"));
+
+    for (int64_t year = 1800; year < 2200; ++year) {
+        for (unsigned month = 1; month <= 12; ++month) {
+            const unsigned last = daysInMonth(year, month);
+            CHECK(last == daysFromCivil(month == 12 ? year + 1 : year, month == 12 ? 1 : month + 1, 1) - daysFromCivil(year, month, 1));
+            wchar_t buffer[32];
+            std::swprintf(buffer, 32, L"%04lld%02u%02u000000.000000+000", static_cast<long long>(year), month, last);
+            CHECK(parses(buffer));
+            std::swprintf(buffer, 32, L"%04lld%02u%02u000000.000000+000", static_cast<long long>(year), month, last + 1);
+            CHECK(!parses(buffer));
+        }
+    }
+}
+
+/** Random instants, formatted with random offsets, parse back to the same
+ * instant.
+ */
+static void testRoundTrip() {
+    std::mt19937_64 random(1);
+    // Years 0001 to 9998, so that any offset still leaves four digits.
+    const int64_t first = daysFromCivil(1, 1, 2) * 86400000000;
+    const int64_t last = daysFromCivil(9998, 12, 31) * 86400000000;
+    std::uniform_int_distribution<int64_t> instants(first, last);
+    std::uniform_int_distribution<int> offsets(-720, 840);
+    for (int i = 0; i < 100000; ++i) {
+        const int64_t instant = instants(random);
+        const auto text = format(instant, offsets(random));
+        int64_t microseconds = 0;
+        CHECK(parse(text, microseconds) == DatetimeTimestamp);
+        CHECK(microseconds == instant);
+    }
+}
+
+/** Mutations of a valid value either fail to parse, or parse to a date that
+ * exists.
+ */
+static void testFuzz() {
+    std::mt19937_64 random(2);
+    const std::wstring alphabet = L"0123456789.+-:* ";
+    for (int i = 0; i < 200000; ++i) {
+        std::wstring text = format(static_cast<int64_t>(random() % 400000000000000000) - 200000000000000000, 0);
+        const int mutations = 1 + random() % 3;
+        for (int m = 0; m < mutations; ++m) {
+            text[random() % text.size()] = alphabet[random() % alphabet.size()];
+        }
+        int64_t microseconds;
+        const DatetimeKind kind = parse(text, microseconds);
+        if (kind == DatetimeTimestamp) {
+            const int64_t year = std::stoll(text.substr(0, 4));
+            const unsigned month = std::stoul(text.substr(4, 2));
+            const unsigned day = std::stoul(text.substr(6, 2));
+            CHECK(month >= 1 && month <= 12);
+            CHECK(day >= 1 && day <= daysInMonth(year, month));
+        }
+    }
+}
+
+int main() {
+    testKnownValues();
+    testMalformed();
+    testMonthLengths();
+    testRoundTrip();
+    testFuzz();
+    return checkFailures();
+}
@@ -0,0 +1,198 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "fakesource.h"
+#include "check.h"
+
+#include <algorithm>
+#include <map>
+#include <random>
+
+static FakeInstance process(const std::wstring &handle, const std::wstring &name) {
+    return FakeInstance{L"Win32_Process", L"Win32_Process.Handle=\"" + handle + L"\"", {{L"Handle", handle}, {L"Name", name}}};
+}
+
+static void testEverythingAddedWithoutPrevious() {
+    const FakeSource current({process(L"4", L"System"), process(L"8", L"smss.exe")});
+    const auto changes = diffFakes(nullptr, current);
+    CHECK(changes.size() == 2);
+    CHECK(changes[0].change == DiffAdded);
+    CHECK(changes[0].className == L"Win32_Process");
+    CHECK(changes[0].path == L"Win32_Process.Handle=\"4\"");
+    CHECK(changes[0].properties.size() == 2);
+    CHECK(std::get<0>(changes[0].properties[1]) == L"Name");
+    CHECK(std::get<1>(changes[0].properties[1]) == L"System");
+}
+
+static void testUnchanged() {
+    const FakeSource previous({process(L"4", L"System"), process(L"8", L"smss.exe")});
+    CHECK(diffFakes(&previous, previous).empty());
+}
+
+static void testModifiedOnlyChangedProperties() {
+    const FakeSource previous({process(L"4", L"System")});
+    FakeSource current({process(L"4", L"Other")});
+    current.instances[0].properties.emplace_back(L"Priority", L"8");
+    auto changes = diffFakes(&previous, current);
+    CHECK(changes.size() == 1);
+    CHECK(changes[0].change == DiffModified);
+    CHECK(changes[0].properties.size() == 2);
+    CHECK(std::get<0>(changes[0].properties[0]) == L"Name");
+    CHECK(std::get<1>(changes[0].properties[0]) == L"Other");
+    CHECK(std::get<0>(changes[0].properties[1]) == L"Priority");
+
+    // A property that's gone has no value.
+    changes = diffFakes(&current, previous);
+    CHECK(changes.size() == 1);
+    CHECK(changes[0].properties.size() == 2);
+    CHECK(std::get<0>(changes[0].properties[1]) == L"Priority");
+    CHECK(!std::get<1>(changes[0].properties[1]));
+}
+
+static void testReorderIsNotAModification() {
+    const FakeSource previous({process(L"4", L"System")});
+    FakeSource current = previous;
+    std::swap(current.instances[0].properties[0], current.instances[0].properties[1]);
+    CHECK(diffFakes(&previous, current).empty());
+}
+
+static void testRemoved() {
+    const FakeSource previous({process(L"4", L"System"), process(L"8", L"smss.exe")});
+    const FakeSource current({process(L"8", L"smss.exe")});
+    const auto changes = diffFakes(&previous, current);
+    CHECK(changes.size() == 1);
+    CHECK(changes[0].change == DiffRemoved);
+    CHECK(changes[0].path == L"Win32_Process.Handle=\"4\"");
+    CHECK(changes[0].properties.empty());
+}
+
+/** Without a path, an instance is only recognized while it is identical.
+ */
+static void testPathless() {
+    const FakeSource previous({{L"Win32_Thing", L"", {{L"A", L"1"}}}});
+    CHECK(diffFakes(&previous, previous).empty());
+    const FakeSource current({{L"Win32_Thing", L"", {{L"A", L"2"}}}});
+    const auto changes = diffFakes(&previous, current);
+    CHECK(changes.size() == 2);
+    CHECK(changes[0].change == DiffAdded);
+    CHECK(changes[1].change == DiffRemoved);
+}
+
+/** Duplicate identities match at most once.
+ */
+static void testDuplicates() {
+    const FakeSource previous({process(L"4", L"System")});
+    const FakeSource current({process(L"4", L"System"), process(L"4", L"System")});
+    const auto changes = diffFakes(&previous, current);
+    CHECK(changes.size() == 1);
+    CHECK(changes[0].change == DiffAdded);
+}
+
+static void testHashBoundaries() {
+    const FakeSource a({{L"C", L"", {{L"ab", L"c"}}}});
+    const FakeSource b({{L"C", L"", {{L"a", L"bc"}}}});
+    CHECK(instanceHash(a, 0) != instanceHash(b, 0));
+    // Same class, no path, so only the hash tells them apart.
+    CHECK(instanceIdentity(a, 0, instanceHash(a, 0)) != instanceIdentity(b, 0, instanceHash(b, 0)));
+}
+
+/** Applying a diff to previous gives current, as a map of identity to
+ * properties, through random edits.
+ */
+static void testApplyingGivesCurrent() {
+    using State = std::map<std::wstring, std::map<std::wstring, std::wstring>>;
+    const auto state = [](const FakeSource &source) {
+        State output;
+        for (const auto &instance: source.instances) {
+            auto &properties = output[instance.className + L'\\' + instance.path];
+            for (const auto &[key, value]: instance.properties) {
+                properties[key] = value;
+            }
+        }
+        return output;
+    };
+
+    std::mt19937_64 random(1);
+    FakeSource previous;
+    for (int i = 0; i < 200; ++i) {
+        FakeInstance instance{random() % 2 ? L"Win32_Process" : L"Win32_Service", L"path" + std::to_wstring(i), {}};
+        for (int p = 0; p < 5; ++p) {
+            instance.properties.emplace_back(L"P" + std::to_wstring(p), std::to_wstring(random() % 4));
+        }
+        previous.instances.push_back(std::move(instance));
+    }
+    for (int round = 0; round < 50; ++round) {
+        FakeSource current;
+        for (const auto &instance: previous.instances) {
+            switch (random() % 10) {
+                case 0:
+                    // Removed
+                    break;
+                case 1: {
+                    FakeInstance changed = instance;
+                    changed.properties[random() % changed.properties.size()].second = std::to_wstring(random() % 4);
+                    current.instances.push_back(std::move(changed));
+                    break;
+                }
+                case 2: {
+                    FakeInstance changed = instance;
+                    changed.properties.erase(changed.properties.begin() + random() % changed.properties.size());
+                    const std::wstring key = L"Q" + std::to_wstring(random() % 3);
+                    // Keys are unique within an instance
+                    if (std::find_if(changed.properties.begin(), changed.properties.end(), [&key](const auto &property) {
+                            return property.first == key;
+                        }) == changed.properties.end()) {
+                        changed.properties.emplace_back(key, L"x");
+                    }
+                    current.instances.push_back(std::move(changed));
+                    break;
+                }
+                default:
+                    current.instances.push_back(instance);
+            }
+        }
+        for (int i = 0; i < 5; ++i) {
+            current.instances.push_back({L"Win32_Process", L"new" + std::to_wstring(round) + L"_" + std::to_wstring(i), {{L"P0", L"0"}}});
+        }
+
+        State applied = state(previous);
+        for (const auto &change: diffFakes(&previous, current)) {
+            const std::wstring identity = change.className + L'\\' + change.path;
+            if (change.change == DiffRemoved) {
+                CHECK(applied.erase(identity) == 1);
+                continue;
+            }
+            if (change.change == DiffAdded) {
+                CHECK(applied.count(identity) == 0);
+                applied[identity].clear();
+            } else {
+                CHECK(change.change == DiffModified);
+                CHECK(!change.properties.empty());
+            }
+            auto &properties = applied[identity];
+            for (const auto &[key, value]: change.properties) {
+                if (value) {
+                    properties[key] = *value;
+                } else {
+                    properties.erase(key);
+                }
+            }
+        }
+        CHECK(applied == state(current));
+        previous = std::move(current);
+    }
+}
+
+int main() {
+    testEverythingAddedWithoutPrevious();
+    testUnchanged();
+    testModifiedOnlyChangedProperties();
+    testReorderIsNotAModification();
+    testRemoved();
+    testPathless();
+    testDuplicates();
+    testHashBoundaries();
+    testApplyingGivesCurrent();
+    return checkFailures();
+}
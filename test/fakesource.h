@@ -0,0 +1,58 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+#pragma once
+
+#include "../diff.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/** An enum in memory, for diffing.
+ */
+struct FakeInstance {
+    std::wstring className;
+    std::wstring path;
+    std::vector<std::pair<std::wstring, std::wstring>> properties;
+};
+
+struct FakeSource : DiffSource {
+    std::vector<FakeInstance> instances;
+
+    FakeSource() = default;
+
+    FakeSource(std::vector<FakeInstance> instances) : instances(std::move(instances)) {
+    }
+
+    size_t instanceCount() const override {
+        return instances.size();
+    }
+
+    const wchar_t *className(const size_t instance) const override {
+        return instances[instance].className.c_str();
+    }
+
+    const wchar_t *path(const size_t instance) const override {
+        return instances[instance].path.c_str();
+    }
+
+    size_t propertyCount(const size_t instance) const override {
+        return instances[instance].properties.size();
+    }
+
+    const wchar_t *key(const size_t instance, const size_t property) const override {
+        return instances[instance].properties[property].first.c_str();
+    }
+
+    const wchar_t *value(const size_t instance, const size_t property) const override {
+        return instances[instance].properties[property].second.c_str();
+    }
+};
+
+/** Diff two fakes, indexing both.
+ */
+inline std::vector<DiffChange> diffFakes(const FakeSource *previous, const FakeSource &current) {
+    const DiffIndex previousIndex = previous ? DiffIndex(*previous) : DiffIndex();
+    return diffInstances(previous, previousIndex, current, DiffIndex(current));
+}
@@ -0,0 +1,192 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../invariant.h"
+#include "check.h"
+
+#include <clocale>
+#include <cmath>
+#include <cstring>
+#include <cwchar>
+#include <limits>
+#include <random>
+#include <vector>
+
+/** What the C library prints for value, in the C locale.
+ */
+template <typename T>
+static std::wstring printed(const wchar_t * const format, const T value) {
+    wchar_t buffer[32];
+    std::swprintf(buffer, 32, format, value);
+    return buffer;
+}
+
+static std::wstring unsignedText(const uint64_t value) {
+    std::wstring output;
+    appendUnsigned(output, value);
+    return output;
+}
+
+static std::wstring signedText(const int64_t value) {
+    std::wstring output;
+    appendSigned(output, value);
+    return output;
+}
+
+template <typename T>
+static std::wstring floatingText(const T value) {
+    std::wstring output;
+    appendFloating(output, value);
+    return output;
+}
+
+/** Whether text reads back, in the C locale, as exactly value, down to the
+ * sign of zero and of NaN.
+ */
+static bool readsBack(const std::wstring &text, const double value) {
+    wchar_t *end;
+    const double read = std::wcstod(text.c_str(), &end);
+    if (*end != 0) {
+        return false;
+    }
+    if (std::isnan(value)) {
+        return std::isnan(read) && std::signbit(read) == std::signbit(value);
+    }
+    return std::memcmp(&read, &value, sizeof(value)) == 0;
+}
+
+static bool readsBack(const std::wstring &text, const float value) {
+    wchar_t *end;
+    const float read = std::wcstof(text.c_str(), &end);
+    if (*end != 0) {
+        return false;
+    }
+    if (std::isnan(value)) {
+        return std::isnan(read) && std::signbit(read) == std::signbit(value);
+    }
+    return std::memcmp(&read, &value, sizeof(value)) == 0;
+}
+
+static void testIntegerLimits() {
+    CHECK(unsignedText(0) == L"0");
+    CHECK(unsignedText(9) == L"9");
+    CHECK(unsignedText(10) == L"10");
+    CHECK(unsignedText(99) == L"99");
+    CHECK(unsignedText(100) == L"100");
+    CHECK(unsignedText(std::numeric_limits<uint64_t>::max()) == L"18446744073709551615");
+    CHECK(signedText(0) == L"0");
+    CHECK(signedText(-1) == L"-1");
+    CHECK(signedText(std::numeric_limits<int64_t>::max()) == L"9223372036854775807");
+    CHECK(signedText(std::numeric_limits<int64_t>::min()) == L"-9223372036854775808");
+}
+
+/** Every power of ten and its neighbours, and random values of every length,
+ * match what the C library prints and read back the same.
+ */
+static void testIntegerRoundTrip() {
+    std::mt19937_64 random(1);
+    std::vector<uint64_t> values;
+    for (uint64_t power = 1; power <= 1000000000000000000u; power *= 10) {
+        values.push_back(power - 1);
+        values.push_back(power);
+        values.push_back(power + 1);
+        values.push_back(power * 10 - 1);
+    }
+    for (int i = 0; i < 100000; ++i) {
+        values.push_back(random() >> (random() % 64));
+    }
+    for (const uint64_t value: values) {
+        const auto text = unsignedText(value);
+        CHECK(text == printed(L"%llu", static_cast<unsigned long long>(value)));
+        CHECK(std::wcstoull(text.c_str(), nullptr, 10) == value);
+
+        const auto signedValue = static_cast<int64_t>(value);
+        const auto signedString = signedText(signedValue);
+        CHECK(signedString == printed(L"%lld", static_cast<long long>(signedValue)));
+        CHECK(std::wcstoll(signedString.c_str(), nullptr, 10) == signedValue);
+        const auto negatedString = signedText(0 - signedValue);
+        CHECK(std::wcstoll(negatedString.c_str(), nullptr, 10) == 0 - signedValue);
+    }
+}
+
+static void testFloatingSpecials() {
+    CHECK(floatingText(0.0) == L"0");
+    CHECK(floatingText(-0.0) == L"-0");
+    CHECK(floatingText(std::numeric_limits<double>::infinity()) == L"inf");
+    CHECK(floatingText(-std::numeric_limits<double>::infinity()) == L"-inf");
+    CHECK(floatingText(std::numeric_limits<double>::quiet_NaN()) == L"nan");
+    CHECK(floatingText(-std::numeric_limits<double>::quiet_NaN()) == L"-nan");
+    CHECK(floatingText(0.1) == L"0.1");
+    CHECK(floatingText(1.5f) == L"1.5");
+    CHECK(floatingText(-0.0f) == L"-0");
+    CHECK(floatingText(std::numeric_limits<float>::infinity()) == L"inf");
+    CHECK(floatingText(std::numeric_limits<float>::quiet_NaN()) == L"nan");
+
+    for (const double value: {
+            0.0,
+            -0.0,
+            std::numeric_limits<double>::infinity(),
+            -std::numeric_limits<double>::infinity(),
+            std::numeric_limits<double>::quiet_NaN(),
+            -std::numeric_limits<double>::quiet_NaN(),
+            std::numeric_limits<double>::max(),
+            std::numeric_limits<double>::lowest(),
+            std::numeric_limits<double>::min(),
+            std::numeric_limits<double>::denorm_min(),
+            std::numeric_limits<double>::epsilon()}) {
+        CHECK(readsBack(floatingText(value), value));
+    }
+    for (const float value: {
+            0.0f,
+            -0.0f,
+            std::numeric_limits<float>::infinity(),
+            -std::numeric_limits<float>::infinity(),
+            std::numeric_limits<float>::quiet_NaN(),
+            std::numeric_limits<float>::max(),
+            std::numeric_limits<float>::min(),
+            std::numeric_limits<float>::denorm_min()}) {
+        CHECK(readsBack(floatingText(value), value));
+    }
+}
+
+/** Random bit patterns, so every exponent and both signs turn up.
+ */
+static void testFloatingRoundTrip() {
+    std::mt19937_64 random(2);
+    for (int i = 0; i < 100000; ++i) {
+        const uint64_t bits = random();
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        CHECK(readsBack(floatingText(value), value));
+
+        const uint32_t floatBits = static_cast<uint32_t>(bits);
+        float floatValue;
+        std::memcpy(&floatValue, &floatBits, sizeof(floatValue));
+        CHECK(readsBack(floatingText(floatValue), floatValue));
+    }
+}
+
+/** The thread locale never changes the output.
+ */
+static void testLocaleIgnored() {
+    for (const char * const name: {"de_DE.UTF-8", "fr_FR.UTF-8", "de_DE", "fr_FR"}) {
+        if (!std::setlocale(LC_ALL, name)) {
+            continue;
+        }
+        CHECK(floatingText(1.5) == L"1.5");
+        CHECK(unsignedText(1234567) == L"1234567");
+        CHECK(signedText(-1234567) == L"-1234567");
+    }
+    std::setlocale(LC_ALL, "C");
+}
+
+int main() {
+    std::setlocale(LC_ALL, "C");
+    testIntegerLimits();
+    testIntegerRoundTrip();
+    testFloatingSpecials();
+    testFloatingRoundTrip();
+    testLocaleIgnored();
+    return checkFailures();
+}
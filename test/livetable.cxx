@@ -0,0 +1,216 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../livetable.h"
+#include "check.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <random>
+#include <thread>
+
+struct Instance {
+    std::wstring className;
+    std::wstring path;
+    int generation;
+};
+
+using Table = LiveTable<Instance>;
+
+/** A stand-in for the services, holding the real instances, which delivers an
+ * event to the subscribed table for every change, in order, and enumerates in
+ * batches without a consistent snapshot, as WMI does.
+ */
+class FakeServices {
+    private:
+        std::mutex mutex;
+        std::map<std::wstring, Instance> instances;
+        Table *subscriber = nullptr;
+
+    public:
+        void subscribe(Table &table) {
+            std::lock_guard<std::mutex> lock(mutex);
+            subscriber = &table;
+        }
+
+        void put(const std::wstring &className, const std::wstring &path) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto &instance = instances[path];
+            instance = Instance{className, path, instance.generation + 1};
+            if (subscriber) {
+                subscriber->upsert(path, std::make_shared<const Instance>(instance));
+            }
+        }
+
+        void remove(const std::wstring &path) {
+            std::lock_guard<std::mutex> lock(mutex);
+            instances.erase(path);
+            if (subscriber) {
+                subscriber->erase(path);
+            }
+        }
+
+        /** One batch of the enumeration, after the path from.  Empty at the
+         * end.
+         */
+        std::vector<std::pair<std::wstring, std::shared_ptr<const Instance>>> next(std::wstring &from, const size_t size) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<std::pair<std::wstring, std::shared_ptr<const Instance>>> output;
+            for (auto it = instances.upper_bound(from); it != instances.end() && output.size() < size; ++it) {
+                output.emplace_back(it->first, std::make_shared<const Instance>(it->second));
+                from = it->first;
+            }
+            return output;
+        }
+
+        std::map<std::wstring, Instance> current() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return instances;
+        }
+};
+
+static std::map<std::wstring, Instance> contents(const Table &table) {
+    std::map<std::wstring, Instance> output;
+    for (const auto &instance: table.snapshot()) {
+        CHECK(output.emplace(instance->path, *instance).second);
+    }
+    return output;
+}
+
+static bool same(const std::map<std::wstring, Instance> &a, const std::map<std::wstring, Instance> &b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const auto &x, const auto &y) {
+        return x.first == y.first && x.second.className == y.second.className && x.second.generation == y.second.generation;
+    });
+}
+
+/** Seed, as WmiLive_new does: subscribe first, then enumerate, calling
+ * between after each batch.
+ */
+template <typename Between>
+static void seed(FakeServices &services, Table &table, const size_t batch, Between between) {
+    services.subscribe(table);
+    std::vector<std::pair<std::wstring, std::shared_ptr<const Instance>>> enumerated;
+    std::wstring from;
+    for (auto items = services.next(from, batch); !items.empty(); items = services.next(from, batch)) {
+        enumerated.insert(enumerated.end(), items.begin(), items.end());
+        between();
+    }
+    table.seed(enumerated);
+}
+
+static void testEventsDuringSeeding() {
+    FakeServices services;
+    for (const auto path: {L"a", L"b", L"c", L"d"}) {
+        services.put(L"Win32_Process", path);
+    }
+    Table table;
+    int batch = 0;
+    seed(services, table, 2, [&]() {
+        if (batch++ == 0) {
+            // "a" and "b" were enumerated, then change.
+            services.put(L"Win32_Process", L"a");
+            services.remove(L"b");
+            // "c" is deleted and created again before it is enumerated.
+            services.remove(L"c");
+            services.put(L"Win32_Process", L"c");
+            services.put(L"Win32_Process", L"e");
+        }
+    });
+    const auto live = contents(table);
+    CHECK(same(live, services.current()));
+    CHECK(live.count(L"b") == 0);
+    CHECK(live.count(L"c") == 1);
+    CHECK(live.at(L"a").generation == 2);
+    CHECK(live.at(L"c").generation == 1);
+
+    // Events after seeding still apply.
+    services.remove(L"a");
+    services.put(L"Win32_Process", L"f");
+    CHECK(same(contents(table), services.current()));
+}
+
+/** A deletion during seeding of something the enumeration already returned,
+ * which is then created again, must survive the end of seeding.
+ */
+static void testRecreatedAfterEnumerated() {
+    FakeServices services;
+    services.put(L"Win32_Process", L"a");
+    Table table;
+    seed(services, table, 10, [&]() {
+        services.remove(L"a");
+        services.put(L"Win32_Process", L"a");
+    });
+    const auto live = contents(table);
+    CHECK(live.count(L"a") == 1);
+    CHECK(same(live, services.current()));
+}
+
+/** Subclasses keep their own class names, from the events and from the
+ * enumeration alike.
+ */
+static void testSubclasses() {
+    FakeServices services;
+    services.put(L"CIM_LogicalDisk", L"a");
+    services.put(L"Win32_LogicalDisk", L"b");
+    Table table;
+    seed(services, table, 1, [&]() {
+        services.put(L"Win32_MappedLogicalDisk", L"c");
+    });
+    const auto live = contents(table);
+    CHECK(live.at(L"a").className == L"CIM_LogicalDisk");
+    CHECK(live.at(L"b").className == L"Win32_LogicalDisk");
+    CHECK(live.at(L"c").className == L"Win32_MappedLogicalDisk");
+}
+
+static void testFirstFailureKept() {
+    Table table;
+    CHECK(table.error() == nullptr);
+    table.fail("first");
+    const char * const error = table.error();
+    table.fail("second");
+    CHECK(error == table.error());
+    CHECK(std::string(error) == "first");
+}
+
+/** Another thread changes the instances throughout seeding and after it, and
+ * the table ends up matching them.
+ */
+static void testConcurrentEvents() {
+    for (unsigned round = 0; round < 20; ++round) {
+        FakeServices services;
+        for (int i = 0; i < 200; ++i) {
+            services.put(L"Win32_Process", std::to_wstring(i));
+        }
+        Table table;
+        std::atomic<bool> stop{false};
+        std::thread events([&]() {
+            std::mt19937 random(round);
+            while (!stop) {
+                const std::wstring path = std::to_wstring(random() % 250);
+                if (random() % 3 == 0) {
+                    services.remove(path);
+                } else {
+                    services.put(L"Win32_Process", path);
+                }
+            }
+        });
+        seed(services, table, 7, []() {
+            std::this_thread::yield();
+        });
+        std::this_thread::yield();
+        stop = true;
+        events.join();
+        CHECK(same(contents(table), services.current()));
+    }
+}
+
+int main() {
+    testEventsDuringSeeding();
+    testRecreatedAfterEnumerated();
+    testSubclasses();
+    testFirstFailureKept();
+    testConcurrentEvents();
+    return checkFailures();
+}
@@ -0,0 +1,146 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../mpscqueue.h"
+#include "check.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** A stand-in for the auto-reset Win32 event that wakes the consumer.
+ */
+class Event {
+    private:
+        std::mutex mutex;
+        std::condition_variable changed;
+        bool signalled = false;
+
+    public:
+        void set() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                signalled = true;
+            }
+            changed.notify_one();
+        }
+
+        bool wait(const long milliseconds) {
+            std::unique_lock<std::mutex> lock(mutex);
+            const bool output = changed.wait_for(lock, std::chrono::milliseconds(milliseconds), [this]() { return signalled; });
+            signalled = false;
+            return output;
+        }
+};
+
+/** What a sink queues, as AsyncMessage: a batch for a class, or its
+ * completion.
+ */
+struct Message {
+    size_t index = 0;
+    std::vector<size_t> objects;
+    bool complete = false;
+};
+
+static void testFifo() {
+    MpscQueue<int> queue;
+    CHECK(!queue.pop());
+    for (int i = 0; i < 5; ++i) {
+        queue.push(i);
+    }
+    for (int i = 0; i < 3; ++i) {
+        CHECK(queue.pop() == i);
+    }
+    queue.push(5);
+    for (int i = 3; i < 6; ++i) {
+        CHECK(queue.pop() == i);
+    }
+    CHECK(!queue.pop());
+    // Empty again, which reuses the stub.
+    queue.push(6);
+    CHECK(queue.pop() == 6);
+    CHECK(!queue.pop());
+}
+
+/** Whatever is left is freed with the queue.
+ */
+static void testDestroyedWithValues() {
+    const auto counted = std::make_shared<int>(0);
+    {
+        MpscQueue<std::shared_ptr<int>> queue;
+        for (int i = 0; i < 10; ++i) {
+            queue.push(counted);
+        }
+        queue.pop();
+        CHECK(counted.use_count() == 10);
+    }
+    CHECK(counted.use_count() == 1);
+}
+
+/** Sinks for several classes push batches from several threads while the
+ * consumer drains, as WmiAsync does: wait on the event for at most the
+ * cancel interval, pop everything, and stop once every class has completed.
+ * Nothing is lost or duplicated, and each sink's messages stay in order.
+ */
+static void testDrainingSinks() {
+    constexpr size_t sinks = 8;
+    constexpr size_t batches = 20000;
+    MpscQueue<Message> messages;
+    Event ready;
+
+    std::vector<std::thread> producers;
+    for (size_t sink = 0; sink < sinks; ++sink) {
+        producers.emplace_back([&, sink]() {
+            for (size_t batch = 0; batch < batches; ++batch) {
+                Message message;
+                message.index = sink;
+                message.objects.assign(sink % 3 + 1, batch);
+                messages.push(std::move(message));
+                ready.set();
+            }
+            Message message;
+            message.index = sink;
+            message.complete = true;
+            messages.push(std::move(message));
+            ready.set();
+        });
+    }
+
+    std::vector<size_t> nextBatch(sinks, 0);
+    std::vector<bool> complete(sinks, false);
+    size_t completed = 0;
+    size_t objects = 0;
+    while (completed < sinks) {
+        ready.wait(50);
+        while (auto message = messages.pop()) {
+            const size_t sink = message->index;
+            CHECK(!complete[sink]);
+            if (message->complete) {
+                CHECK(nextBatch[sink] == batches);
+                complete[sink] = true;
+                ++completed;
+                continue;
+            }
+            CHECK(message->objects.size() == sink % 3 + 1);
+            CHECK(message->objects.front() == nextBatch[sink]);
+            ++nextBatch[sink];
+            objects += message->objects.size();
+        }
+    }
+    for (auto &producer: producers) {
+        producer.join();
+    }
+    CHECK(!messages.pop());
+    CHECK(objects == batches * (1 + 2 + 3 + 1 + 2 + 3 + 1 + 2));
+}
+
+int main() {
+    testFifo();
+    testDestroyedWithValues();
+    testDrainingSinks();
+    return checkFailures();
+}
@@ -0,0 +1,148 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../nextwait.h"
+#include "check.h"
+
+#include <atomic>
+#include <optional>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+using Batch = std::optional<std::vector<int>>;
+
+/** An enumerator whose provider never produces anything, so that every Next
+ * call waits out its whole timeout and returns an empty batch, forever.
+ */
+struct StuckEnumerator {
+    size_t calls = 0;
+    long longestWait = 0;
+
+    Batch operator()(const long wait) {
+        CHECK(wait != waitInfinite);
+        ++calls;
+        longestWait = std::max(longestWait, wait);
+        std::this_thread::sleep_for(std::chrono::milliseconds(wait));
+        return std::make_optional<std::vector<int>>();
+    }
+};
+
+static long millisecondsSince(const Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+}
+
+/** A cancellation is noticed within one cancelInterval, however long the
+ * enumeration would otherwise run.
+ */
+static void testCancelLatency() {
+    std::atomic<bool> signalled{false};
+    const std::function<bool()> cancelled = [&signalled]() { return signalled.load(); };
+    const NextWaits waits(std::chrono::milliseconds(0), cancelled, "");
+    StuckEnumerator enumerator;
+    Clock::time_point signalledAt;
+    std::thread canceller([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(170));
+        signalledAt = Clock::now();
+        signalled = true;
+    });
+    bool threw = false;
+    try {
+        drain(waits, enumerator, [](std::vector<int> &) {});
+    } catch (const CancelledError &) {
+        threw = true;
+    }
+    canceller.join();
+    CHECK(threw);
+    CHECK(enumerator.longestWait == cancelInterval);
+    const long latency = millisecondsSince(signalledAt);
+    // One interval, and some slack for the scheduler.
+    CHECK(latency <= cancelInterval + 25);
+}
+
+/** A timeout ends the enumeration on time, and no single call waits past it.
+ */
+static void testTimeout() {
+    const std::function<bool()> none;
+    const auto start = Clock::now();
+    const NextWaits waits(std::chrono::milliseconds(130), none, "Timed out enumerating Win32_Stuck.");
+    StuckEnumerator enumerator;
+    std::string message;
+    try {
+        drain(waits, enumerator, [](std::vector<int> &) {});
+    } catch (const TimeoutError &e) {
+        message = e.what();
+    }
+    const long elapsed = millisecondsSince(start);
+    CHECK(message == "Timed out enumerating Win32_Stuck.");
+    CHECK(enumerator.longestWait <= 130);
+    CHECK(elapsed >= 130);
+    CHECK(elapsed <= 130 + 25);
+}
+
+/** With both, waits are the shorter of the interval and what is left.
+ */
+static void testTimeoutAndCancel() {
+    const std::function<bool()> never = []() { return false; };
+    const NextWaits waits(std::chrono::milliseconds(20), never, "Timed out.");
+    const long wait = waits.next();
+    CHECK(wait > 0);
+    CHECK(wait <= 20);
+    const NextWaits longer(std::chrono::milliseconds(60000), never, "Timed out.");
+    CHECK(longer.next() == cancelInterval);
+}
+
+static void testNeitherWaitsForever() {
+    const std::function<bool()> none;
+    const NextWaits waits(std::chrono::milliseconds(0), none, "");
+    CHECK(waits.next() == waitInfinite);
+}
+
+/** An enumeration cancelled before it starts never calls Next.
+ */
+static void testAlreadyCancelled() {
+    const std::function<bool()> always = []() { return true; };
+    const NextWaits waits(std::chrono::milliseconds(0), always, "");
+    StuckEnumerator enumerator;
+    bool threw = false;
+    try {
+        drain(waits, enumerator, [](std::vector<int> &) {});
+    } catch (const CancelledError &) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(enumerator.calls == 0);
+}
+
+/** Every batch is passed on, including empty ones from calls that timed out,
+ * up to the end.
+ */
+static void testDrainsToTheEnd() {
+    const std::function<bool()> never = []() { return false; };
+    const NextWaits waits(std::chrono::milliseconds(0), never, "");
+    std::vector<Batch> batches{std::vector<int>{1, 2}, std::vector<int>{}, std::vector<int>{3}, std::nullopt};
+    size_t call = 0;
+    std::vector<int> seen;
+    size_t consumed = 0;
+    drain(waits, [&](const long wait) {
+        CHECK(wait == cancelInterval);
+        return batches.at(call++);
+    }, [&](std::vector<int> &batch) {
+        ++consumed;
+        seen.insert(seen.end(), batch.begin(), batch.end());
+    });
+    CHECK(call == 4);
+    CHECK(consumed == 3);
+    CHECK((seen == std::vector<int>{1, 2, 3}));
+}
+
+int main() {
+    testCancelLatency();
+    testTimeout();
+    testTimeoutAndCancel();
+    testNeitherWaitsForever();
+    testAlreadyCancelled();
+    testDrainsToTheEnd();
+    return checkFailures();
+}
@@ -0,0 +1,163 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../perfcounter.h"
+#include "check.h"
+
+#include <cstdint>
+
+/** A pair of samples one second apart on every timer, with the perf and
+ * object timers at 10MHz, as on most hosts.
+ */
+static PerfRawSample sampleAt(const uint64_t second, const uint64_t value, const uint64_t base = 0) {
+    PerfRawSample output;
+    output.value = value;
+    output.base = base;
+    output.perfTime = second * 10000000;
+    output.perfFrequency = 10000000;
+    output.sys100NsTime = second * 10000000;
+    output.sys100NsFrequency = 10000000;
+    output.objectTime = second * 10000000;
+    output.objectFrequency = 10000000;
+    return output;
+}
+
+static void testClassification() {
+    CHECK(perfCounterSupported(PerfCounter));
+    CHECK(perfCounterSupported(Perf100NsTimer));
+    CHECK(!perfCounterSupported(0x12345678));
+
+    CHECK(perfCounterHasBase(PerfRawFraction));
+    CHECK(perfCounterHasBase(PerfAverageTimer));
+    CHECK(!perfCounterHasBase(PerfCounter));
+
+    CHECK(!perfCounterNeedsPrevious(PerfRawCount));
+    CHECK(!perfCounterNeedsPrevious(PerfRawFraction));
+    CHECK(!perfCounterNeedsPrevious(PerfElapsedTime));
+    CHECK(perfCounterNeedsPrevious(PerfCounter));
+    CHECK(!perfCounterNeedsPrevious(0x12345678));
+}
+
+static void testRawAndDelta() {
+    const auto previous = sampleAt(1, 100);
+    const auto current = sampleAt(2, 150);
+    CHECK_NEAR(perfCounterCook(PerfRawCount, previous, current), 150.0);
+    CHECK_NEAR(perfCounterCook(PerfLargeRawCountHex, PerfRawSample(), current), 150.0);
+    CHECK_NEAR(perfCounterCook(PerfDelta, previous, current), 50.0);
+    CHECK_NEAR(perfCounterCook(PerfLargeDelta, previous, current), 50.0);
+}
+
+static void testRates() {
+    // 2000 events over one second.
+    const auto previous = sampleAt(1, 1000);
+    const auto current = sampleAt(2, 3000);
+    CHECK_NEAR(perfCounterCook(PerfCounter, previous, current), 2000.0);
+    CHECK_NEAR(perfCounterCook(PerfBulkCount, previous, current), 2000.0);
+
+    // Over two seconds, the rate halves.
+    CHECK_NEAR(perfCounterCook(PerfCounter, previous, sampleAt(3, 3000)), 1000.0);
+
+    // Without a frequency, there is no rate.
+    auto noFrequency = current;
+    noFrequency.perfFrequency = 0;
+    CHECK(!perfCounterCook(PerfCounter, previous, noFrequency));
+
+    // Queue lengths are the sum of lengths over ticks.
+    const auto queuePrevious = sampleAt(1, 0);
+    const auto queueCurrent = sampleAt(2, 30000000);
+    CHECK_NEAR(perfCounterCook(PerfQueueLength, queuePrevious, queueCurrent), 3.0);
+    CHECK_NEAR(perfCounterCook(Perf100NsQueueLength, queuePrevious, queueCurrent), 3.0);
+    CHECK_NEAR(perfCounterCook(PerfObjectTimeQueueLength, queuePrevious, queueCurrent), 3.0);
+}
+
+static void testFractions() {
+    CHECK_NEAR(perfCounterCook(PerfRawFraction, PerfRawSample(), sampleAt(1, 25, 200)), 12.5);
+    CHECK_NEAR(perfCounterCook(PerfLargeRawFraction, PerfRawSample(), sampleAt(1, 200, 200)), 100.0);
+    CHECK_NEAR(perfCounterCook(PerfSampleFraction, sampleAt(1, 10, 20), sampleAt(2, 15, 30)), 50.0);
+    CHECK_NEAR(perfCounterCook(PerfPrecision100NsTimer, sampleAt(1, 0, 0), sampleAt(2, 250, 1000)), 25.0);
+}
+
+static void testTimers() {
+    // Busy for half a second out of one.
+    const auto previous = sampleAt(1, 0);
+    const auto current = sampleAt(2, 5000000);
+    CHECK_NEAR(perfCounterCook(PerfTimer, previous, current), 50.0);
+    CHECK_NEAR(perfCounterCook(Perf100NsTimer, previous, current), 50.0);
+    CHECK_NEAR(perfCounterCook(PerfObjectTimeTimer, previous, current), 50.0);
+    CHECK_NEAR(perfCounterCook(PerfTimerInverse, previous, current), 50.0);
+
+    // Idle for a quarter of a second, so busy for three quarters.
+    CHECK_NEAR(perfCounterCook(Perf100NsTimerInverse, previous, sampleAt(2, 2500000)), 75.0);
+
+    // Over four instances, half a second of busy time is 12.5% each.
+    const auto multiPrevious = sampleAt(1, 0, 4);
+    const auto multiCurrent = sampleAt(2, 5000000, 4);
+    CHECK_NEAR(perfCounterCook(PerfMultiTimer, multiPrevious, multiCurrent), 12.5);
+    CHECK_NEAR(perfCounterCook(Perf100NsMultiTimer, multiPrevious, multiCurrent), 12.5);
+    CHECK_NEAR(perfCounterCook(PerfMultiTimerInverse, multiPrevious, multiCurrent), 87.5);
+    CHECK_NEAR(perfCounterCook(Perf100NsMultiTimerInverse, multiPrevious, multiCurrent), 87.5);
+}
+
+static void testAverages() {
+    // Four operations taking two seconds of ticks in total.
+    CHECK_NEAR(perfCounterCook(PerfAverageTimer, sampleAt(1, 0, 10), sampleAt(2, 20000000, 14)), 0.5);
+    // Four operations moving 4096 bytes in total.
+    CHECK_NEAR(perfCounterCook(PerfAverageBulk, sampleAt(1, 0, 10), sampleAt(2, 4096, 14)), 1024.0);
+}
+
+static void testElapsedTime() {
+    // Started at one second, sampled at five.
+    auto current = sampleAt(5, 10000000);
+    CHECK_NEAR(perfCounterCook(PerfElapsedTime, PerfRawSample(), current), 4.0);
+
+    // A start time after the sample time gives nothing.
+    current.value = 60000000;
+    CHECK(!perfCounterCook(PerfElapsedTime, PerfRawSample(), current));
+}
+
+static void testBaseZero() {
+    CHECK(!perfCounterCook(PerfRawFraction, PerfRawSample(), sampleAt(1, 25, 0)));
+    CHECK(!perfCounterCook(PerfMultiTimer, sampleAt(1, 0, 0), sampleAt(2, 5000000, 0)));
+    CHECK(!perfCounterCook(Perf100NsMultiTimerInverse, sampleAt(1, 0, 0), sampleAt(2, 5000000, 0)));
+    // A base that didn't move divides by zero.
+    CHECK(!perfCounterCook(PerfSampleFraction, sampleAt(1, 10, 20), sampleAt(2, 15, 20)));
+    CHECK(!perfCounterCook(PerfAverageTimer, sampleAt(1, 0, 10), sampleAt(2, 20000000, 10)));
+    CHECK(!perfCounterCook(PerfAverageBulk, sampleAt(1, 0, 10), sampleAt(2, 4096, 10)));
+}
+
+static void testWrapAndStall() {
+    // A 32-bit counter that wrapped, or any counter that was reset, goes
+    // backwards, which gives nothing rather than a huge delta.
+    const auto previous = sampleAt(1, 0xfffffff0);
+    const auto current = sampleAt(2, 0x10);
+    CHECK(!perfCounterCook(PerfDelta, previous, current));
+    CHECK(!perfCounterCook(PerfCounter, previous, current));
+    CHECK(!perfCounterCook(Perf100NsTimer, previous, current));
+    CHECK(!perfCounterCook(PerfSampleFraction, sampleAt(1, 10, 20), sampleAt(2, 5, 30)));
+
+    // The same counter just before the wrap is fine.
+    CHECK_NEAR(perfCounterCook(PerfDelta, sampleAt(1, 0xfffffff0), sampleAt(2, 0xffffffff)), 15.0);
+
+    // Timestamps that don't advance give nothing.
+    CHECK(!perfCounterCook(PerfCounter, sampleAt(1, 0), sampleAt(1, 100)));
+    CHECK(!perfCounterCook(Perf100NsTimer, sampleAt(2, 0), sampleAt(1, 100)));
+}
+
+static void testUnsupported() {
+    CHECK(!perfCounterCook(0x12345678, sampleAt(1, 0), sampleAt(2, 100)));
+}
+
+int main() {
+    testClassification();
+    testRawAndDelta();
+    testRates();
+    testFractions();
+    testTimers();
+    testAverages();
+    testElapsedTime();
+    testBaseZero();
+    testWrapAndStall();
+    testUnsupported();
+    return checkFailures();
+}
@@ -0,0 +1,161 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../pipeline.h"
+#include "check.h"
+
+#include <atomic>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+struct NoScope {
+};
+
+/** A scope which fails to start, as COM might.
+ */
+struct FailingScope {
+    FailingScope() {
+        throw std::runtime_error("Failed to initialize COM library.");
+    }
+};
+
+using Pool = ConverterPool<int, std::vector<std::string>, NoScope>;
+using Pipeline = ConvertPipeline<int, std::vector<std::string>, NoScope>;
+
+static std::vector<std::string> toStrings(std::vector<int> &objects) {
+    std::vector<std::string> output;
+    for (const int object: objects) {
+        output.push_back(std::to_string(object));
+    }
+    return output;
+}
+
+/** Batches come back in the order they were pushed, however long each takes
+ * and however many classes share the pool.
+ */
+static void testOrder() {
+    Pool pool(4);
+    std::atomic<unsigned> seed{0};
+    const auto slowly = [&seed](std::vector<int> &objects) {
+        std::mt19937 random(seed++);
+        std::this_thread::sleep_for(std::chrono::microseconds(random() % 500));
+        return toStrings(objects);
+    };
+    Pipeline first(pool, slowly);
+    Pipeline second(pool, slowly);
+    for (int batch = 0; batch < 50; ++batch) {
+        first.push({batch * 2, batch * 2 + 1});
+        second.push({-batch});
+    }
+    const auto firstBatches = first.finish();
+    CHECK(firstBatches.size() == 50);
+    int expected = 0;
+    for (const auto &batch: firstBatches) {
+        for (const auto &object: batch) {
+            CHECK(object == std::to_string(expected++));
+        }
+    }
+    const auto secondBatches = second.finish();
+    CHECK(secondBatches.size() == 50);
+    for (size_t batch = 0; batch < secondBatches.size(); ++batch) {
+        CHECK(secondBatches[batch] == std::vector<std::string>{std::to_string(-static_cast<int>(batch))});
+    }
+}
+
+/** The first converter error stops the fetcher's pushes, and comes out of
+ * finish, and nothing is converted after it.
+ */
+static void testError() {
+    Pool pool(2);
+    std::atomic<int> converted{0};
+    Pipeline pipeline(pool, [&converted](std::vector<int> &objects) {
+        if (objects.front() == 3) {
+            throw std::runtime_error("Could not get property.");
+        }
+        ++converted;
+        return toStrings(objects);
+    });
+    std::string pushError;
+    try {
+        for (int batch = 0; batch < 1000; ++batch) {
+            pipeline.push({batch});
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    } catch (const std::runtime_error &e) {
+        pushError = e.what();
+    }
+    CHECK(pushError == "Could not get property.");
+    std::string finishError;
+    try {
+        pipeline.finish();
+    } catch (const std::runtime_error &e) {
+        finishError = e.what();
+    }
+    CHECK(finishError == "Could not get property.");
+    CHECK(converted < 1000);
+}
+
+/** An abandoned class gives up what is still queued, and waits for what is
+ * being converted, so the converters never touch it once it is gone.
+ */
+static void testAbandoned() {
+    Pool pool(1);
+    std::atomic<int> converted{0};
+    {
+        Pipeline pipeline(pool, [&converted](std::vector<int> &objects) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            ++converted;
+            return toStrings(objects);
+        });
+        for (int batch = 0; batch < 2; ++batch) {
+            pipeline.push({batch});
+        }
+    }
+    CHECK(converted <= 2);
+    // The pool still works for the next class.
+    Pipeline next(pool, toStrings);
+    next.push({7});
+    CHECK(next.finish().front().front() == "7");
+}
+
+/** Objects are released by the converter, not handed back.
+ */
+static void testObjectsReleased() {
+    ConverterPool<std::shared_ptr<int>, int, NoScope> pool(1);
+    ConvertPipeline<std::shared_ptr<int>, int, NoScope> pipeline(pool, [](std::vector<std::shared_ptr<int>> &objects) {
+        return static_cast<int>(objects.size());
+    });
+    const auto object = std::make_shared<int>(0);
+    pipeline.push({object, object});
+    CHECK(pipeline.finish().front() == 2);
+    CHECK(object.use_count() == 1);
+}
+
+/** A converter whose thread couldn't start fails its batches rather than
+ * leave the fetcher waiting.
+ */
+static void testScopeError() {
+    ConverterPool<int, int, FailingScope> pool(1);
+    ConvertPipeline<int, int, FailingScope> pipeline(pool, [](std::vector<int> &) {
+        return 0;
+    });
+    pipeline.push({1});
+    std::string error;
+    try {
+        pipeline.finish();
+    } catch (const std::runtime_error &e) {
+        error = e.what();
+    }
+    CHECK(error == "Failed to initialize COM library.");
+}
+
+int main() {
+    testOrder();
+    testError();
+    testAbandoned();
+    testObjectsReleased();
+    testScopeError();
+    return checkFailures();
+}
@@ -0,0 +1,128 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../prefetch.h"
+#include "check.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct NoScope {
+};
+
+using Batch = std::vector<int>;
+using Prefetch = Prefetcher<Batch, NoScope>;
+
+/** A provider of count batches of one number each, which may time out every
+ * other call, and may fail after the last.
+ */
+struct FakeProvider {
+    int count;
+    bool stalls = false;
+    bool fails = false;
+    std::atomic<int> produced{0};
+    std::atomic<int> calls{0};
+
+    std::optional<Batch> operator()(const long timeout) {
+        CHECK(timeout == cancelInterval);
+        if (stalls && calls++ % 2 == 0) {
+            return std::make_optional<Batch>();
+        }
+        if (produced == count) {
+            if (fails) {
+                throw std::runtime_error("Could not Enum classes.");
+            }
+            return std::nullopt;
+        }
+        return std::make_optional<Batch>(1, produced++);
+    }
+};
+
+/** Every batch comes out in order, without the timed out ones, then the end.
+ */
+static void testInOrder() {
+    FakeProvider provider{100};
+    provider.stalls = true;
+    Prefetch prefetch(std::ref(provider), 2);
+    for (int batch = 0; batch < 100; ++batch) {
+        const auto next = prefetch.next();
+        CHECK(next && next->size() == 1 && next->front() == batch);
+    }
+    CHECK(!prefetch.next());
+}
+
+/** The background thread stays at most depth batches ahead.
+ */
+static void testDepth() {
+    FakeProvider provider{100};
+    Prefetch prefetch(std::ref(provider), 3);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(provider.produced == 3);
+    prefetch.next();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(provider.produced == 4);
+}
+
+/** Batches fetched before an error are handed over before it.
+ */
+static void testErrorAfterBatches() {
+    FakeProvider provider{3};
+    provider.fails = true;
+    Prefetch prefetch(std::ref(provider), 5);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    for (int batch = 0; batch < 3; ++batch) {
+        CHECK(prefetch.next()->front() == batch);
+    }
+    std::string error;
+    try {
+        prefetch.next();
+    } catch (const std::runtime_error &e) {
+        error = e.what();
+    }
+    CHECK(error == "Could not Enum classes.");
+}
+
+/** A caller's timeout with nothing ready gives an empty batch, as Next
+ * would.
+ */
+static void testTimeout() {
+    Prefetch prefetch([](long) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(cancelInterval));
+        return std::make_optional<Batch>();
+    }, 1);
+    const auto start = std::chrono::steady_clock::now();
+    const auto batch = prefetch.next(10);
+    CHECK(batch && batch->empty());
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(cancelInterval));
+}
+
+/** Stopping while the provider never finishes takes no longer than its
+ * current call, and fetch is never called after.
+ */
+static void testStopWhileStuck() {
+    std::atomic<int> calls{0};
+    Prefetch prefetch([&calls](const long timeout) {
+        ++calls;
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+        return std::make_optional<Batch>();
+    }, 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(70));
+    const auto start = std::chrono::steady_clock::now();
+    prefetch.stop();
+    CHECK(std::chrono::steady_clock::now() - start <= std::chrono::milliseconds(cancelInterval + 25));
+    const int stoppedAt = calls;
+    std::this_thread::sleep_for(std::chrono::milliseconds(cancelInterval));
+    CHECK(calls == stoppedAt);
+}
+
+int main() {
+    testInOrder();
+    testDepth();
+    testErrorAfterBatches();
+    testTimeout();
+    testStopWhileStuck();
+    return checkFailures();
+}
@@ -0,0 +1,239 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../invariant.h"
+#include "../propertyfilter.h"
+#include "../propertyloop.h"
+#include "check.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** Every allocation made through operator new on any thread.
+ */
+static size_t allocations = 0;
+
+void *operator new(const size_t size) {
+    ++allocations;
+    if (void * const output = std::malloc(size ? size : 1)) {
+        return output;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](const size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void * const pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void * const pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void * const pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void * const pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+enum FakeType {
+    FakeNumber,
+    FakeText,
+};
+
+/** What a VARIANT holds for the test: a number, or text owned by the object,
+ * as a BSTR is.  Like a VARIANT, it is copied without allocating.
+ */
+struct FakeValue {
+    int64_t number = 0;
+    const wchar_t *text = nullptr;
+};
+
+/** Stands in for an IWbemClassObject which has begun enumerating: Next
+ * overwrites the name, value and type in place.
+ */
+struct FakeObject {
+    struct Property {
+        std::wstring name;
+        FakeType type;
+        FakeValue value;
+    };
+
+    std::vector<Property> properties;
+    size_t position = 0;
+
+    void beginEnumeration() {
+        position = 0;
+    }
+
+    bool next(std::wstring &name, FakeValue &value, FakeType &type) {
+        if (position == properties.size()) {
+            return false;
+        }
+        const auto &property = properties[position++];
+        name.assign(property.name);
+        value = property.value;
+        type = property.type;
+        return true;
+    }
+};
+
+/** A Win32_Process-like object, with names long enough to be allocated if
+ * anything copied them.
+ */
+static FakeObject makeProcess() {
+    FakeObject object;
+    const std::vector<std::wstring> numbers{L"Handle", L"HandleCount", L"KernelModeTime", L"PageFaults", L"ParentProcessId", L"Priority", L"ThreadCount", L"UserModeTime", L"VirtualSize", L"WorkingSetSize"};
+    const std::vector<std::wstring> texts{L"Caption", L"CommandLine", L"Description", L"ExecutablePath", L"Name"};
+    int64_t value = 1;
+    for (const auto &name: numbers) {
+        object.properties.push_back({name, FakeNumber, {value * 1234567, nullptr}});
+        value *= -3;
+    }
+    for (const auto &name: texts) {
+        object.properties.push_back({name, FakeText, {0, L"C:\\Windows\\System32\\svchost.exe -k netsvcs -p"}});
+    }
+    return object;
+}
+
+static void storeText(std::wstring &output, const FakeValue &value, const FakeType type) {
+    if (type == FakeText) {
+        output.append(value.text);
+    } else {
+        appendSigned(output, value.number);
+    }
+}
+
+/** A name and a value, as offsets into one arena of text.
+ */
+struct ArenaProperty {
+    size_t name = 0;
+    size_t nameLength = 0;
+    size_t value = 0;
+    size_t valueLength = 0;
+};
+
+/** Converting into storage that is kept from one instance to the next, the
+ * loop itself, the filter and the formatting allocate nothing at all.
+ */
+static void testNoAllocationsPerProperty() {
+    const std::wregex regex(L"Handle.*|.*Size|Name|CommandLine");
+    const PropertyFilter filter(regex, L"Handle.*|.*Size|Name|CommandLine");
+    FakeObject object = makeProcess();
+    std::vector<ArenaProperty> properties;
+    std::wstring arena;
+
+    size_t kept = 0;
+    const auto convert = [&]() {
+        properties.clear();
+        arena.clear();
+        object.beginEnumeration();
+        convertProperties<FakeValue, FakeType>(properties, [&object](std::wstring &name, FakeValue &value, FakeType &type) {
+            return object.next(name, value, type);
+        }, [&filter](const std::wstring &name) {
+            return filter.matches(name);
+        }, [&arena](ArenaProperty &property, const std::wstring &name, const FakeValue &value, const FakeType type) {
+            property.name = arena.size();
+            property.nameLength = name.size();
+            arena.append(name);
+            property.value = arena.size();
+            storeText(arena, value, type);
+            property.valueLength = arena.size() - property.value;
+        });
+        kept = properties.size();
+    };
+
+    // The first instance warms up the thread's scratch name, the filter's
+    // memo, and the reused storage.
+    convert();
+    const size_t before = allocations;
+    for (int instance = 0; instance < 1000; ++instance) {
+        convert();
+    }
+    CHECK(allocations == before);
+    CHECK(kept == 6);
+    CHECK(arena.compare(properties[0].name, properties[0].nameLength, L"Handle") == 0);
+    CHECK(arena.compare(properties[0].value, properties[0].valueLength, L"1234567") == 0);
+}
+
+/** Converting into fresh storage, as each WmiInstance is, the only allocations
+ * are the property list itself and the strings too long to fit inside their
+ * std::wstring.
+ */
+static void testOnlyStorageAllocates() {
+    const std::wregex regex(L".*");
+    const PropertyFilter filter(regex, L".*");
+    FakeObject object = makeProcess();
+    const size_t inlineCapacity = std::wstring().capacity();
+
+    for (int instance = 0; instance < 3; ++instance) {
+        const size_t before = allocations;
+        std::vector<std::pair<std::wstring, std::wstring>> properties;
+        object.beginEnumeration();
+        convertProperties<FakeValue, FakeType>(properties, [&object](std::wstring &name, FakeValue &value, FakeType &type) {
+            return object.next(name, value, type);
+        }, [&filter](const std::wstring &name) {
+            return filter.matches(name);
+        }, [](auto &property, const std::wstring &name, const FakeValue &value, const FakeType type) {
+            property.first.assign(name);
+            storeText(property.second, value, type);
+        });
+        const size_t made = allocations - before;
+        CHECK(properties.size() == object.properties.size());
+        size_t expected = 1;
+        for (const auto &[name, value]: properties) {
+            expected += name.capacity() > inlineCapacity;
+            expected += value.capacity() > inlineCapacity;
+        }
+        // The first instance also warms up the filter's memo.
+        if (instance > 0) {
+            CHECK(made == expected);
+        }
+        CHECK(properties.capacity() == properties.size() || instance == 0);
+    }
+}
+
+/** The memo answers the same as the regexes do, and forgets what it knew when
+ * a filter gains a regex or another filter is used in between.
+ */
+static void testMemo() {
+    const std::wregex sizes(L".*Size");
+    const std::wregex name(L"Name");
+    PropertyFilter filter(sizes, L".*Size");
+    CHECK(filter.matches(L"VirtualSize"));
+    CHECK(!filter.matches(L"Name"));
+    CHECK(!filter.matches(L"Name"));
+    const std::wstring key = filter.key;
+    filter.add(name, L"Name");
+    CHECK(filter.matches(L"Name"));
+    CHECK(filter.key == key + L"Name" + L'\0');
+
+    const PropertyFilter other(name, L"Name");
+    CHECK(!other.matches(L"VirtualSize"));
+    CHECK(filter.matches(L"VirtualSize"));
+    CHECK(!other.matches(L"VirtualSize"));
+
+    // A filter built straight from a regex has no key, but is remembered too.
+    const PropertyFilter unkeyed(sizes);
+    CHECK(unkeyed.key.empty());
+    CHECK(unkeyed.matches(L"WorkingSetSize"));
+    CHECK(!unkeyed.matches(L"Caption"));
+}
+
+int main() {
+    testNoAllocationsPerProperty();
+    testOnlyStorageAllocates();
+    testMemo();
+    return checkFailures();
+}
@@ -0,0 +1,235 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../sampler.h"
+#include "check.h"
+
+#include <map>
+#include <optional>
+#include <stdexcept>
+
+/** A stand-in for one refreshed instance.  Handles are indices into the
+ * property list, and the name is handle 1000.
+ */
+struct FakeObject {
+    std::vector<std::tuple<std::wstring, SampleKind, uint64_t>> properties;
+    std::optional<std::wstring> name;
+    bool failRead = false;
+    int references = 0;
+};
+
+/** A stand-in for the refreshed enum.
+ */
+struct FakeEnum {
+    std::vector<FakeObject> objects;
+    int calls = 0;
+};
+
+static int handleCalls = 0;
+
+struct FakeTraits {
+    using Enum = FakeEnum;
+    using Object = FakeObject *;
+
+    static bool objects(FakeEnum &source, FakeObject ** const objects, const size_t capacity, size_t &returned) {
+        ++source.calls;
+        returned = source.objects.size();
+        if (capacity < returned) {
+            return false;
+        }
+        for (size_t i = 0; i < returned; ++i) {
+            objects[i] = &source.objects[i];
+            ++objects[i]->references;
+        }
+        return true;
+    }
+
+    static void release(FakeObject * const object) {
+        --object->references;
+    }
+
+    static long handle(FakeObject * const object, const wchar_t * const key, SampleKind &kind) {
+        ++handleCalls;
+        for (size_t i = 0; i < object->properties.size(); ++i) {
+            if (std::get<0>(object->properties[i]) == key) {
+                kind = std::get<1>(object->properties[i]);
+                return static_cast<long>(i);
+            }
+        }
+        throw std::runtime_error("Could not get property handle.");
+    }
+
+    static bool nameHandle(FakeObject * const object, long &handle) {
+        handle = 1000;
+        return static_cast<bool>(object->name);
+    }
+
+    static uint32_t readDword(FakeObject * const object, const long handle) {
+        if (object->failRead) {
+            throw std::runtime_error("Could not read DWORD.");
+        }
+        CHECK(std::get<1>(object->properties.at(handle)) != Sample64);
+        return static_cast<uint32_t>(std::get<2>(object->properties.at(handle)));
+    }
+
+    static uint64_t readQword(FakeObject * const object, const long handle) {
+        CHECK(std::get<1>(object->properties.at(handle)) == Sample64);
+        return std::get<2>(object->properties.at(handle));
+    }
+
+    static bool readString(FakeObject * const object, const long handle, wchar_t * const buffer, const size_t capacity, size_t &length) {
+        CHECK(handle == 1000);
+        length = object->name->size() + 1;
+        if (capacity < length) {
+            return false;
+        }
+        std::copy(object->name->c_str(), object->name->c_str() + length, buffer);
+        return true;
+    }
+};
+
+using Sampled = SampledClass<FakeTraits>;
+
+static FakeObject process(const std::wstring &name, const uint32_t threads, const int32_t priority, const uint64_t bytes) {
+    FakeObject output;
+    output.properties = {
+        {L"ThreadCount", SampleUnsigned32, threads},
+        {L"PriorityBase", SampleSigned32, static_cast<uint32_t>(priority)},
+        {L"WorkingSet", Sample64, bytes},
+    };
+    output.name = name;
+    return output;
+}
+
+static Sampled processClass() {
+    Sampled output;
+    // The class definition's kinds are replaced by the instances'.
+    output.keys = {L"WorkingSet", L"ThreadCount", L"PriorityBase"};
+    output.kinds = {SampleUnsigned32, SampleUnsigned32, SampleUnsigned32};
+    return output;
+}
+
+static bool released(const FakeEnum &source) {
+    for (const auto &object: source.objects) {
+        if (object.references != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testValues() {
+    Sampled sampled = processClass();
+    FakeEnum source;
+    source.objects.push_back(process(L"System", 200, -5, 1ull << 40));
+    source.objects.push_back(process(L"Idle", 8, 0, 4096));
+    sampled.refresh(source);
+    CHECK(released(source));
+    CHECK(sampled.instanceCount == 2);
+    CHECK(sampled.hasName);
+    CHECK(sampled.names[0] == L"System");
+    CHECK(sampled.names[1] == L"Idle");
+    CHECK(sampled.values[0] == 1ull << 40);
+    CHECK(sampled.values[1] == 200);
+    // Signed values are sign extended.
+    CHECK(sampled.values[2] == static_cast<uint64_t>(-5));
+    CHECK(sampled.values[3] == 4096);
+    CHECK(sampled.values[5] == 0);
+}
+
+/** More instances than the first buffer holds, and names longer than the
+ * first string buffer, are fetched again with room for them.
+ */
+static void testGrowing() {
+    Sampled sampled = processClass();
+    FakeEnum source;
+    for (int i = 0; i < 40; ++i) {
+        source.objects.push_back(process(std::wstring(i * 5, L'x'), i, i, i));
+    }
+    sampled.refresh(source);
+    CHECK(source.calls == 2);
+    CHECK(released(source));
+    CHECK(sampled.instanceCount == 40);
+    for (size_t i = 0; i < 40; ++i) {
+        CHECK(sampled.names[i] == std::wstring(i * 5, L'x'));
+        CHECK(sampled.values[i * 3 + 1] == i);
+    }
+
+    // The buffers are big enough from now on.
+    source.calls = 0;
+    sampled.refresh(source);
+    CHECK(source.calls == 1);
+}
+
+/** Handles are resolved from the first instance only, and fewer instances
+ * reuse the same storage.
+ */
+static void testResolvedOnce() {
+    Sampled sampled = processClass();
+    FakeEnum source;
+    source.objects.push_back(process(L"a", 1, 1, 1));
+    source.objects.push_back(process(L"b", 2, 2, 2));
+    handleCalls = 0;
+    sampled.refresh(source);
+    CHECK(handleCalls == 3);
+    const uint64_t * const values = sampled.values.data();
+    source.objects.pop_back();
+    source.objects[0] = process(L"c", 3, 3, 3);
+    sampled.refresh(source);
+    CHECK(handleCalls == 3);
+    CHECK(sampled.instanceCount == 1);
+    CHECK(sampled.values.data() == values);
+    CHECK(sampled.values[1] == 3);
+    CHECK(sampled.names[0] == L"c");
+}
+
+static void testEmptyAndNameless() {
+    Sampled sampled = processClass();
+    FakeEnum source;
+    sampled.refresh(source);
+    CHECK(sampled.instanceCount == 0);
+    CHECK(!sampled.resolved);
+
+    source.objects.push_back(process(L"", 1, 1, 1));
+    source.objects[0].name.reset();
+    sampled.refresh(source);
+    CHECK(sampled.resolved);
+    CHECK(!sampled.hasName);
+    CHECK(sampled.names.empty());
+    CHECK(sampled.values[2] == 1);
+
+    Sampled named = processClass();
+    source.objects[0].name = L"";
+    named.refresh(source);
+    CHECK(named.hasName);
+    CHECK(named.names[0].empty());
+}
+
+/** A failed read throws, and still releases every object.
+ */
+static void testReleasedOnFailure() {
+    Sampled sampled = processClass();
+    FakeEnum source;
+    for (int i = 0; i < 3; ++i) {
+        source.objects.push_back(process(L"a", 1, 1, 1));
+    }
+    source.objects[1].failRead = true;
+    bool threw = false;
+    try {
+        sampled.refresh(source);
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(released(source));
+}
+
+int main() {
+    testValues();
+    testGrowing();
+    testResolvedOnce();
+    testEmptyAndNameless();
+    testReleasedOnFailure();
+    return checkFailures();
+}
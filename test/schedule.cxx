@@ -0,0 +1,234 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../schedule.h"
+#include "check.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+using Clock = Schedule::Clock;
+
+static const Clock::time_point start = Clock::time_point() + 1h;
+
+static const std::vector<std::wstring> classes = {
+    L"Win32_Process",
+    L"Win32_Service",
+    L"Win32_DiskDrive",
+    L"CIM_Other",
+};
+
+/** A class source over the fixed class list.
+ */
+static std::function<bool(std::wstring &)> classSource() {
+    size_t next = 0;
+    return [next](std::wstring &className) mutable {
+        if (next >= classes.size()) {
+            return false;
+        }
+        className = classes[next++];
+        return true;
+    };
+}
+
+/** Move a job to be due at exactly due, with no random first run.
+ */
+static void setDue(Schedule &schedule, const size_t id, const Clock::time_point due) {
+    for (auto &job: schedule.jobs) {
+        if (job.id == id) {
+            job.base = due;
+            job.due = due;
+        }
+    }
+}
+
+/** Drive overlapping jobs on a virtual clock, the way the scheduler thread
+ * does, and check that every pass fetches each wanted class exactly once.
+ */
+static void testOneFetchPerClassPerPass() {
+    Schedule schedule;
+    schedule.random.seed(1);
+    schedule.add(L"Win32_Process", L".*", 1000ms, start);
+    schedule.add(L"Win32_.*", L"Name", 1000ms, start);
+    schedule.add(L"Win32_Service", L".*", 3000ms, start);
+    schedule.add(L"Win32_Process", L".*", 2500ms, start);
+
+    size_t passes = 0;
+    size_t jobRuns = 0;
+    Clock::time_point now = start;
+    while (now < start + 60s) {
+        now = std::max(now, *schedule.earliest());
+        const auto due = schedule.takeDue(now);
+        CHECK(!due.empty());
+        ++passes;
+        jobRuns += due.size();
+
+        std::map<std::wstring, int> fetches;
+        uint64_t expectedRequests = 0;
+        const auto counts = runSchedulePass(due, classSource(), [&](const std::wstring &className, const PassClass &wanting) {
+            ++fetches[className];
+            for (const size_t job: wanting.jobs) {
+                CHECK(std::regex_match(className, due[job].cRegex));
+            }
+            // Each distinct pattern once.
+            for (size_t i = 0; i < wanting.patterns.size(); ++i) {
+                for (size_t j = i + 1; j < wanting.patterns.size(); ++j) {
+                    CHECK(due[wanting.patterns[i]].propertyPattern != due[wanting.patterns[j]].propertyPattern);
+                }
+            }
+            return true;
+        });
+
+        CHECK(counts.classFetches == fetches.size());
+        for (const auto &className: classes) {
+            size_t wanting = 0;
+            for (const auto &job: due) {
+                wanting += std::regex_match(className, job.cRegex);
+            }
+            expectedRequests += wanting;
+            CHECK(fetches[className] == (wanting > 0 ? 1 : 0));
+        }
+        CHECK(counts.classRequests == expectedRequests);
+    }
+    // Coalescing means fewer passes than job runs.
+    CHECK(passes < jobRuns);
+}
+
+static void testOverlappingJobsCoalesce() {
+    Schedule schedule;
+    schedule.window = 500ms;
+    const size_t a = schedule.add(L"Win32_Process", L".*", 1000ms, start);
+    const size_t b = schedule.add(L"Win32_Process", L".*", 1000ms, start);
+    const size_t c = schedule.add(L"Win32_Service", L".*", 1000ms, start);
+    setDue(schedule, a, start);
+    setDue(schedule, b, start + 300ms);
+    setDue(schedule, c, start + 700ms);
+
+    // a and b are within the window, and c isn't.
+    auto due = schedule.takeDue(start);
+    CHECK(due.size() == 2);
+    int fetches = 0;
+    auto counts = runSchedulePass(due, classSource(), [&fetches](const std::wstring &className, const PassClass &wanting) {
+        ++fetches;
+        CHECK(className == L"Win32_Process");
+        CHECK(wanting.jobs.size() == 2);
+        CHECK(wanting.patterns.size() == 1);
+        return true;
+    });
+    CHECK(fetches == 1);
+    CHECK(counts.classRequests == 2);
+    CHECK(counts.classFetches == 1);
+
+    // Each moves on from its own due time.
+    for (const auto &job: schedule.jobs) {
+        if (job.id == a) {
+            CHECK(job.due == start + 1000ms);
+        } else if (job.id == b) {
+            CHECK(job.due == start + 1300ms);
+        } else {
+            CHECK(job.due == start + 700ms);
+        }
+    }
+    CHECK(*schedule.earliest() == start + 700ms);
+}
+
+static void testSkippedClassesAreNotFetches() {
+    Schedule schedule;
+    const size_t id = schedule.add(L"Win32_.*", L".*", 1000ms, start);
+    setDue(schedule, id, start);
+    const auto due = schedule.takeDue(start);
+    const auto counts = runSchedulePass(due, classSource(), [](const std::wstring &className, const PassClass &) {
+        return className != L"Win32_Service";
+    });
+    CHECK(counts.classRequests == 3);
+    CHECK(counts.classFetches == 2);
+}
+
+static void testJitterDoesNotAccumulate() {
+    Schedule schedule;
+    schedule.random.seed(2);
+    schedule.window = 0ms;
+    schedule.jitter = 400ms;
+    const size_t id = schedule.add(L"Win32_Process", L".*", 1000ms, start);
+    setDue(schedule, id, start);
+
+    const size_t runs = 1000;
+    Clock::time_point first, last;
+    for (size_t run = 0; run < runs; ++run) {
+        const auto now = *schedule.earliest();
+        const auto due = schedule.takeDue(now);
+        CHECK(due.size() == 1);
+        if (run == 0) {
+            first = now;
+        }
+        last = now;
+        const auto &job = schedule.jobs.front();
+        CHECK(job.base == start + (run + 1) * 1000ms);
+        CHECK(job.due >= job.base);
+        CHECK(job.due <= job.base + 400ms);
+    }
+    // The average period is the interval, give or take one jitter.
+    const auto period = (last - first) / (runs - 1);
+    CHECK(period >= 1000ms - 1ms);
+    CHECK(period <= 1000ms + 1ms);
+}
+
+static void testLateJobsDoNotRunBackToBack() {
+    Schedule schedule;
+    const size_t id = schedule.add(L"Win32_Process", L".*", 1000ms, start);
+    setDue(schedule, id, start);
+    const auto late = start + 10s;
+    CHECK(schedule.takeDue(late).size() == 1);
+    CHECK(schedule.jobs.front().due == late);
+    CHECK(schedule.takeDue(late).size() == 1);
+    CHECK(schedule.jobs.front().due == late + 1000ms);
+}
+
+static void testFirstRunIsSpread() {
+    Schedule schedule;
+    schedule.random.seed(3);
+    for (int i = 0; i < 100; ++i) {
+        schedule.add(L"Win32_Process", L".*", 1000ms, start);
+    }
+    for (const auto &job: schedule.jobs) {
+        CHECK(job.due >= start);
+        CHECK(job.due <= start + 1000ms);
+        CHECK(job.due == job.base);
+    }
+}
+
+static void testAddAndRemove() {
+    Schedule schedule;
+    CHECK(!schedule.earliest());
+    const size_t a = schedule.add(L"Win32_Process", L".*", 1000ms, start);
+    const size_t b = schedule.add(L"Win32_Service", L".*", 1000ms, start);
+    CHECK(a != b);
+    CHECK(schedule.remove(a));
+    CHECK(!schedule.remove(a));
+    CHECK(schedule.jobs.size() == 1);
+    CHECK(schedule.jobs.front().id == b);
+
+    bool threw = false;
+    try {
+        schedule.add(L"(", L".*", 1000ms, start);
+    } catch (const std::regex_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(schedule.jobs.size() == 1);
+}
+
+int main() {
+    testOneFetchPerClassPerPass();
+    testOverlappingJobsCoalesce();
+    testSkippedClassesAreNotFetches();
+    testJitterDoesNotAccumulate();
+    testLateJobsDoNotRunBackToBack();
+    testFirstRunIsSpread();
+    testAddAndRemove();
+    return checkFailures();
+}
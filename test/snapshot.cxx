@@ -0,0 +1,342 @@
+/* Copyright © 2019 Taylor C. Richberger <taywee@gmx.com>
+ * This code is released under the license described in the LICENSE file
+ */
+
+#include "../snapshot.h"
+#include "check.h"
+
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/** A snapshot file in memory, aligned as a mapping would be.
+ */
+struct Buffer {
+    std::vector<uint64_t> words;
+    size_t size = 0;
+
+    const char *data() const {
+        return reinterpret_cast<const char *>(words.data());
+    }
+
+    char *data() {
+        return reinterpret_cast<char *>(words.data());
+    }
+};
+
+static Buffer join(const std::vector<std::pair<const void *, size_t>> &pieces) {
+    Buffer output;
+    for (const auto &piece: pieces) {
+        output.size += piece.second;
+    }
+    output.words.resize((output.size + 7) / 8);
+    size_t offset = 0;
+    for (const auto &[data, size]: pieces) {
+        if (size == 0) {
+            continue;
+        }
+        std::memcpy(output.data() + offset, data, size);
+        offset += size;
+    }
+    return output;
+}
+
+/** A synthetic instance, as an enum would give it.
+ */
+struct Instance {
+    const char16_t *className;
+    const char16_t *path;
+    std::vector<std::pair<const char16_t *, const char16_t *>> properties;
+};
+
+/** The runs of instances of the same class, as (first, count).
+ */
+static std::vector<std::pair<size_t, size_t>> classRuns(const std::vector<Instance> &instances) {
+    std::vector<std::pair<size_t, size_t>> output;
+    for (size_t i = 0; i < instances.size(); ++i) {
+        if (output.empty() || std::u16string(instances[i].className) != instances[i - 1].className) {
+            output.emplace_back(i, 0);
+        }
+        ++output.back().second;
+    }
+    return output;
+}
+
+static Buffer write(const std::vector<Instance> &instances) {
+    size_t propertyCount = 0;
+    for (const auto &instance: instances) {
+        propertyCount += instance.properties.size();
+    }
+    const auto runs = classRuns(instances);
+    SnapshotWriter writer(runs.size(), instances.size(), propertyCount);
+    auto run = runs.begin();
+    for (size_t i = 0; i < instances.size(); ++i) {
+        const Instance &instance = instances[i];
+        if (run != runs.end() && run->first == i) {
+            writer.addClass(instance.className, run->second);
+            ++run;
+        }
+        writer.addInstance(instance.className, instance.path, instance.properties.size());
+        for (const auto &[key, value]: instance.properties) {
+            writer.addProperty(key, value);
+        }
+    }
+    return join(writer.finish());
+}
+
+static bool opens(const Buffer &buffer) {
+    try {
+        SnapshotView view(buffer.data(), buffer.size);
+        return true;
+    } catch (const std::runtime_error &) {
+        return false;
+    }
+}
+
+static bool equal(const char16_t * const a, const char16_t * const b) {
+    return a && b && std::u16string(a) == b;
+}
+
+static const std::vector<Instance> sample = {
+    {u"Win32_Process", u"Win32_Process.Handle=\"4\"", {{u"Handle", u"4"}, {u"Name", u"System"}}},
+    {u"Win32_Process", u"Win32_Process.Handle=\"8\"", {{u"Handle", u"8"}, {u"Name", u""}}},
+    {u"Win32_Service", nullptr, {}},
+    {u"Win32_Service", u"Win32_Service.Name=\"été\"", {{u"Name", nullptr}}},
+};
+
+static void testRoundTrip() {
+    const Buffer buffer = write(sample);
+    const SnapshotView view(buffer.data(), buffer.size);
+    CHECK(view.instanceCount() == sample.size());
+    for (size_t i = 0; i < sample.size(); ++i) {
+        const SnapshotInstance * const instance = view.instance(i);
+        CHECK(instance);
+        CHECK(equal(view.string(instance->className), sample[i].className));
+        CHECK(equal(view.string(instance->path), sample[i].path ? sample[i].path : u""));
+        CHECK(instance->propertyCount == sample[i].properties.size());
+        for (size_t p = 0; p < sample[i].properties.size(); ++p) {
+            const SnapshotProperty * const property = view.property(*instance, p);
+            CHECK(property);
+            CHECK(equal(view.string(property->key), sample[i].properties[p].first));
+            const char16_t * const value = sample[i].properties[p].second;
+            CHECK(equal(view.string(property->value), value ? value : u""));
+        }
+        CHECK(!view.property(*instance, sample[i].properties.size()));
+    }
+    CHECK(!view.instance(sample.size()));
+
+    CHECK(view.classCount() == 2);
+    const SnapshotClass * const processes = view.snapshotClass(0);
+    const SnapshotClass * const services = view.snapshotClass(1);
+    CHECK(processes && equal(view.string(processes->className), u"Win32_Process"));
+    CHECK(processes && processes->firstInstance == 0 && processes->instanceCount == 2);
+    CHECK(services && equal(view.string(services->className), u"Win32_Service"));
+    CHECK(services && services->firstInstance == 2 && services->instanceCount == 2);
+    CHECK(!view.snapshotClass(2));
+
+    // Class names and keys are interned, and values aren't.
+    CHECK(processes && processes->className == view.instance(0)->className);
+    CHECK(view.instance(0)->className == view.instance(1)->className);
+    CHECK(view.property(*view.instance(0), 0)->key == view.property(*view.instance(1), 0)->key);
+    CHECK(view.property(*view.instance(0), 0)->value != view.property(*view.instance(1), 0)->value);
+}
+
+static void testEmpty() {
+    const Buffer buffer = write({});
+    const SnapshotView view(buffer.data(), buffer.size);
+    CHECK(view.instanceCount() == 0);
+    CHECK(!view.instance(0));
+    CHECK(view.classCount() == 0);
+    CHECK(!view.snapshotClass(0));
+}
+
+/** The writer refuses classes that don't cover the instances added, in order.
+ */
+static void testClassesMustMatch() {
+    const auto throws = [](const auto &build) {
+        try {
+            SnapshotWriter writer(2, 2, 0);
+            build(writer);
+            writer.finish();
+            return false;
+        } catch (const std::logic_error &) {
+            return true;
+        }
+    };
+    CHECK(!throws([](SnapshotWriter &writer) {
+        writer.addClass(u"A", 1);
+        writer.addInstance(u"A", u"", 0);
+        writer.addClass(u"B", 1);
+        writer.addInstance(u"B", u"", 0);
+    }));
+    CHECK(throws([](SnapshotWriter &writer) {
+        writer.addClass(u"A", 2);
+        writer.addInstance(u"A", u"", 0);
+        writer.addClass(u"B", 1);
+        writer.addInstance(u"B", u"", 0);
+    }));
+    CHECK(throws([](SnapshotWriter &writer) {
+        writer.addClass(u"A", 1);
+        writer.addInstance(u"A", u"", 0);
+        writer.addInstance(u"A", u"", 0);
+    }));
+}
+
+/** A class whose instances run past the instance table is never given out,
+ * and the table itself must be inside the file.
+ */
+static void testClassBounds() {
+    const Buffer good = write(sample);
+    Buffer buffer = good;
+    auto * const classes = reinterpret_cast<SnapshotClass *>(buffer.data() + sizeof(SnapshotHeader));
+    classes[1].instanceCount = 3;
+    SnapshotView view(buffer.data(), buffer.size);
+    CHECK(view.snapshotClass(0));
+    CHECK(!view.snapshotClass(1));
+    classes[1].firstInstance = UINT64_MAX;
+    classes[1].instanceCount = 2;
+    CHECK(!view.snapshotClass(1));
+    classes[1].firstInstance = 4;
+    classes[1].instanceCount = 0;
+    CHECK(view.snapshotClass(1));
+}
+
+static void testStringBounds() {
+    const Buffer buffer = write(sample);
+    const SnapshotView view(buffer.data(), buffer.size);
+    const uint64_t strings = view.header->stringsOffset;
+    CHECK(view.string(strings));
+    CHECK(!view.string(strings - 2));
+    CHECK(!view.string(0));
+    CHECK(!view.string(strings + 1));
+    CHECK(!view.string(buffer.size));
+    CHECK(view.string(buffer.size - 2));
+    CHECK(!view.string(UINT64_MAX));
+}
+
+static void testBadHeaders() {
+    const Buffer good = write(sample);
+    CHECK(opens(good));
+
+    Buffer buffer = good;
+    buffer.size = sizeof(SnapshotHeader) - 1;
+    CHECK(!opens(buffer));
+
+    buffer = good;
+    buffer.data()[0] = 'X';
+    CHECK(!opens(buffer));
+
+    const auto header = [](Buffer &buffer) {
+        return reinterpret_cast<SnapshotHeader *>(buffer.data());
+    };
+    buffer = good;
+    ++header(buffer)->version;
+    CHECK(!opens(buffer));
+
+    // Truncated, or with trailing bytes.
+    buffer = good;
+    buffer.size -= 2;
+    CHECK(!opens(buffer));
+    buffer = good;
+    header(buffer)->fileSize += 2;
+    CHECK(!opens(buffer));
+
+    buffer = good;
+    header(buffer)->classCount = UINT64_MAX / sizeof(SnapshotClass);
+    CHECK(!opens(buffer));
+    buffer = good;
+    header(buffer)->classesOffset += 4;
+    CHECK(!opens(buffer));
+    buffer = good;
+    header(buffer)->classesOffset = UINT64_MAX - 7;
+    CHECK(!opens(buffer));
+    buffer = good;
+    header(buffer)->instanceCount = UINT64_MAX / sizeof(SnapshotInstance);
+    CHECK(!opens(buffer));
+    buffer = good;
+    header(buffer)->propertyCount = UINT64_MAX;
+    CHECK(!opens(buffer));
+    buffer = good;
+    header(buffer)->instancesOffset += 4;
+    CHECK(!opens(buffer));
+    buffer = good;
+    header(buffer)->propertiesOffset = UINT64_MAX - 7;
+    CHECK(!opens(buffer));
+    buffer = good;
+    header(buffer)->stringsOffset += 1;
+    CHECK(!opens(buffer));
+    buffer = good;
+    header(buffer)->stringsOffset = UINT64_MAX - 1;
+    CHECK(!opens(buffer));
+
+    // Must end in a terminator.
+    buffer = good;
+    reinterpret_cast<char16_t *>(buffer.data() + buffer.size)[-1] = u'x';
+    CHECK(!opens(buffer));
+}
+
+/** Whatever is corrupted, a snapshot that opens only ever gives null, or
+ * strings terminated inside the file.
+ */
+static void testFuzz() {
+    const Buffer good = write(sample);
+    std::mt19937_64 random(1);
+    size_t opened = 0;
+    for (int i = 0; i < 20000; ++i) {
+        Buffer buffer = good;
+        const int flips = 1 + random() % 8;
+        for (int f = 0; f < flips; ++f) {
+            buffer.data()[random() % buffer.size] ^= static_cast<char>(1 << (random() % 8));
+        }
+        if (!opens(buffer)) {
+            continue;
+        }
+        ++opened;
+        const SnapshotView view(buffer.data(), buffer.size);
+        const char * const end = buffer.data() + buffer.size;
+        const auto terminated = [end](const char16_t *string) {
+            if (!string) {
+                return true;
+            }
+            while (reinterpret_cast<const char *>(string) < end) {
+                if (*string++ == u'\0') {
+                    return true;
+                }
+            }
+            return false;
+        };
+        for (size_t index = 0; index < view.classCount(); ++index) {
+            if (const SnapshotClass * const snapshotClass = view.snapshotClass(index)) {
+                CHECK(terminated(view.string(snapshotClass->className)));
+                CHECK(snapshotClass->firstInstance + snapshotClass->instanceCount <= view.instanceCount());
+            }
+        }
+        for (size_t index = 0; index < view.instanceCount(); ++index) {
+            const SnapshotInstance * const instance = view.instance(index);
+            CHECK(instance);
+            CHECK(terminated(view.string(instance->className)));
+            CHECK(terminated(view.string(instance->path)));
+            for (size_t p = 0; p < instance->propertyCount && p < 64; ++p) {
+                if (const SnapshotProperty * const property = view.property(*instance, p)) {
+                    CHECK(terminated(view.string(property->key)));
+                    CHECK(terminated(view.string(property->value)));
+                }
+            }
+        }
+    }
+    // Flips in the strings and tables still open.
+    CHECK(opened > 0);
+}
+
+int main() {
+    testRoundTrip();
+    testEmpty();
+    testClassesMustMatch();
+    testClassBounds();
+    testStringBounds();
+    testBadHeaders();
+    testFuzz();
+    return checkFailures();
+}
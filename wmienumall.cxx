@@ -6,16 +6,47 @@
 #include <comdef.h>
 #include <wbemidl.h>
 #include <regex>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cmath>
+#include <cstdint>
 #include <cstring>
+#include <cwchar>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <vector>
 #include <optional>
+#include <random>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <tuple>
+#include <unordered_map>
 
 #include "wmienumall.h"
+#include "batchsizer.h"
+#include "circuitbreaker.h"
+#include "datetime.h"
+#include "diff.h"
+#include "invariant.h"
+#include "livetable.h"
+#include "mpscqueue.h"
+#include "nextwait.h"
+#include "perfcounter.h"
+#include "pipeline.h"
+#include "prefetch.h"
+#include "propertyfilter.h"
+#include "propertyloop.h"
+#include "sampler.h"
+#include "schedule.h"
+#include "scopedtimer.h"
+#include "snapshot.h"
 
 /** Simple wrapper that checks an hres and throws an exception on failure.
  */
@@ -56,7 +87,10 @@ struct ComLibrary {
  * Only initializes the security once.
  */
 static void comSecurity() {
+    // Workers may connect from several threads at once.
+    static std::mutex mutex;
     static bool initialized = false;
+    std::lock_guard<std::mutex> lock(mutex);
     if (!initialized) {
         checkResult(CoInitializeSecurity(
             NULL, 
@@ -73,6 +107,8 @@ static void comSecurity() {
     }
 }
 
+static_assert(static_cast<uint32_t>(waitInfinite) == WBEM_INFINITE, "waitInfinite must be WBEM_INFINITE");
+
 /** Simple wrapper for creation and release of IWebmLocator.
  */
 struct Locator {
@@ -105,14 +141,13 @@ struct Locator {
 };
 
 /** Simple RAII wrapper around IWbemServices.
- * Stores its own locator.
+ * Stores its own locator.  COM must already be initialized on the thread.
  */
-struct Services {
-        const ComLibrary library;
+struct Connection {
         Locator locator;
 
         IWbemServices *pSvc;
-        Services(const std::wstring &wmiNamespace = L"ROOT\\CIMV2") {
+        Connection(const std::wstring &wmiNamespace = L"ROOT\\CIMV2") {
             comSecurity();
 
             _bstr_t string(wmiNamespace.c_str()); // Object path of WMI namespace
@@ -129,18 +164,19 @@ struct Services {
                     "Could not connect. Error code = 0x");
         }
 
-        Services(const Services &) = delete;
-        Services(Services &&other) {
+        Connection(const Connection &) = delete;
+        Connection(Connection &&other) : locator(std::move(other.locator)) {
             pSvc = other.pSvc;
             other.pSvc = nullptr;
         }
-        Services &operator=(const Services &) = delete;
-        Services &operator=(Services &&other) {
+        Connection &operator=(const Connection &) = delete;
+        Connection &operator=(Connection &&other) {
+            std::swap(locator, other.locator);
             std::swap(pSvc, other.pSvc);
             return *this;
         }
 
-        ~Services() {
+        ~Connection() {
             if (pSvc) {
                 pSvc->Release();
             }
@@ -163,27 +199,298 @@ struct Services {
         }
 };
 
+/** A Connection which initializes COM on its thread for as long as it lives,
+ * for things which hold their own connection rather than using the pool.
+ */
+struct Services : ComLibrary, Connection {
+        Services(const std::wstring &wmiNamespace = L"ROOT\\CIMV2") : Connection(wmiNamespace) {
+        }
+};
+
+/** RAII wrapper around CoIncrementMTAUsage, which keeps the multithreaded
+ * apartment alive even while no thread has COM initialized, so that pooled
+ * connections can outlive the threads that made them.  CoIncrementMTAUsage is
+ * what makes Windows 8 the minimum.
+ */
+struct MtaUsage {
+        CO_MTA_USAGE_COOKIE cookie;
+
+        MtaUsage() {
+            checkResult(CoIncrementMTAUsage(&cookie), "Failed to keep the multithreaded apartment alive.");
+        }
+
+        MtaUsage(const MtaUsage &) = delete;
+        MtaUsage &operator=(const MtaUsage &) = delete;
+
+        ~MtaUsage() {
+            CoDecrementMTAUsage(cookie);
+        }
+};
+
+/** Thread-safe pool of connected, proxy blanketed connections to a single
+ * namespace.  At most maxSize connections are open at once, and checkout waits
+ * for one to be checked in beyond that.  Connections that have been idle for a
+ * while, or that were in use when an exception was thrown, are checked with a
+ * cheap call before they are handed out again.
+ */
+struct ConnectionPool {
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::seconds healthCheckAge{10};
+
+    struct Idle {
+        std::unique_ptr<Connection> connection;
+        Clock::time_point since;
+    };
+
+    /** A checked out connection, which is checked back in when it is destroyed.
+     */
+    struct Lease {
+        ConnectionPool *pool = nullptr;
+        std::unique_ptr<Connection> connection;
+        int exceptions = 0;
+
+        Lease() = default;
+
+        Lease(ConnectionPool *pool, std::unique_ptr<Connection> connection) : pool(pool), connection(std::move(connection)), exceptions(std::uncaught_exceptions()) {
+        }
+
+        Lease(const Lease &) = delete;
+        Lease(Lease &&other) : pool(other.pool), connection(std::move(other.connection)), exceptions(other.exceptions) {
+        }
+        Lease &operator=(const Lease &) = delete;
+        Lease &operator=(Lease &&other) {
+            std::swap(pool, other.pool);
+            std::swap(connection, other.connection);
+            std::swap(exceptions, other.exceptions);
+            return *this;
+        }
+
+        ~Lease() {
+            if (connection) {
+                // Being destroyed by an exception makes the connection suspect.
+                pool->checkin(std::move(connection), std::uncaught_exceptions() > exceptions);
+            }
+        }
+
+        Connection &operator*() {
+            return *connection;
+        }
+
+        Connection *operator->() {
+            return connection.get();
+        }
+    };
+
+    const std::wstring wmiNamespace;
+    std::vector<Idle> idle;
+    size_t open = 0;
+    size_t maxSize;
+    uint64_t created = 0;
+    uint64_t reused = 0;
+    uint64_t discarded = 0;
+    std::mutex mutex;
+    std::condition_variable available;
+
+    ConnectionPool(std::wstring wmiNamespace, const size_t maxSize) : wmiNamespace(std::move(wmiNamespace)), maxSize(maxSize) {
+    }
+
+    /** Check out a connection, waiting for one if the pool is at its maximum.
+     */
+    Lease checkout() {
+        return std::move(acquire(true).value());
+    }
+
+    /** Check out a connection only if one is available right now.
+     */
+    std::optional<Lease> tryCheckout() {
+        return acquire(false);
+    }
+
+    void checkin(std::unique_ptr<Connection> connection, const bool suspect) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (open <= maxSize) {
+                // A suspect connection looks as old as possible, so it is
+                // checked before it is used again.
+                idle.push_back(Idle{std::move(connection), suspect ? Clock::time_point() : Clock::now()});
+            } else {
+                // The pool was shrunk while this was checked out.
+                --open;
+                ++discarded;
+            }
+        }
+        available.notify_one();
+        // Anything not kept is released here, outside of the lock.
+    }
+
+    /** Release all the idle connections.
+     */
+    void clear() {
+        std::vector<Idle> released;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            released.swap(idle);
+            open -= released.size();
+            discarded += released.size();
+        }
+        available.notify_all();
+    }
+
+private:
+    static bool healthy(Connection &connection) {
+        IWbemClassObject *object = nullptr;
+        _bstr_t path(L"__SystemClass");
+        const HRESULT hres = connection.pSvc->GetObject(path.GetBSTR(), 0, nullptr, &object, nullptr);
+        if (object) {
+            object->Release();
+        }
+        return SUCCEEDED(hres);
+    }
+
+    std::optional<Lease> acquire(const bool wait) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            // Most recently used first, as it is the most likely to be warm.
+            while (!idle.empty()) {
+                Idle entry = std::move(idle.back());
+                idle.pop_back();
+                if (Clock::now() - entry.since >= healthCheckAge) {
+                    lock.unlock();
+                    const bool ok = healthy(*entry.connection);
+                    if (!ok) {
+                        entry.connection.reset();
+                    }
+                    lock.lock();
+                    if (!ok) {
+                        --open;
+                        ++discarded;
+                        continue;
+                    }
+                }
+                ++reused;
+                return std::make_optional<Lease>(this, std::move(entry.connection));
+            }
+            if (open < maxSize) {
+                ++open;
+                lock.unlock();
+                try {
+                    auto connection = std::make_unique<Connection>(wmiNamespace);
+                    connection->setProxyBlanket();
+                    lock.lock();
+                    ++created;
+                    return std::make_optional<Lease>(this, std::move(connection));
+                } catch (...) {
+                    if (!lock.owns_lock()) {
+                        lock.lock();
+                    }
+                    --open;
+                    lock.unlock();
+                    available.notify_one();
+                    throw;
+                }
+            }
+            if (!wait) {
+                return std::nullopt;
+            }
+            available.wait(lock);
+        }
+    }
+};
+
+/** The process-wide connection pools, one per namespace.
+ */
+struct ConnectionPools {
+    MtaUsage mta;
+    size_t maxSize = 8;
+    std::unordered_map<std::wstring, std::unique_ptr<ConnectionPool>> pools;
+    std::mutex mutex;
+
+    /** Never destroyed, as releasing COM proxies from a static destructor would
+     * happen too late to be safe.  WmiPool_clear releases the idle connections
+     * explicitly.
+     */
+    static ConnectionPools &instance() {
+        static ConnectionPools * const pools = new ConnectionPools();
+        return *pools;
+    }
+
+    ConnectionPool &get(const std::wstring &wmiNamespace = L"ROOT\\CIMV2") {
+        std::wstring key(wmiNamespace);
+        std::transform(key.begin(), key.end(), key.begin(), towupper);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &pool = pools[key];
+        if (!pool) {
+            pool = std::make_unique<ConnectionPool>(wmiNamespace, maxSize);
+        }
+        return *pool;
+    }
+};
+
+/** Format a scalar variant without regard to the thread locale, so that the
+ * output is the same on every host.  Returns false for types this doesn't
+ * handle, which are left to VariantChangeType.
+ */
+static bool appendInvariant(const VARIANT &variant, std::wstring &output) {
+    switch (variant.vt) {
+        case VT_I1:
+            appendSigned(output, variant.cVal);
+            return true;
+        case VT_I2:
+            appendSigned(output, variant.iVal);
+            return true;
+        case VT_I4:
+            appendSigned(output, variant.lVal);
+            return true;
+        case VT_INT:
+            appendSigned(output, variant.intVal);
+            return true;
+        case VT_I8:
+            appendSigned(output, variant.llVal);
+            return true;
+        case VT_UI1:
+            appendUnsigned(output, variant.bVal);
+            return true;
+        case VT_UI2:
+            appendUnsigned(output, variant.uiVal);
+            return true;
+        case VT_UI4:
+            appendUnsigned(output, variant.ulVal);
+            return true;
+        case VT_UINT:
+            appendUnsigned(output, variant.uintVal);
+            return true;
+        case VT_UI8:
+            appendUnsigned(output, variant.ullVal);
+            return true;
+        case VT_R4:
+            appendFloating(output, variant.fltVal);
+            return true;
+        case VT_R8:
+            appendFloating(output, variant.dblVal);
+            return true;
+        case VT_BOOL:
+            output.append(variant.boolVal ? L"True" : L"False");
+            return true;
+        default:
+            return false;
+    }
+}
+
 /** Simple VARIANT wrapper, which acts to add proper RAII semantics to the
- * VARIANT type.
+ * VARIANT type.  The VARIANT is held inline, so a Variant on the stack costs
+ * no allocation.
  */
 struct Variant {
-        VARIANT *variant;
-        std::wstring buffer;
+        VARIANT variant;
 
         Variant() {
-            variant = new VARIANT();
-            VariantInit(variant);
-        }
-
-        /** Assume variant to take ownership of.
-         */
-        Variant(VARIANT *variant) : variant(variant) {
+            VariantInit(&variant);
         }
 
         Variant(const Variant &) = delete;
-        Variant(Variant &&other) {
-            variant = other.variant;
-            other.variant = nullptr;
+        Variant(Variant &&other) : variant(other.variant) {
+            VariantInit(&other.variant);
         }
         Variant &operator=(const Variant &) = delete;
         Variant &operator=(Variant &&other) {
@@ -192,43 +499,65 @@ struct Variant {
         }
 
         ~Variant() {
-            if (variant) {
-                VariantClear(variant);
-                delete variant;
-            }
+            VariantClear(&variant);
         }
 
         operator VARIANT*() {
-            return variant;
+            return &variant;
         }
 
-        operator VARIANT**() {
-            return &variant;
+        /** Take ownership of the BSTR held by this, leaving it VT_EMPTY.
+         * Returns null if this does not hold a non-empty scalar BSTR.
+         */
+        BSTR adopt() {
+            if (variant.vt != VT_BSTR || !variant.bstrVal) {
+                return nullptr;
+            }
+            BSTR output = variant.bstrVal;
+            variant.vt = VT_EMPTY;
+            variant.bstrVal = nullptr;
+            return output;
         }
 
-        /** Get all the strings contained in this variant.
-         * If this is not an array type, there will only be one string.
+        /** Release the contents, leaving this VT_EMPTY for reuse.
+         */
+        void clear() {
+            VariantClear(&variant);
+        }
+
+        /** Append the strings from this variant to output, joined by a comma
+         * and space between each.  If this is not an array type, there will
+         * only be one string.
+         *
+         * This is not identical to old behavior, but that behavior was bad, and
+         * would often cause undesirable things (like an array of integers being
+         * interpreted as a single larger integer of multiple digits).
          */
-        std::vector<std::wstring> getStrings() {
-            return getStrings(variant);
+        void appendString(std::wstring &output, WmiStats *stats = nullptr, const bool invariant = false) {
+            appendString(variant, output, stats, invariant);
         }
 
-        /** Get the strings contained in the target variant.
+        /** Append the strings contained in the target variant to output.
          *
          * Kept as a separate static function so that this can be recursively
-         * called on update if later necessary.
+         * called on update if later necessary.  If invariant is set, numbers
+         * and booleans are formatted the same regardless of locale.
          */
-        static std::vector<std::wstring> getStrings(VARIANT *variant) {
-            std::vector<std::wstring> output;
-            const VARTYPE type = variant->vt;
+        static void appendString(VARIANT &variant, std::wstring &output, WmiStats *stats = nullptr, const bool invariant = false) {
+            static constexpr wchar_t separator[] = L", ";
+            ScopedTimer timer(stats ? &stats->conversionTime : nullptr);
+            if (stats) {
+                ++stats->conversions;
+            }
+            const VARTYPE type = variant.vt;
             // Check for array.  Later arrays can be handled better, but at the
             // moment, the only SAFEARRAY type that is handled is a BSTR array
             if (type & VT_ARRAY) {
                 SAFEARRAY *array;
                 if (type & VT_BYREF) {
-                    array = *variant->pparray;
+                    array = *variant.pparray;
                 } else {
-                    array = variant->parray;
+                    array = variant.parray;
                 }
                 if (type & VT_BSTR) {
                     BSTR *vals;
@@ -241,43 +570,25 @@ struct Variant {
                             "Failed to access array upperwer bound.");
                     const long elementCount = upperBound - lowerBound + 1;
                     for (long i = 0; i < elementCount; ++i) {
-                        output.emplace_back(vals[i], SysStringLen(vals[i]));
+                        if (i > 0) {
+                            output.append(separator);
+                        }
+                        output.append(vals[i], SysStringLen(vals[i]));
                     }
                     SafeArrayUnaccessData(array);
                 }
-            } else {
-                if (!(type == VT_EMPTY || type == VT_NULL)) {
-                    Variant newVariant;
-                    checkResult(VariantChangeType(newVariant, variant, VARIANT_ALPHABOOL, VT_BSTR),
-                            "Failed to convert variant to BSTR.");
-                    BSTR val = newVariant.variant->bstrVal;
-                    output.emplace_back(val, SysStringLen(val));
-                }
-            }
-            return output;
-        }
-
-        /** Get the strings from this variant joined by a comma and space
-         * between each, and sets the content string to be equal to this.
-         *
-         * This is not identical to old behavior, but that behavior was bad, and
-         * would often cause undesirable things (like an array of integers being
-         * interpreted as a single larger integer of multiple digits).
-         */
-        std::wstring &getString() {
-            static const std::wstring separator = L", ";
-            std::wostringstream oss;
-            const auto strings = getStrings();
-            auto it = std::begin(strings);
-            auto end = std::end(strings);
-            if (it != end) {
-                oss << *it;
-                for (++it; it != end; ++it) {
-                    oss << separator << *it;
-                }
+            } else if (type == VT_BSTR) {
+                // Already a string, so there is nothing to convert.
+                output.append(variant.bstrVal, SysStringLen(variant.bstrVal));
+            } else if (invariant && appendInvariant(variant, output)) {
+                return;
+            } else if (!(type == VT_EMPTY || type == VT_NULL)) {
+                Variant newVariant;
+                checkResult(VariantChangeType(newVariant, &variant, VARIANT_ALPHABOOL, VT_BSTR),
+                        "Failed to convert variant to BSTR.");
+                BSTR val = newVariant.variant.bstrVal;
+                output.append(val, SysStringLen(val));
             }
-            buffer = oss.str();
-            return buffer;
         }
 };
 
@@ -322,25 +633,72 @@ struct WbemClass {
             }
         }
 
-        /** Used to iterate through all items in this iterator.
+        /** Used to iterate through all items in this iterator.  The name and
+         * value are overwritten in place, so that the same storage can be
+         * reused for every property.  type is optionally set to the
+         * property's CIMTYPE.  Returns false at the end.
          */
-        std::optional<std::tuple<std::wstring, Variant>> next() {
-            BSTR name = nullptr;
-            Variant value;
+        bool next(std::wstring &name, Variant &value, WmiStats *stats = nullptr, CIMTYPE *type = nullptr) {
+            ScopedTimer timer(stats ? &stats->propertyTime : nullptr);
+            BSTR bName = nullptr;
+            value.clear();
             const HRESULT hres = obj->Next(
                 0,
-                &name,
+                &bName,
                 value,
-                nullptr,
+                type,
                 nullptr
                 );
             if (hres == WBEM_S_NO_MORE_DATA) {
-                return std::nullopt;
+                return false;
             }
             checkResult(hres, "Failed to get next value.");
-            // Wrap the BSTR to ensure it is correctly freed
-            _bstr_t namestring(name, false);
-            return std::make_optional<std::tuple<std::wstring, Variant>>(std::wstring(namestring.GetBSTR(), namestring.length()), std::move(value));
+            if (stats) {
+                ++stats->properties;
+            }
+            name.assign(bName, SysStringLen(bName));
+            SysFreeString(bName);
+            return true;
+        }
+};
+
+/** Generic owning pointer for COM interfaces without a dedicated wrapper.
+ */
+template <typename T>
+struct ComPointer {
+        T *pointer;
+
+        ComPointer() : pointer(nullptr) {
+        }
+
+        /** Assume pointer to take ownership of.
+         */
+        ComPointer(T *pointer) : pointer(pointer) {
+        }
+
+        ComPointer(const ComPointer &) = delete;
+        ComPointer(ComPointer &&other) {
+            pointer = other.pointer;
+            other.pointer = nullptr;
+        }
+        ComPointer &operator=(const ComPointer &) = delete;
+        ComPointer &operator=(ComPointer &&other) {
+            std::swap(pointer, other.pointer);
+            return *this;
+        }
+
+        ~ComPointer() {
+            if (pointer) {
+                pointer->Release();
+            }
+        }
+
+        T *operator->() const {
+            return pointer;
+        }
+
+        operator T**() {
+            return &pointer;
         }
 };
 
@@ -348,6 +706,8 @@ struct WbemClass {
  */
 struct EnumWbemClasses {
         IEnumWbemClassObject *enumClasses;
+        BatchSizer sizer;
+        std::vector<IWbemClassObject *> buffer;
 
         EnumWbemClasses() : enumClasses(nullptr) {
         }
@@ -355,14 +715,22 @@ struct EnumWbemClasses {
         EnumWbemClasses(IEnumWbemClassObject *enumClasses) : enumClasses(enumClasses) {
         }
 
-        static EnumWbemClasses classEnum(Services &services) {
+        static EnumWbemClasses classEnum(Connection &services, WmiStats *stats = nullptr) {
+            ScopedTimer timer(stats ? &stats->createEnumTime : nullptr);
+            if (stats) {
+                ++stats->createEnumCalls;
+            }
             EnumWbemClasses output;
             checkResult(services.pSvc->CreateClassEnum(nullptr, WBEM_FLAG_FORWARD_ONLY | WBEM_FLAG_RETURN_IMMEDIATELY, nullptr, output),
                     "Could not Create class enum.");
             return output;
         }
 
-        static EnumWbemClasses instanceEnum(Services &services, const BSTR className) {
+        static EnumWbemClasses instanceEnum(Connection &services, const BSTR className, WmiStats *stats = nullptr) {
+            ScopedTimer timer(stats ? &stats->createEnumTime : nullptr);
+            if (stats) {
+                ++stats->createEnumCalls;
+            }
             EnumWbemClasses output;
             checkResult(services.pSvc->CreateInstanceEnum(className, WBEM_FLAG_FORWARD_ONLY | WBEM_FLAG_RETURN_IMMEDIATELY, nullptr, output),
                 "Could not create instance enum.");
@@ -370,13 +738,15 @@ struct EnumWbemClasses {
         }
 
         EnumWbemClasses(const EnumWbemClasses &) = delete;
-        EnumWbemClasses(EnumWbemClasses &&other) {
+        EnumWbemClasses(EnumWbemClasses &&other) : sizer(other.sizer), buffer(std::move(other.buffer)) {
             enumClasses = other.enumClasses;
             other.enumClasses = nullptr;
         }
         EnumWbemClasses &operator=(const EnumWbemClasses &) = delete;
         EnumWbemClasses &operator=(EnumWbemClasses &&other) {
             std::swap(enumClasses, other.enumClasses);
+            std::swap(sizer, other.sizer);
+            std::swap(buffer, other.buffer);
             return *this;
         }
 
@@ -390,17 +760,41 @@ struct EnumWbemClasses {
             }
         }
 
-        /** Enumerate classes in a maximum possible chunk size of 128.
+        /** Enumerate classes in chunks sized by the sizer, 128 by default.
+         * timeout is in milliseconds, and if nothing at all arrives within it,
+         * an empty batch is returned.  nullopt means the end.
          */
-        std::optional<std::vector<WbemClass>> next() {
+        std::optional<std::vector<WbemClass>> next(WmiStats *stats = nullptr, const long timeout = WBEM_INFINITE) {
+            ScopedTimer timer(stats ? &stats->nextTime : nullptr);
+            const ULONG size = sizer.size;
+            if (stats) {
+                ++stats->nextCalls;
+                stats->batchSizeMin = stats->batchSizeMin == 0 ? size : std::min<uint64_t>(stats->batchSizeMin, size);
+                stats->batchSizeMax = std::max<uint64_t>(stats->batchSizeMax, size);
+                stats->batchSizeLast = size;
+            }
+            buffer.resize(size);
             ULONG returned;
-            IWbemClassObject* apObj[128];
-            checkResult(enumClasses->Next(WBEM_INFINITE, 128, apObj, &returned),
-                    "Could not Enum classes.");
+            const auto start = std::chrono::steady_clock::now();
+            const HRESULT hres = enumClasses->Next(timeout, size, buffer.data(), &returned);
+            checkResult(hres, "Could not Enum classes.");
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            if (hres == WBEM_S_TIMEDOUT) {
+                sizer.recordTimeout(size, returned, elapsed);
+            } else {
+                sizer.record(size, returned, elapsed);
+            }
+            if (hres == WBEM_S_TIMEDOUT && returned == 0) {
+                return std::make_optional<std::vector<WbemClass>>();
+            }
             if (returned > 0) {
+                if (stats) {
+                    stats->objects += returned;
+                }
                 std::vector<WbemClass> output;
+                output.reserve(returned);
                 for ( ULONG n = 0; n < returned; n++ ) {
-                    output.emplace_back(apObj[n]);
+                    output.emplace_back(buffer[n]);
                 }
                 return std::make_optional(std::move(output));
             } else {
@@ -409,125 +803,3572 @@ struct EnumWbemClasses {
         }
 };
 
+/** Wraps an EnumWbemClasses, and keeps calling Next on a background thread up
+ * to depth batches ahead of the caller.  See Prefetcher.
+ *
+ * The background thread counts into its own stats, which are added to the
+ * caller's once it has stopped.
+ */
+struct PrefetchingEnum {
+        using Batch = std::optional<std::vector<WbemClass>>;
+
+        WmiStats * const stats;
+        WmiStats localStats{};
+        // Last, so that it is built once the stats are.
+        Prefetcher<std::vector<WbemClass>, ComLibrary> prefetcher;
+
+        PrefetchingEnum(EnumWbemClasses &source, const size_t depth, WmiStats * const stats) :
+                stats(stats),
+                prefetcher([this, &source](const long timeout) {
+                    return source.next(this->stats ? &localStats : nullptr, timeout);
+                }, depth) {
+        }
+
+        PrefetchingEnum(const PrefetchingEnum &) = delete;
+        PrefetchingEnum &operator=(const PrefetchingEnum &) = delete;
+
+        ~PrefetchingEnum() {
+            prefetcher.stop();
+            if (stats) {
+                stats->nextCalls += localStats.nextCalls;
+                stats->nextTime += localStats.nextTime;
+                stats->objects += localStats.objects;
+                if (localStats.batchSizeMin != 0) {
+                    stats->batchSizeMin = stats->batchSizeMin == 0 ? localStats.batchSizeMin : std::min(stats->batchSizeMin, localStats.batchSizeMin);
+                }
+                stats->batchSizeMax = std::max(stats->batchSizeMax, localStats.batchSizeMax);
+                stats->batchSizeLast = localStats.batchSizeLast;
+            }
+        }
+
+        /** The same as EnumWbemClasses::next, but taking what the background
+         * thread has already fetched.
+         */
+        Batch next(const long timeout = WBEM_INFINITE) {
+            return prefetcher.next(timeout);
+        }
+};
+
+/** A property's value as text.  This is either an owned string, or a BSTR
+ * adopted from the VARIANT it arrived in, which saves copying large strings.
+ */
+struct PropertyValue {
+    std::wstring string;
+    // Owned, and freed on destruction.  Null if string is used instead.
+    BSTR adopted = nullptr;
+
+    // For CIM_DATETIME properties, the parsed value in microseconds.
+    WmiDatetime datetime = WMI_DATETIME_NONE;
+    int64_t microseconds = 0;
+
+    PropertyValue() = default;
+
+    PropertyValue(const PropertyValue &other) : string(other.string), datetime(other.datetime), microseconds(other.microseconds) {
+        if (other.adopted) {
+            adopted = SysAllocStringLen(other.adopted, SysStringLen(other.adopted));
+            if (!adopted) {
+                throw std::bad_alloc();
+            }
+        }
+    }
+    PropertyValue(PropertyValue &&other) : string(std::move(other.string)), adopted(other.adopted), datetime(other.datetime), microseconds(other.microseconds) {
+        other.adopted = nullptr;
+    }
+    PropertyValue &operator=(PropertyValue other) {
+        std::swap(string, other.string);
+        std::swap(adopted, other.adopted);
+        datetime = other.datetime;
+        microseconds = other.microseconds;
+        return *this;
+    }
+
+    ~PropertyValue() {
+        if (adopted) {
+            SysFreeString(adopted);
+        }
+    }
+
+    const wchar_t *c_str() const {
+        return adopted ? adopted : string.c_str();
+    }
+
+    size_t size() const {
+        return adopted ? SysStringLen(adopted) : string.size();
+    }
+};
+
 /** Implementation of the public interface class for an instance.  This isn't
  * actually exposed publicly.
  */
 struct WmiInstance {
     std::wstring className;
-    std::vector<std::tuple<std::wstring, std::wstring>> properties;
+
+    // The __RELPATH, which identifies the instance within its class, or empty
+    // if the class has none.
+    std::wstring path;
+    std::vector<std::tuple<std::wstring, PropertyValue>> properties;
+
+    /** Approximate number of bytes held by this instance.
+     */
+    size_t size() const {
+        size_t output = sizeof(WmiInstance) + (className.size() + path.size()) * sizeof(wchar_t);
+        for (const auto &[key, value]: properties) {
+            output += sizeof(properties[0]) + (key.size() + value.size()) * sizeof(wchar_t);
+        }
+        return output;
+    }
 };
 
-/** Implementation of the public interface class for the entire enum, which is
- * just an optional error and a vector of instances.
+/** All the instances of a single class from a single enumeration.  This is
+ * immutable once built, so that it can be shared between enums by the result
+ * cache.
  */
-struct WmiEnum {
-    std::optional<std::string> error;
+struct ClassResult {
     std::vector<WmiInstance> instances;
+
+    // Approximate size of the instances, in bytes.
+    size_t bytes = 0;
+
+    // COM calls made to build this.
+    size_t calls = 0;
 };
 
-/** Get a new WmiEnum.  In the case of error, this enum will possibly have some
- * instances, but will definitely have its error field set.  Even in the case of
- * error, the WmiEnum instance should be freed.
+/** Throw the last Win32 error if ok is false.
  */
-WmiEnum *WmiEnum_new(const wchar_t * const classRegex, const wchar_t * const propertyRegex) {
-    WmiEnum *output = new WmiEnum();
-    try {
-        const std::wregex cRegex(classRegex), pRegex(propertyRegex);
-        // at some point, it might make sense to have services independently
-        // allocatable and freeable so that it can be allocated just once in the
-        // program's lifespan.
-        Services services;
-        services.setProxyBlanket();
-        auto enumClasses = EnumWbemClasses::classEnum(services);
-        for (auto items = enumClasses.next(); items; items = enumClasses.next()) {
-            // We already know that items has a value due to the for loop check.
-            for (auto &item: items.value()) {
-                // Need this as a separate piece to avoid cleaning it up too
-                // early.  If we access the bstr directly here, the following
-                // statement will be holding a dangling pointer because the
-                // Variant will have been cleaned up.
-                auto rawClassName = item.get(L"__CLASS").value();
+static void checkWin32(const BOOL ok, const std::string &message) {
+    if (!ok) {
+        checkResult(HRESULT_FROM_WIN32(GetLastError()), message);
+    }
+}
 
-                // Convenience BSTR
-                auto bClassName = rawClassName.variant->bstrVal;
-                const std::wstring className(bClassName, SysStringLen(bClassName));
-                if (std::regex_match(className, cRegex)) {
-
-                    // Iterate all instances
-                    auto enumInstances = EnumWbemClasses::instanceEnum(services, bClassName);
-                    for (auto instances = enumInstances.next(); instances; instances = enumInstances.next()) {
-                        // We already know the instance exists
-                        for (auto &instance: instances.value()) {
-
-                            // Iterate all properties and add them to the new
-                            // instance
-                            WmiInstance wmiInstance;
-                            wmiInstance.className.assign(className);
-                            instance.beginEnumeration();
-                            for (auto pair = instance.next(); pair; pair = instance.next()) {
-                                if (std::regex_match(std::get<0>(pair.value()), pRegex)) {
-                                    wmiInstance.properties.emplace_back(
-                                            std::get<0>(pair.value()),
-                                            std::get<1>(pair.value()).getString());
-                                }
-                            }
-                            output->instances.emplace_back(std::move(wmiInstance));
-                        }
-                    }
-                }
+/** Write a file from several pieces.  It is written to a temporary file and
+ * moved into place, so that a crash can never leave a partial file behind.
+ */
+static void writeFileAtomically(const wchar_t * const path, const std::vector<std::pair<const void *, size_t>> &pieces) {
+    const std::wstring temporary = std::wstring(path) + L".tmp";
+    HANDLE file = CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    checkWin32(file != INVALID_HANDLE_VALUE, "Could not create file.");
+    try {
+        for (const auto &[data, size]: pieces) {
+            const char *bytes = static_cast<const char *>(data);
+            size_t remaining = size;
+            while (remaining > 0) {
+                DWORD written;
+                const DWORD chunk = static_cast<DWORD>(std::min<size_t>(remaining, 1 << 30));
+                checkWin32(WriteFile(file, bytes, chunk, &written, nullptr), "Could not write file.");
+                bytes += written;
+                remaining -= written;
             }
         }
+        checkWin32(FlushFileBuffers(file), "Could not flush file.");
+    } catch (...) {
+        CloseHandle(file);
+        DeleteFileW(temporary.c_str());
+        throw;
     }
-    catch (const std::exception &e) {
-        output->error = std::make_optional<std::string>(e.what());
+    CloseHandle(file);
+    checkWin32(MoveFileExW(temporary.c_str(), path, MOVEFILE_REPLACE_EXISTING), "Could not replace file.");
+}
+
+/** Read a whole (small) file.
+ */
+static std::string readFile(const wchar_t * const path) {
+    HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    checkWin32(file != INVALID_HANDLE_VALUE, "Could not open file.");
+    std::string output;
+    try {
+        char buffer[65536];
+        DWORD read;
+        do {
+            checkWin32(ReadFile(file, buffer, sizeof(buffer), &read, nullptr), "Could not read file.");
+            output.append(buffer, read);
+        } while (read > 0);
+    } catch (...) {
+        CloseHandle(file);
+        throw;
     }
+    CloseHandle(file);
     return output;
 }
 
-const char *WmiEnum_error(const WmiEnum * const wmiEnum) {
-    if (wmiEnum->error) {
-        return wmiEnum->error.value().c_str();
-    } else {
-        return nullptr;
+/** Convert a wide string to UTF-8.
+ */
+static std::string toUtf8(const std::wstring &string) {
+    if (string.empty()) {
+        return std::string();
     }
+    const int size = WideCharToMultiByte(CP_UTF8, 0, string.data(), string.size(), nullptr, 0, nullptr, nullptr);
+    std::string output(size, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, string.data(), string.size(), output.data(), size, nullptr, nullptr);
+    return output;
 }
 
-void WmiEnum_free(WmiEnum * const wmiEnum) {
-    delete wmiEnum;
+/** Convert a UTF-8 string to a wide string.
+ */
+static std::wstring fromUtf8(const std::string &string) {
+    if (string.empty()) {
+        return std::wstring();
+    }
+    const int size = MultiByteToWideChar(CP_UTF8, 0, string.data(), string.size(), nullptr, 0);
+    std::wstring output(size, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, string.data(), string.size(), output.data(), size);
+    return output;
 }
 
-size_t WmiEnum_instanceCount(const WmiEnum * const wmiEnum) {
-    return wmiEnum->instances.size();
-}
+static_assert(sizeof(wchar_t) == sizeof(char16_t), "Snapshots are served as wchar_t directly, so it must be UTF-16.");
 
-const wchar_t *WmiEnum_instanceClassName(const WmiEnum * const wmiEnum, const size_t instance) {
-    if (instance < wmiEnum->instances.size()) {
-        return wmiEnum->instances[instance].className.c_str();
-    }
-    return nullptr;
-}
+/** Read-only mapping of a snapshot file, served through a SnapshotView of the
+ * whole mapping.
+ */
+struct MappedSnapshot {
+        HANDLE file;
+        HANDLE mapping = nullptr;
+        const char *data = nullptr;
+        std::optional<SnapshotView> view;
 
-size_t WmiEnum_instancePropertyCount(const WmiEnum * const wmiEnum, const size_t instance) {
-    if (instance < wmiEnum->instances.size()) {
-        return wmiEnum->instances[instance].properties.size();
-    }
-    return 0;
-}
-const wchar_t *WmiEnum_instancePropertyKey(const WmiEnum * const wmiEnum, const size_t instance, const size_t property) {
-    if (instance < wmiEnum->instances.size()) {
-        const auto &i = wmiEnum->instances[instance];
-        if (property < i.properties.size()) {
-            return std::get<0>(i.properties[property]).c_str();
+        MappedSnapshot(const wchar_t * const path) {
+            file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            checkWin32(file != INVALID_HANDLE_VALUE, "Could not open snapshot.");
+            try {
+                LARGE_INTEGER size;
+                checkWin32(GetFileSizeEx(file, &size), "Could not get snapshot size.");
+                if (static_cast<uint64_t>(size.QuadPart) < sizeof(SnapshotHeader)) {
+                    throw std::runtime_error("Snapshot is truncated.");
+                }
+                mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                checkWin32(mapping != nullptr, "Could not map snapshot.");
+                data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                checkWin32(data != nullptr, "Could not map snapshot view.");
+                view.emplace(data, size.QuadPart);
+            } catch (...) {
+                close();
+                throw;
+            }
         }
-    }
-    return nullptr;
-}
-const wchar_t *WmiEnum_instancePropertyValue(const WmiEnum * const wmiEnum, const size_t instance, const size_t property) {
-    if (instance < wmiEnum->instances.size()) {
-        const auto &i = wmiEnum->instances[instance];
-        if (property < i.properties.size()) {
-            return std::get<1>(i.properties[property]).c_str();
+
+        MappedSnapshot(const MappedSnapshot &) = delete;
+        MappedSnapshot &operator=(const MappedSnapshot &) = delete;
+
+        ~MappedSnapshot() {
+            close();
         }
-    }
-    return nullptr;
+
+        void close() {
+            if (data) {
+                UnmapViewOfFile(data);
+                data = nullptr;
+            }
+            if (mapping) {
+                CloseHandle(mapping);
+                mapping = nullptr;
+            }
+            if (file != INVALID_HANDLE_VALUE) {
+                CloseHandle(file);
+                file = INVALID_HANDLE_VALUE;
+            }
+        }
+
+        size_t classCount() const {
+            return view->classCount();
+        }
+
+        size_t instanceCount() const {
+            return view->instanceCount();
+        }
+
+        const SnapshotClass *snapshotClass(const size_t index) const {
+            return view->snapshotClass(index);
+        }
+
+        const SnapshotInstance *instance(const size_t index) const {
+            return view->instance(index);
+        }
+
+        const SnapshotProperty *property(const SnapshotInstance &instance, const size_t index) const {
+            return view->property(instance, index);
+        }
+
+        const wchar_t *string(const uint64_t offset) const {
+            return reinterpret_cast<const wchar_t *>(view->string(offset));
+        }
+};
+
+/** Stats entry with storage for its class name.
+ */
+struct ClassStats {
+    std::wstring className;
+    WmiStats stats;
+
+    ClassStats(std::wstring name) : className(std::move(name)), stats() {
+        stats.className = className.c_str();
+    }
+
+    ClassStats(const ClassStats &) = delete;
+    ClassStats &operator=(const ClassStats &) = delete;
+};
+
+/** Snapshot accessors can return null for corrupt offsets, which the indexes
+ * and diffing treat as empty strings.
+ */
+static const wchar_t *orEmpty(const wchar_t * const string) {
+    return string ? string : L"";
+}
+
+/** Compare two names as WMI does, ignoring case.
+ */
+static bool namesEqual(const wchar_t *a, const wchar_t *b) {
+    for (; *a && *b; ++a, ++b) {
+        if (towupper(*a) != towupper(*b)) {
+            return false;
+        }
+    }
+    return *a == *b;
+}
+
+/** The property positions of one class's instances, by upper-cased name.
+ * Instances of a class normally all have the same properties in the same
+ * order, in which case a position found once is good for all of them.
+ */
+struct KeyIndex {
+    std::unordered_map<std::wstring, size_t> byName;
+
+    // Whether every instance of the class has the same keys in the same order.
+    bool uniform = true;
+};
+
+/** Where each class's instances are in an enum.  Enumerations add each
+ * class's instances together, and snapshots keep a table of those ranges, so
+ * that indexing them doesn't read every instance.  A class that turns up again
+ * after another still gets a range of its own, so that its instances can be
+ * looked up, but byName only finds the first.
+ */
+struct ClassIndex {
+    struct Range {
+        const wchar_t *className;
+        size_t begin;
+        size_t end;
+
+        // Built by the first property lookup, only ever once, under keysOnce,
+        // as readers may share an enum between threads.
+        mutable std::once_flag keysOnce;
+        mutable std::optional<KeyIndex> keys;
+
+        Range(const wchar_t * const className, const size_t begin, const size_t end) : className(className), begin(begin), end(end) {
+        }
+    };
+
+    // A deque, as a Range can't be moved.
+    std::deque<Range> ranges;
+
+    // By upper-cased class name, as WMI class names are case insensitive.
+    std::unordered_map<std::wstring, size_t> byName;
+
+    static std::wstring key(const wchar_t * const className) {
+        std::wstring output(className);
+        std::transform(output.begin(), output.end(), output.begin(), towupper);
+        return output;
+    }
+
+    /** Add the range of the next class's instances, which must come after
+     * every range added so far.
+     */
+    void add(const wchar_t * const className, const size_t begin, const size_t end) {
+        ranges.emplace_back(className, begin, end);
+        byName.emplace(key(className), ranges.size() - 1);
+    }
+};
+
+/** Implementation of the public interface class for the entire enum, which is
+ * just an optional error and a vector of instances, and the stats if they were
+ * requested.
+ */
+struct WmiEnum {
+    std::optional<std::string> error;
+
+    // Each of these shares ownership of the ClassResult it lives in.
+    std::vector<std::shared_ptr<const WmiInstance>> instances;
+
+    // If set, this enum was loaded from a snapshot, and all the accessors are
+    // served from it instead of from instances.
+    std::unique_ptr<const MappedSnapshot> snapshot;
+
+    // A deque, so that the className pointers stay valid as entries are added.
+    std::deque<ClassStats> stats;
+
+    // Lazily built by WmiEnum_statsJson.
+    mutable std::optional<std::string> statsJson;
+
+    // Built by the first class accessor.  Readers may share an enum between
+    // threads, so it is only ever built once, under classIndexOnce.
+    mutable std::once_flag classIndexOnce;
+    mutable std::optional<ClassIndex> classIndex;
+
+    /** Add a stats entry and return it, or return null if stats are disabled.
+     */
+    WmiStats *addStats(const bool enabled, std::wstring className) {
+        if (!enabled) {
+            return nullptr;
+        }
+        return &stats.emplace_back(std::move(className)).stats;
+    }
+
+    /** Add all of the instances from a class result, without copying them.
+     */
+    void add(std::shared_ptr<const ClassResult> result) {
+        instances.reserve(instances.size() + result->instances.size());
+        for (const auto &instance: result->instances) {
+            instances.emplace_back(result, &instance);
+        }
+    }
+};
+
+/** Implementation of the public cancel token.
+ */
+struct WmiCancel {
+    std::atomic<bool> signalled{false};
+};
+
+/** How property values are turned into stored text.
+ */
+struct Conversion {
+    // Keep scalar string values as the BSTRs they arrived in.
+    bool adoptStrings = false;
+    // Format numbers and booleans without VariantChangeType.
+    bool invariantFormat = false;
+    // Name each instance by its own __CLASS rather than the class asked for,
+    // which differ for the subclasses a deep enumeration returns.
+    bool ownClassName = false;
+};
+
+/** Implementation of the public options class.
+ */
+struct WmiOptions {
+    bool stats = false;
+    unsigned workers = 1;
+    const WmiCancel *cancel = nullptr;
+    unsigned converters = 0;
+    unsigned prefetch = 0;
+    BatchSizer batches;
+    Conversion conversion;
+    WmiProgressCallback progress = nullptr;
+    void *progressUserData = nullptr;
+    std::chrono::milliseconds progressInterval{250};
+};
+
+/** Counts progress through an enumeration, and reports it through the
+ * options' callback at most once per interval.  Workers may update it
+ * concurrently, but the callback is never called concurrently.
+ */
+struct ProgressReporter {
+    using Clock = std::chrono::steady_clock;
+
+    WmiProgressCallback callback;
+    void *userData;
+    Clock::duration interval;
+
+    std::atomic<uint64_t> classesScanned{0};
+    std::atomic<uint64_t> classesMatched{0};
+    std::atomic<uint64_t> classesCompleted{0};
+    std::atomic<uint64_t> instances{0};
+    std::atomic<uint64_t> properties{0};
+    std::atomic<uint64_t> bytes{0};
+
+    // Checked without the lock, so that most batches cost only a clock read.
+    std::atomic<Clock::rep> nextReport{0};
+    std::mutex mutex;
+    std::wstring currentClass;
+
+    ProgressReporter(const WmiOptions &options) : callback(options.progress), userData(options.progressUserData), interval(options.progressInterval) {
+    }
+
+    void setClass(const std::wstring &className) {
+        std::lock_guard<std::mutex> lock(mutex);
+        currentClass = className;
+    }
+
+    /** Call the callback if the interval has passed, or always if forced.
+     */
+    void report(const bool force = false) {
+        const auto now = Clock::now().time_since_epoch().count();
+        if (!force && now < nextReport.load(std::memory_order_relaxed)) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+        if (force) {
+            lock.lock();
+        } else if (!lock.try_lock()) {
+            // Somebody else is reporting right now.
+            return;
+        }
+        nextReport.store(now + interval.count(), std::memory_order_relaxed);
+        WmiProgress progress;
+        progress.classesScanned = classesScanned;
+        progress.classesMatched = classesMatched;
+        progress.classesCompleted = classesCompleted;
+        progress.instances = instances;
+        progress.properties = properties;
+        progress.bytes = bytes;
+        progress.currentClass = currentClass.c_str();
+        callback(&progress, userData);
+    }
+};
+
+/** Session-level record of classes that were found to have no instances, so
+ * that repeated polls can skip their CreateInstanceEnum round-trips until the
+ * entry expires and the class is revalidated by enumerating it again.
+ */
+struct EmptyClassCache {
+    using Clock = std::chrono::steady_clock;
+
+    // Zero disables the cache.
+    std::chrono::milliseconds ttl{0};
+    std::unordered_map<std::wstring, Clock::time_point> expiries;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    mutable std::mutex mutex;
+
+    /** Check whether the class is known to be empty.  Expired entries are
+     * dropped, so the class gets enumerated and revalidated.
+     */
+    bool contains(const std::wstring &className) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ttl.count() == 0) {
+            return false;
+        }
+        const auto it = expiries.find(className);
+        if (it != expiries.end()) {
+            if (Clock::now() < it->second) {
+                ++hits;
+                return true;
+            }
+            expiries.erase(it);
+        }
+        ++misses;
+        return false;
+    }
+
+    /** Record the result of an actual enumeration of the class.
+     */
+    void update(const std::wstring &className, const bool empty) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ttl.count() == 0) {
+            return;
+        }
+        if (empty) {
+            expiries[className] = Clock::now() + ttl;
+        } else {
+            expiries.erase(className);
+        }
+    }
+};
+
+/** Session-level cache of whole class results, for classes which don't change
+ * between polls.  Entries are keyed on the class name, the property regex, and
+ * the conversion switches which change what the instances hold, and are shared with the enums that they are served to rather than copied.
+ * TTLs come from a list of class regex rules, where the latest matching rule
+ * wins.
+ */
+struct ResultCache {
+    using Clock = std::chrono::steady_clock;
+
+    struct Rule {
+        std::wstring pattern;
+        std::wregex regex;
+        std::chrono::milliseconds ttl;
+    };
+
+    struct Entry {
+        std::shared_ptr<const ClassResult> result;
+        Clock::time_point expiry;
+    };
+
+    std::vector<Rule> rules;
+
+    // The TTL for each class seen so far, so rules are only matched once per
+    // class.
+    std::unordered_map<std::wstring, std::chrono::milliseconds> ttls;
+    std::unordered_map<std::wstring, Entry> entries;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t bytesSaved = 0;
+    uint64_t callsSaved = 0;
+    mutable std::mutex mutex;
+
+    static std::wstring key(const std::wstring &className, const std::wstring &filterKey, const Conversion &conversion) {
+        std::wstring output(className);
+        output.push_back(L'\0');
+        // Adopted strings leave text.string empty, and the other way around,
+        // so neither kind of result may be served for the other.  Nor may
+        // numbers formatted for one locale be served as invariant ones.
+        output.push_back(conversion.adoptStrings ? L'a' : L'-');
+        output.push_back(conversion.invariantFormat ? L'i' : L'-');
+        output.push_back(conversion.ownClassName ? L'c' : L'-');
+        output.append(filterKey);
+        return output;
+    }
+
+    /** Get the TTL of a class.  Must be called with the mutex held.
+     */
+    std::chrono::milliseconds ttl(const std::wstring &className) {
+        const auto it = ttls.find(className);
+        if (it != ttls.end()) {
+            return it->second;
+        }
+        std::chrono::milliseconds output{0};
+        for (auto rule = rules.rbegin(); rule != rules.rend(); ++rule) {
+            if (std::regex_match(className, rule->regex)) {
+                output = rule->ttl;
+                break;
+            }
+        }
+        ttls.emplace(className, output);
+        return output;
+    }
+
+    /** Find a fresh result, or return null.
+     */
+    std::shared_ptr<const ClassResult> find(const std::wstring &className, const std::wstring &filterKey, const Conversion &conversion) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (rules.empty() || ttl(className).count() == 0) {
+            return nullptr;
+        }
+        const auto it = entries.find(key(className, filterKey, conversion));
+        if (it != entries.end()) {
+            if (Clock::now() < it->second.expiry) {
+                ++hits;
+                bytesSaved += it->second.result->bytes;
+                callsSaved += it->second.result->calls;
+                return it->second.result;
+            }
+            entries.erase(it);
+        }
+        ++misses;
+        return nullptr;
+    }
+
+    void store(const std::wstring &className, const std::wstring &filterKey, const Conversion &conversion, std::shared_ptr<const ClassResult> result) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (rules.empty()) {
+            return;
+        }
+        const auto classTtl = ttl(className);
+        if (classTtl.count() > 0) {
+            entries[key(className, filterKey, conversion)] = Entry{std::move(result), Clock::now() + classTtl};
+        }
+    }
+
+    /** Add or replace the rule for a pattern.  Invalidates everything, because
+     * the TTLs may have changed.
+     */
+    void setRule(const std::wstring &pattern, const std::chrono::milliseconds classTtl) {
+        std::wregex regex(pattern);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = rules.begin(); it != rules.end(); ++it) {
+            if (it->pattern == pattern) {
+                rules.erase(it);
+                break;
+            }
+        }
+        rules.push_back(Rule{pattern, std::move(regex), classTtl});
+        ttls.clear();
+        entries.clear();
+    }
+};
+
+/** Session-level model of how expensive each class is to enumerate, learned
+ * from exponential moving averages of its latency and result size.  This is
+ * used to order work, and to flag enumerations that took far longer than
+ * usual.
+ */
+struct CostModel {
+    struct Cost {
+        uint64_t samples = 0;
+        // Nanoseconds
+        double latency = 0.0;
+        double variance = 0.0;
+        double instances = 0.0;
+        double bytes = 0.0;
+    };
+
+    // Weight of each new sample.
+    static constexpr double alpha = 0.2;
+
+    // A sample is an outlier if it is this many standard deviations above
+    // the mean, once there are enough samples for the deviation to mean
+    // anything.
+    static constexpr double outlierDeviations = 3.0;
+    static constexpr uint64_t outlierSamples = 5;
+
+    std::unordered_map<std::wstring, Cost> costs;
+    mutable std::mutex mutex;
+
+    /** Record an enumeration of a class.  Returns whether it was an outlier
+     * compared to what was known before it.
+     */
+    bool record(const std::wstring &className, const uint64_t nanoseconds, const size_t instances, const size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &cost = costs[className];
+        const double latency = nanoseconds;
+        if (cost.samples == 0) {
+            cost.latency = latency;
+            cost.instances = instances;
+            cost.bytes = bytes;
+            cost.samples = 1;
+            return false;
+        }
+        const double difference = latency - cost.latency;
+        const bool outlier = cost.samples >= outlierSamples && difference > outlierDeviations * std::sqrt(cost.variance);
+        // Exponentially weighted variance, updated with the old mean.
+        cost.variance = (1.0 - alpha) * (cost.variance + alpha * difference * difference);
+        cost.latency += alpha * difference;
+        cost.instances += alpha * (instances - cost.instances);
+        cost.bytes += alpha * (bytes - cost.bytes);
+        ++cost.samples;
+        return outlier;
+    }
+
+    /** Predicted latency of a class in nanoseconds, or 0 if it has never been
+     * seen.
+     */
+    double predict(const std::wstring &className) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto it = costs.find(className);
+        return it == costs.end() ? 0.0 : it->second.latency;
+    }
+
+    /** Estimated 95th percentile latency of a class in nanoseconds, assuming
+     * roughly normal latencies, once there are enough samples to say.
+     */
+    std::optional<double> percentile95(const std::wstring &className) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto it = costs.find(className);
+        if (it == costs.end() || it->second.samples < outlierSamples) {
+            return std::nullopt;
+        }
+        return it->second.latency + 1.645 * std::sqrt(it->second.variance);
+    }
+
+    /** Get the order to enumerate classes in.  A single worker goes cheapest
+     * first, so that partial results arrive as early as possible.  Several
+     * workers go most expensive first, which is the longest processing time
+     * rule, so that one slow class doesn't start last and hold up the end.
+     * Classes that have never been seen count as free, so they are learned
+     * quickly.
+     */
+    std::vector<size_t> order(const std::vector<std::wstring> &classNames, const bool parallel) const {
+        std::vector<double> predictions;
+        predictions.reserve(classNames.size());
+        for (const auto &className: classNames) {
+            predictions.push_back(predict(className));
+        }
+        std::vector<size_t> output(classNames.size());
+        for (size_t i = 0; i < output.size(); ++i) {
+            output[i] = i;
+        }
+        std::stable_sort(output.begin(), output.end(), [&predictions, parallel](const size_t a, const size_t b) {
+            return parallel ? predictions[a] > predictions[b] : predictions[a] < predictions[b];
+        });
+        return output;
+    }
+
+    std::string save() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ostringstream oss;
+        oss.precision(17);
+        oss << "wmienumall-costs 1\n";
+        for (const auto &[className, cost]: costs) {
+            oss
+                << toUtf8(className)
+                << '\t' << cost.samples
+                << '\t' << cost.latency
+                << '\t' << cost.variance
+                << '\t' << cost.instances
+                << '\t' << cost.bytes
+                << '\n';
+        }
+        return oss.str();
+    }
+
+    void load(const std::string &data) {
+        std::istringstream iss(data);
+        std::string line;
+        if (!std::getline(iss, line) || line != "wmienumall-costs 1") {
+            throw std::runtime_error("Not a cost model file.");
+        }
+        std::unordered_map<std::wstring, Cost> loaded;
+        while (std::getline(iss, line)) {
+            const auto tab = line.find('\t');
+            if (tab == std::string::npos) {
+                throw std::runtime_error("Cost model file is corrupt.");
+            }
+            std::istringstream fields(line.substr(tab + 1));
+            Cost cost;
+            if (!(fields >> cost.samples >> cost.latency >> cost.variance >> cost.instances >> cost.bytes)) {
+                throw std::runtime_error("Cost model file is corrupt.");
+            }
+            loaded[fromUtf8(line.substr(0, tab))] = cost;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        costs = std::move(loaded);
+    }
+};
+
+/** Implementation of the public diff class.
+ */
+struct WmiDiff {
+    std::vector<DiffChange> changes;
+};
+
+/** An enum as one side of a diff.  Snapshot strings at corrupt offsets are
+ * diffed as empty.
+ */
+struct EnumDiffSource : DiffSource {
+    const WmiEnum * const wmiEnum;
+
+    EnumDiffSource(const WmiEnum * const wmiEnum) : wmiEnum(wmiEnum) {
+    }
+
+    size_t instanceCount() const override {
+        return WmiEnum_instanceCount(wmiEnum);
+    }
+
+    const wchar_t *className(const size_t instance) const override {
+        return orEmpty(WmiEnum_instanceClassName(wmiEnum, instance));
+    }
+
+    const wchar_t *path(const size_t instance) const override {
+        return orEmpty(WmiEnum_instancePath(wmiEnum, instance));
+    }
+
+    size_t propertyCount(const size_t instance) const override {
+        return WmiEnum_instancePropertyCount(wmiEnum, instance);
+    }
+
+    const wchar_t *key(const size_t instance, const size_t property) const override {
+        return orEmpty(WmiEnum_instancePropertyKey(wmiEnum, instance, property));
+    }
+
+    const wchar_t *value(const size_t instance, const size_t property) const override {
+        return orEmpty(WmiEnum_instancePropertyValue(wmiEnum, instance, property));
+    }
+};
+
+/** Diff two enums, each with its index.  previous may be null, in which case
+ * everything in current is added.
+ */
+static WmiDiff *diff(const WmiEnum * const previous, const DiffIndex &previousIndex, const WmiEnum * const current, const DiffIndex &currentIndex) {
+    auto output = std::make_unique<WmiDiff>();
+    if (previous) {
+        const EnumDiffSource previousSource(previous);
+        output->changes = diffInstances(&previousSource, previousIndex, EnumDiffSource(current), currentIndex);
+    } else {
+        output->changes = diffInstances(nullptr, previousIndex, EnumDiffSource(current), currentIndex);
+    }
+    return output.release();
+}
+
+/** Session state for diff mode, holding the previous enum of each pair of
+ * regexes and its index.  The previous enum shares its instances with the enum
+ * that was returned, so holding on to it costs no copies.
+ */
+struct DiffTracker {
+    struct Previous {
+        std::unique_ptr<WmiEnum> wmiEnum;
+        DiffIndex index;
+    };
+
+    std::unordered_map<std::wstring, Previous> previous;
+    std::mutex mutex;
+};
+
+/** Session-level hedging of critical classes.  A matching class which hasn't
+ * finished within its learned 95th percentile latency is enumerated a second
+ * time on another connection, and whichever finishes first is used.
+ *
+ * A single timer thread waits out the delays of every pending hedge, and only
+ * those that actually fire get a thread of their own, which is joined when it
+ * is reaped or when the session is destroyed.  Hedges never touch the session
+ * itself.
+ */
+struct Hedging {
+    using Clock = std::chrono::steady_clock;
+
+    /** The state shared between a primary enumeration and its hedge.
+     */
+    struct Race {
+        std::mutex mutex;
+        // Set when the primary has finished either way, which also cancels
+        // the hedge.
+        std::atomic<bool> primaryDone{false};
+        // Set when the hedge has a result, which cancels the primary.
+        std::atomic<bool> hedgeDone{false};
+        bool hedged = false;
+        std::shared_ptr<ClassResult> hedgeResult;
+
+        // The hedge's own copy of the filter, as it may outlive the caller.
+        std::vector<std::wregex> regexes;
+        PropertyFilter filter;
+    };
+
+    struct Thread {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> finished;
+    };
+
+    /** A hedge waiting for its primary to run past the delay.
+     */
+    struct Pending {
+        Clock::time_point deadline;
+        std::shared_ptr<Race> race;
+        std::function<void()> hedge;
+    };
+
+    std::optional<std::wregex> classRegex;
+    uint64_t eligible = 0;
+    uint64_t hedges = 0;
+    uint64_t wins = 0;
+    std::vector<Thread> threads;
+    std::vector<Pending> pending;
+    // Started with the first pending hedge.
+    std::thread timer;
+    std::condition_variable wake;
+    bool stopping = false;
+    mutable std::mutex mutex;
+
+    Hedging() = default;
+    Hedging(const Hedging &) = delete;
+    Hedging &operator=(const Hedging &) = delete;
+
+    ~Hedging() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (timer.joinable()) {
+            timer.join();
+        }
+        for (auto &thread: threads) {
+            thread.thread.join();
+        }
+    }
+
+    bool matches(const std::wstring &className) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return classRegex && std::regex_match(className, *classRegex);
+    }
+
+    /** Run hedge at deadline, unless race's primary is done by then.
+     */
+    void schedule(const Clock::time_point deadline, std::shared_ptr<Race> race, std::function<void()> hedge) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(Pending{deadline, std::move(race), std::move(hedge)});
+            if (!timer.joinable()) {
+                timer = std::thread([this]() {
+                    runTimer();
+                });
+            }
+        }
+        wake.notify_all();
+    }
+
+    /** Wake the timer so that it drops hedges whose primaries are done.
+     */
+    void primaryDone() {
+        wake.notify_all();
+    }
+
+    void runTimer() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            const auto now = Clock::now();
+            std::vector<std::function<void()>> firing;
+            std::optional<Clock::time_point> earliest;
+            for (auto it = pending.begin(); it != pending.end();) {
+                if (it->race->primaryDone) {
+                    it = pending.erase(it);
+                } else if (it->deadline <= now) {
+                    firing.push_back(std::move(it->hedge));
+                    it = pending.erase(it);
+                } else {
+                    earliest = earliest ? std::min(*earliest, it->deadline) : it->deadline;
+                    ++it;
+                }
+            }
+            if (!firing.empty()) {
+                lock.unlock();
+                for (auto &hedge: firing) {
+                    launch(std::move(hedge));
+                }
+                lock.lock();
+                continue;
+            }
+            if (earliest) {
+                wake.wait_until(lock, *earliest);
+            } else {
+                wake.wait(lock);
+            }
+        }
+    }
+
+    /** Start a thread, reaping any that have finished.
+     */
+    template <typename F>
+    void launch(F function) {
+        auto finished = std::make_shared<std::atomic<bool>>(false);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = threads.begin(); it != threads.end();) {
+            if (*it->finished) {
+                it->thread.join();
+                it = threads.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        threads.push_back(Thread{std::thread([function = std::move(function), finished]() {
+            function();
+            *finished = true;
+        }), finished});
+    }
+};
+
+/** Implementation of the public session class, which holds state that is
+ * carried between polls.
+ */
+struct WmiSession {
+    EmptyClassCache emptyClasses;
+    ResultCache results;
+    DiffTracker diffs;
+    CostModel costs;
+    CircuitBreakers breakers;
+    Hedging hedging;
+};
+
+/** Encode a wide string as UTF-8 into a JSON string literal, with quotes.
+ */
+static void jsonString(std::ostringstream &oss, const std::wstring &string) {
+    oss << '"';
+    for (const char c: toUtf8(string)) {
+        switch (c) {
+            case '"':
+                oss << "\\\"";
+                break;
+            case '\\':
+                oss << "\\\\";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    oss << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 0xf];
+                } else {
+                    oss << c;
+                }
+        }
+    }
+    oss << '"';
+}
+
+/** Convert a single instance, with all of its properties matching the filter.
+ */
+static WmiInstance convertInstance(WbemClass &instance, const std::wstring &className, const PropertyFilter &filter, WmiStats * const stats, const Conversion &conversion = {}) {
+    // Iterate all properties and add them to the new
+    // instance
+    WmiInstance wmiInstance;
+    if (conversion.ownClassName) {
+        auto rawClassName = instance.get(L"__CLASS");
+        if (rawClassName && rawClassName->variant.vt == VT_BSTR) {
+            wmiInstance.className.assign(rawClassName->variant.bstrVal, SysStringLen(rawClassName->variant.bstrVal));
+        } else {
+            wmiInstance.className.assign(className);
+        }
+    } else {
+        wmiInstance.className.assign(className);
+    }
+    if (auto relPath = instance.get(L"__RELPATH")) {
+        if (relPath->variant.vt == VT_BSTR) {
+            wmiInstance.path.assign(relPath->variant.bstrVal, SysStringLen(relPath->variant.bstrVal));
+        }
+    }
+    instance.beginEnumeration();
+    convertProperties<Variant, CIMTYPE>(wmiInstance.properties, [&instance, stats](std::wstring &name, Variant &value, CIMTYPE &type) {
+        return instance.next(name, value, stats, &type);
+    }, [&filter, stats](const std::wstring &name) {
+        ScopedTimer timer(stats ? &stats->regexTime : nullptr);
+        if (stats) {
+            ++stats->regexMatches;
+        }
+        return filter.matches(name);
+    }, [stats, &conversion](auto &property, const std::wstring &name, Variant &value, const CIMTYPE type) {
+        auto &[key, text] = property;
+        key.assign(name);
+        if (type == CIM_DATETIME && value.variant.vt == VT_BSTR && value.variant.bstrVal) {
+            text.datetime = static_cast<WmiDatetime>(parseDatetime(value.variant.bstrVal, SysStringLen(value.variant.bstrVal), text.microseconds));
+        }
+        if (conversion.adoptStrings && (text.adopted = value.adopt())) {
+            if (stats) {
+                ++stats->conversions;
+            }
+        } else {
+            value.appendString(text.string, stats, conversion.invariantFormat);
+        }
+    });
+    return wmiInstance;
+}
+
+/** One batch of a class, converted on a converter thread, with the stats
+ * counted converting it.
+ */
+struct ConvertedBatch {
+    std::vector<WmiInstance> instances;
+    WmiStats stats{};
+    size_t bytes = 0;
+};
+
+using WbemConverterPool = ConverterPool<WbemClass, ConvertedBatch, ComLibrary>;
+
+/** The conversion of one class on the enumeration's converter threads.  Each
+ * batch is counted into its own stats, which are only merged into the class's
+ * stats at the end, so that no counter is shared with the fetching thread.
+ */
+struct ClassPipeline {
+    WmiStats * const stats;
+    ProgressReporter * const progress;
+
+    std::atomic<uint64_t> countedInstances{0};
+    std::atomic<uint64_t> countedProperties{0};
+    std::atomic<uint64_t> countedBytes{0};
+
+    // Last, so that it is destroyed first, which waits for the converters to
+    // be done with everything above.
+    ConvertPipeline<WbemClass, ConvertedBatch, ComLibrary> pipeline;
+
+    ClassPipeline(WbemConverterPool &pool, const std::wstring &className, const PropertyFilter &filter, WmiStats * const stats, const Conversion &conversion, ProgressReporter * const progress) :
+            stats(stats),
+            progress(progress),
+            pipeline(pool, [this, &className, &filter, conversion](std::vector<WbemClass> &objects) {
+                return convert(objects, className, filter, conversion);
+            }) {
+    }
+
+    ClassPipeline(const ClassPipeline &) = delete;
+    ClassPipeline &operator=(const ClassPipeline &) = delete;
+
+    /** Hand over a batch, waiting while the pool's queue is full.  Rethrows
+     * the first converter error, so that fetching stops with it.
+     */
+    void push(std::vector<WbemClass> objects) {
+        pipeline.push(std::move(objects));
+    }
+
+    /** Wait for everything to be converted, and append it to instances in
+     * fetch order.  Returns the approximate size in bytes.
+     */
+    size_t finish(std::vector<WmiInstance> &instances) {
+        size_t bytes = 0;
+        for (auto &batch: pipeline.finish()) {
+            if (stats) {
+                stats->properties += batch.stats.properties;
+                stats->propertyTime += batch.stats.propertyTime;
+                stats->conversions += batch.stats.conversions;
+                stats->conversionTime += batch.stats.conversionTime;
+                stats->regexMatches += batch.stats.regexMatches;
+                stats->regexTime += batch.stats.regexTime;
+            }
+            bytes += batch.bytes;
+            for (auto &instance: batch.instances) {
+                instances.emplace_back(std::move(instance));
+            }
+        }
+        return bytes;
+    }
+
+    /** Take back what this counted towards progress, for an abandoned class.
+     */
+    void uncount() {
+        if (progress) {
+            progress->instances -= countedInstances;
+            progress->properties -= countedProperties;
+            progress->bytes -= countedBytes;
+        }
+    }
+
+private:
+    /** Convert one batch, on a converter thread.
+     */
+    ConvertedBatch convert(std::vector<WbemClass> &objects, const std::wstring &className, const PropertyFilter &filter, const Conversion &conversion) {
+        ConvertedBatch output;
+        output.instances.reserve(objects.size());
+        size_t properties = 0;
+        for (auto &object: objects) {
+            WmiInstance &instance = output.instances.emplace_back(convertInstance(object, className, filter, stats ? &output.stats : nullptr, conversion));
+            properties += instance.properties.size();
+            output.bytes += instance.size();
+        }
+        if (progress) {
+            progress->instances += output.instances.size();
+            progress->properties += properties;
+            progress->bytes += output.bytes;
+            countedInstances += output.instances.size();
+            countedProperties += properties;
+            countedBytes += output.bytes;
+            progress->report();
+        }
+        return output;
+    }
+};
+
+/** How a single class enumeration is run, beyond what it fetches.
+ */
+struct ClassControl {
+    // If nonzero, a TimeoutError is thrown if the whole class takes longer.
+    std::chrono::milliseconds timeout{0};
+    // If set, checked at least every cancelInterval, and a CancelledError is
+    // thrown once it returns true.
+    std::function<bool()> cancelled;
+    // May be null.
+    ProgressReporter *progress = nullptr;
+    // The enumeration's converter threads, which convert instances while the
+    // calling thread keeps fetching.  Null converts on the calling thread.
+    WbemConverterPool *converters = nullptr;
+    // Batches fetched ahead on a background thread.  Zero fetches on demand.
+    unsigned prefetch = 0;
+    // The initial state of the instance enumerator's batch sizing.
+    BatchSizer batches;
+    Conversion conversion;
+};
+
+/** Enumerate all instances of a single class.
+ */
+static std::shared_ptr<ClassResult> enumerateClass(Connection &services, const BSTR bClassName, const std::wstring &className, const PropertyFilter &filter, WmiStats * const stats, const ClassControl &control = {}) {
+    ScopedTimer classTimer(stats ? &stats->totalTime : nullptr);
+    auto result = std::make_shared<ClassResult>();
+    auto &instances = result->instances;
+    ProgressReporter * const progress = control.progress;
+    const NextWaits waits(control.timeout, control.cancelled,
+            control.timeout.count() != 0 ? "Timed out enumerating " + toUtf8(className) + "." : std::string());
+
+    std::optional<ClassPipeline> pipeline;
+    if (control.converters) {
+        pipeline.emplace(*control.converters, className, filter, stats, control.conversion, progress);
+    }
+
+    // Progress counted for this class, taken back if it is abandoned, so that
+    // the counts always match what was actually stored.
+    uint64_t countedInstances = 0;
+    uint64_t countedProperties = 0;
+    uint64_t countedBytes = 0;
+    try {
+        // Iterate all instances
+        auto enumInstances = EnumWbemClasses::instanceEnum(services, bClassName, stats);
+        enumInstances.sizer = control.batches;
+        std::optional<PrefetchingEnum> prefetcher;
+        if (control.prefetch > 0) {
+            prefetcher.emplace(enumInstances, control.prefetch, stats);
+        }
+        const auto next = [&](const long wait) {
+            return prefetcher ? prefetcher->next(wait) : enumInstances.next(stats, wait);
+        };
+        result->calls = 1;
+        drain(waits, next, [&](std::vector<WbemClass> &batch) {
+            ++result->calls;
+            if (pipeline) {
+                if (!batch.empty()) {
+                    pipeline->push(std::move(batch));
+                }
+                return;
+            }
+            size_t properties = 0;
+            size_t bytes = 0;
+            for (auto &instance: batch) {
+                WmiInstance wmiInstance = convertInstance(instance, className, filter, stats, control.conversion);
+                bytes += wmiInstance.size();
+                properties += wmiInstance.properties.size();
+                instances.emplace_back(std::move(wmiInstance));
+            }
+            result->bytes += bytes;
+            if (progress) {
+                progress->instances += batch.size();
+                progress->properties += properties;
+                progress->bytes += bytes;
+                countedInstances += batch.size();
+                countedProperties += properties;
+                countedBytes += bytes;
+                progress->report();
+            }
+        });
+        if (pipeline) {
+            result->bytes += pipeline->finish(instances);
+        }
+    } catch (...) {
+        if (progress) {
+            progress->instances -= countedInstances;
+            progress->properties -= countedProperties;
+            progress->bytes -= countedBytes;
+        }
+        if (pipeline) {
+            pipeline->uncount();
+        }
+        throw;
+    }
+    // The final Next call which returned nothing
+    ++result->calls;
+    return result;
+}
+
+/** Enumerate a class, hedging it with a second enumeration on another
+ * connection if it takes longer than delay.  The primary enumeration stays on
+ * the calling thread.
+ */
+static std::shared_ptr<ClassResult> hedgedEnumerateClass(WmiSession &session, Connection &services, const BSTR bClassName, const std::wstring &className, const PropertyFilter &filter, WmiStats * const stats, const ClassControl &control, const std::chrono::nanoseconds delay) {
+    ProgressReporter * const progress = control.progress;
+    auto race = std::make_shared<Hedging::Race>();
+    for (const auto regex: filter.regexes) {
+        race->regexes.push_back(*regex);
+    }
+    for (const auto &regex: race->regexes) {
+        race->filter.regexes.push_back(&regex);
+    }
+    // The hedge can outlive the enumeration, and with it the converter pool,
+    // so it converts on its own thread.
+    ClassControl hedgeControl;
+    hedgeControl.timeout = control.timeout;
+    hedgeControl.prefetch = control.prefetch;
+    hedgeControl.batches = control.batches;
+    hedgeControl.conversion = control.conversion;
+    session.hedging.schedule(std::chrono::steady_clock::now() + delay, race, [race, className, hedgeControl]() {
+        try {
+            ComLibrary library;
+            // Hedging with a connection the pool doesn't have to spare would
+            // only add load.
+            auto lease = ConnectionPools::instance().get().tryCheckout();
+            if (!lease) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(race->mutex);
+                if (race->primaryDone) {
+                    return;
+                }
+                race->hedged = true;
+            }
+            _bstr_t bHedgeClassName(className.c_str());
+            ClassControl control = hedgeControl;
+            control.cancelled = [&race]() { return race->primaryDone.load(); };
+            auto result = enumerateClass(**lease, bHedgeClassName.GetBSTR(), className, race->filter, nullptr, control);
+            std::lock_guard<std::mutex> lock(race->mutex);
+            if (!race->primaryDone) {
+                race->hedgeResult = std::move(result);
+                race->hedgeDone = true;
+            }
+        } catch (const std::exception &) {
+            // The primary carries on alone.
+        }
+    });
+
+    const auto finish = [&race, &session]() {
+        bool hedged;
+        {
+            std::lock_guard<std::mutex> lock(race->mutex);
+            race->primaryDone = true;
+            hedged = race->hedged;
+        }
+        session.hedging.primaryDone();
+        return hedged;
+    };
+    std::shared_ptr<ClassResult> result;
+    try {
+        ClassControl primaryControl = control;
+        primaryControl.cancelled = [&race, &control]() {
+            return race->hedgeDone || (control.cancelled && control.cancelled());
+        };
+        result = enumerateClass(services, bClassName, className, filter, stats, primaryControl);
+    } catch (const CancelledError &) {
+        finish();
+        if (!race->hedgeDone) {
+            throw;
+        }
+        // The hedge won.  hedgeResult can't change after hedgeDone is set.
+        {
+            std::lock_guard<std::mutex> lock(session.hedging.mutex);
+            ++session.hedging.eligible;
+            ++session.hedging.hedges;
+            ++session.hedging.wins;
+        }
+        if (stats) {
+            stats->hedged = 1;
+            stats->hedgeWon = 1;
+            stats->objects += race->hedgeResult->instances.size();
+        }
+        if (progress) {
+            progress->instances += race->hedgeResult->instances.size();
+            progress->bytes += race->hedgeResult->bytes;
+            for (const auto &instance: race->hedgeResult->instances) {
+                progress->properties += instance.properties.size();
+            }
+        }
+        return race->hedgeResult;
+    } catch (...) {
+        finish();
+        throw;
+    }
+    const bool hedged = finish();
+    {
+        std::lock_guard<std::mutex> lock(session.hedging.mutex);
+        ++session.hedging.eligible;
+        if (hedged) {
+            ++session.hedging.hedges;
+        }
+    }
+    if (stats) {
+        stats->hedged = hedged;
+    }
+    return result;
+}
+
+/** Get a class's result, either from the session's result cache or by
+ * enumerating it, and record it in the session's caches.  The filter's key
+ * identifies it for the result cache.  session may be null.
+ *
+ * If the session's circuit breakers are enabled, failures are recorded against
+ * the class rather than thrown, and null is returned for a failed or
+ * quarantined class.  Cancellation through the options' cancel token is always
+ * thrown.  options, progress, and converters may be null.
+ */
+static std::shared_ptr<const ClassResult> fetchClass(WmiSession * const session, Connection &services, const BSTR bClassName, const std::wstring &className, const PropertyFilter &filter, WmiStats * const stats, const WmiOptions * const options = nullptr, ProgressReporter * const progress = nullptr, WbemConverterPool * const converters = nullptr) {
+    if (progress) {
+        progress->setClass(className);
+    }
+    const Conversion conversion = options ? options->conversion : Conversion{};
+    if (session) {
+        if (auto cached = session->results.find(className, filter.key, conversion)) {
+            if (stats) {
+                ++stats->resultCacheHits;
+                stats->bytesSaved += cached->bytes;
+                stats->callsSaved += cached->calls;
+                stats->objects += cached->instances.size();
+            }
+            if (progress) {
+                progress->instances += cached->instances.size();
+                progress->bytes += cached->bytes;
+                for (const auto &instance: cached->instances) {
+                    progress->properties += instance.properties.size();
+                }
+            }
+            return cached;
+        }
+    }
+    ClassControl control;
+    control.progress = progress;
+    control.converters = converters;
+    control.conversion = conversion;
+    if (options) {
+        control.prefetch = options->prefetch;
+        control.batches = options->batches;
+        if (const WmiCancel * const cancel = options->cancel) {
+            control.cancelled = [cancel]() { return cancel->signalled.load(); };
+        }
+    }
+    if (session) {
+        const BreakerState breaker = session->breakers.allow(className, std::chrono::steady_clock::now());
+        if (stats) {
+            stats->breakerState = breaker;
+            stats->predictedTime = session->costs.predict(className);
+        }
+        if (breaker == BreakerOpen) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(session->breakers.mutex);
+        control.timeout = session->breakers.timeout;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<ClassResult> result;
+    try {
+        const auto p95 = session && session->hedging.matches(className) ? session->costs.percentile95(className) : std::nullopt;
+        if (p95) {
+            const std::chrono::nanoseconds delay(static_cast<int64_t>(*p95));
+            result = hedgedEnumerateClass(*session, services, bClassName, className, filter, stats, control, delay);
+        } else {
+            result = enumerateClass(services, bClassName, className, filter, stats, control);
+        }
+    } catch (const CancelledError &) {
+        // Neither a success nor a failure, but a probe must still give way to
+        // the next one.
+        if (session) {
+            session->breakers.abandon(className);
+        }
+        throw;
+    } catch (const std::exception &) {
+        if (session && session->breakers.enabled()) {
+            session->breakers.fail(className, std::chrono::steady_clock::now());
+            if (stats) {
+                stats->failed = 1;
+            }
+            return nullptr;
+        }
+        throw;
+    }
+    if (session) {
+        session->breakers.succeed(className);
+        const uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        const bool outlier = session->costs.record(className, elapsed, result->instances.size(), result->bytes);
+        if (stats) {
+            stats->outlier = outlier;
+        }
+        session->emptyClasses.update(className, result->instances.empty());
+        session->results.store(className, filter.key, conversion, result);
+    }
+    return result;
+}
+
+/** Get the names of all classes matching cRegex, leaving out those the
+ * session knows to be empty.  session, stats, cancel, and progress may all be
+ * null.
+ */
+static std::vector<std::wstring> matchingClasses(Connection &services, const std::wregex &cRegex, WmiSession * const session, WmiStats * const enumStats, const WmiCancel * const cancel, ProgressReporter * const progress) {
+    std::vector<std::wstring> classNames;
+    auto enumClasses = EnumWbemClasses::classEnum(services, enumStats);
+    // With a cancel token, Next only waits a short while at a time so that the
+    // token is noticed quickly.
+    const long wait = cancel ? cancelInterval : waitInfinite;
+    for (auto items = enumClasses.next(enumStats, wait); items; items = enumClasses.next(enumStats, wait)) {
+        if (cancel && cancel->signalled) {
+            throw CancelledError("Enumeration cancelled.");
+        }
+        // We already know that items has a value due to the for loop check.
+        for (auto &item: items.value()) {
+            // Need this as a separate piece to avoid cleaning it up too
+            // early.  If we access the bstr directly here, the following
+            // statement will be holding a dangling pointer because the
+            // Variant will have been cleaned up.
+            auto rawClassName = item.get(L"__CLASS").value();
+
+            // Convenience BSTR
+            auto bClassName = rawClassName.variant.bstrVal;
+            std::wstring className(bClassName, SysStringLen(bClassName));
+            bool classMatches;
+            {
+                ScopedTimer timer(enumStats ? &enumStats->regexTime : nullptr);
+                if (enumStats) {
+                    ++enumStats->regexMatches;
+                }
+                classMatches = std::regex_match(className, cRegex);
+            }
+            if (classMatches) {
+                if (session && session->emptyClasses.contains(className)) {
+                    if (enumStats) {
+                        ++enumStats->emptyClassesSkipped;
+                    }
+                    continue;
+                }
+                classNames.push_back(std::move(className));
+            }
+        }
+        if (progress) {
+            progress->classesScanned += items->size();
+            progress->classesMatched = classNames.size();
+            progress->report();
+        }
+    }
+    return classNames;
+}
+
+/** Get a new WmiEnum.  In the case of error, this enum will possibly have some
+ * instances, but will definitely have its error field set.  Even in the case of
+ * error, the WmiEnum instance should be freed.
+ *
+ * Shared implementation of all the synchronous entry points.  session may be
+ * null, in which case nothing is cached between calls.
+ */
+static WmiEnum *enumerate(const wchar_t * const classRegex, const wchar_t * const propertyRegex, const WmiOptions *options, WmiSession * const session) {
+    static const WmiOptions defaultOptions;
+    if (!options) {
+        options = &defaultOptions;
+    }
+    WmiEnum *output = new WmiEnum();
+    std::optional<ProgressReporter> progressReporter;
+    if (options->progress) {
+        progressReporter.emplace(*options);
+    }
+    ProgressReporter * const progress = progressReporter ? &*progressReporter : nullptr;
+    try {
+        const std::wregex cRegex(classRegex), pRegex(propertyRegex);
+        const PropertyFilter filter(pRegex, propertyRegex);
+        WmiStats * const enumStats = output->addStats(options->stats, L"");
+        ScopedTimer enumTimer(enumStats ? &enumStats->totalTime : nullptr);
+        // Connections come from the process-wide pool, so that they are only
+        // set up once rather than on every call.
+        ComLibrary library;
+        ConnectionPool &pool = ConnectionPools::instance().get();
+
+        // Collect the matching classes first, so that the work can be ordered
+        // by cost.
+        std::vector<std::wstring> classNames;
+        {
+            // Checked back in before the workers start, so that they can use
+            // it.
+            auto lease = pool.checkout();
+            classNames = matchingClasses(*lease, cRegex, session, enumStats, options->cancel, progress);
+        }
+
+        // Stats are made up front, so each worker only touches its own.
+        std::vector<WmiStats *> stats;
+        stats.reserve(classNames.size());
+        for (const auto &className: classNames) {
+            stats.push_back(output->addStats(options->stats, className));
+        }
+        const unsigned workers = std::max(1u, std::min<unsigned>(options->workers, classNames.size()));
+        std::vector<size_t> order;
+        if (session) {
+            order = session->costs.order(classNames, workers > 1);
+        } else {
+            for (size_t i = 0; i < classNames.size(); ++i) {
+                order.push_back(i);
+            }
+        }
+
+        // Started once and shared by every worker and class.  Declared before
+        // the workers, so that it outlives them.
+        std::optional<WbemConverterPool> converters;
+        if (options->converters > 0) {
+            converters.emplace(options->converters);
+        }
+
+        // Results go into slots, so they come out in class enumeration order
+        // no matter what order they were fetched in.
+        std::vector<std::shared_ptr<const ClassResult>> results(classNames.size());
+        std::atomic<size_t> next{0};
+        std::atomic<bool> failed{false};
+        std::mutex errorMutex;
+        const auto fail = [&](const std::string &message) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!output->error) {
+                output->error = std::make_optional<std::string>(message);
+            }
+            failed = true;
+        };
+        const auto work = [&](Connection &workerServices) {
+            for (size_t i = next++; i < order.size() && !failed; i = next++) {
+                if (options->cancel && options->cancel->signalled) {
+                    throw CancelledError("Enumeration cancelled.");
+                }
+                const size_t index = order[i];
+                _bstr_t bClassName(classNames[index].c_str());
+                results[index] = fetchClass(session, workerServices, bClassName.GetBSTR(), classNames[index], filter, stats[index], options, progress, converters ? &*converters : nullptr);
+                if (progress) {
+                    ++progress->classesCompleted;
+                    progress->report();
+                }
+            }
+        };
+
+        if (workers == 1) {
+            try {
+                auto lease = pool.checkout();
+                work(*lease);
+            } catch (const std::exception &e) {
+                fail(e.what());
+            }
+        } else {
+            std::vector<std::thread> threads;
+            for (unsigned worker = 0; worker < workers; ++worker) {
+                threads.emplace_back([&]() {
+                    try {
+                        ComLibrary workerLibrary;
+                        auto lease = pool.checkout();
+                        work(*lease);
+                    } catch (const std::exception &e) {
+                        fail(e.what());
+                    }
+                });
+            }
+            for (auto &thread: threads) {
+                thread.join();
+            }
+        }
+        for (auto &result: results) {
+            if (result) {
+                output->add(std::move(result));
+            }
+        }
+    }
+    catch (const std::exception &e) {
+        output->error = std::make_optional<std::string>(e.what());
+    }
+    if (progress) {
+        // The final counts are always reported.
+        progress->report(true);
+    }
+    return output;
+}
+
+WmiEnum *WmiEnum_new(const wchar_t * const classRegex, const wchar_t * const propertyRegex) {
+    return enumerate(classRegex, propertyRegex, nullptr, nullptr);
+}
+
+WmiEnum *WmiEnum_newEx(const wchar_t * const classRegex, const wchar_t * const propertyRegex, const WmiOptions * const options) {
+    return enumerate(classRegex, propertyRegex, options, nullptr);
+}
+
+/** The live instances of a class.  Shared between the WmiLive and its sink,
+ * because the sink can still be called for a short time after the
+ * subscription is cancelled.
+ */
+using LiveInstances = LiveTable<WmiInstance>;
+
+/** IWbemObjectSink which applies __InstanceOperationEvent notifications to a
+ * LiveTable.
+ */
+class LiveSink : public IWbemObjectSink {
+    private:
+        std::atomic<ULONG> references{1};
+        const std::shared_ptr<LiveInstances> table;
+        const std::wregex pRegex;
+
+    public:
+        LiveSink(std::shared_ptr<LiveInstances> table, std::wregex pRegex) : table(std::move(table)), pRegex(std::move(pRegex)) {
+        }
+
+        virtual ~LiveSink() = default;
+
+        ULONG STDMETHODCALLTYPE AddRef() override {
+            return ++references;
+        }
+
+        ULONG STDMETHODCALLTYPE Release() override {
+            const ULONG count = --references;
+            if (count == 0) {
+                delete this;
+            }
+            return count;
+        }
+
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void ** const ppv) override {
+            if (riid == IID_IUnknown || riid == IID_IWbemObjectSink) {
+                *ppv = static_cast<IWbemObjectSink *>(this);
+                AddRef();
+                return WBEM_S_NO_ERROR;
+            }
+            *ppv = nullptr;
+            return E_NOINTERFACE;
+        }
+
+        HRESULT STDMETHODCALLTYPE Indicate(const LONG count, IWbemClassObject ** const objects) override {
+            try {
+                for (LONG i = 0; i < count; ++i) {
+                    // The array is only borrowed, so take a reference for the
+                    // wrapper to release.
+                    objects[i]->AddRef();
+                    WbemClass event(objects[i]);
+                    apply(event);
+                }
+            } catch (const std::exception &e) {
+                table->fail(e.what());
+            }
+            return WBEM_S_NO_ERROR;
+        }
+
+        HRESULT STDMETHODCALLTYPE SetStatus(const LONG flags, const HRESULT result, BSTR, IWbemClassObject *) override {
+            if (flags == WBEM_STATUS_COMPLETE && FAILED(result) && result != WBEM_E_CALL_CANCELLED) {
+                std::ostringstream oss;
+                oss << "Event subscription failed. Error code = 0x" << std::hex << result;
+                table->fail(oss.str());
+            }
+            return WBEM_S_NO_ERROR;
+        }
+
+    private:
+        void apply(WbemClass &event) {
+            auto eventClass = event.get(L"__CLASS");
+            auto target = event.get(L"TargetInstance");
+            if (!eventClass || eventClass->variant.vt != VT_BSTR || !target || target->variant.vt != VT_UNKNOWN) {
+                return;
+            }
+            IWbemClassObject *targetObject = nullptr;
+            checkResult(target->variant.punkVal->QueryInterface(IID_IWbemClassObject, reinterpret_cast<void **>(&targetObject)),
+                    "Event target is not a class object.");
+            WbemClass instance(targetObject);
+
+            if (std::wcscmp(eventClass->variant.bstrVal, L"__InstanceDeletionEvent") == 0) {
+                std::wstring path;
+                if (auto relPath = instance.get(L"__RELPATH")) {
+                    if (relPath->variant.vt == VT_BSTR) {
+                        path.assign(relPath->variant.bstrVal, SysStringLen(relPath->variant.bstrVal));
+                    }
+                }
+                table->erase(path);
+            } else {
+                Conversion conversion;
+                conversion.ownClassName = true;
+                auto wmiInstance = std::make_shared<const WmiInstance>(convertInstance(instance, std::wstring(), pRegex, nullptr, conversion));
+                table->upsert(wmiInstance->path, std::move(wmiInstance));
+            }
+        }
+};
+
+/** The sampled kind of a CIM integer type.
+ */
+static SampleKind sampleKind(const CIMTYPE type) {
+    switch (type) {
+        case CIM_UINT64:
+        case CIM_SINT64:
+            return Sample64;
+        case CIM_SINT32:
+            return SampleSigned32;
+        default:
+            return SampleUnsigned32;
+    }
+}
+
+/** SampledClass traits for a real refresher.
+ */
+struct WbemSampleTraits {
+    using Enum = IWbemHiPerfEnum;
+    using Object = IWbemObjectAccess *;
+
+    static bool objects(IWbemHiPerfEnum &hiPerfEnum, IWbemObjectAccess ** const objects, const size_t capacity, size_t &returned) {
+        ULONG count = 0;
+        const HRESULT hres = hiPerfEnum.GetObjects(0, capacity, objects, &count);
+        returned = count;
+        if (hres == WBEM_E_BUFFER_TOO_SMALL) {
+            return false;
+        }
+        checkResult(hres, "Could not get refreshed objects.");
+        return true;
+    }
+
+    static void release(IWbemObjectAccess * const access) {
+        access->Release();
+    }
+
+    static long handle(IWbemObjectAccess * const access, const wchar_t * const key, SampleKind &kind) {
+        CIMTYPE type;
+        LONG output;
+        checkResult(access->GetPropertyHandle(key, &type, &output), "Could not get property handle.");
+        kind = sampleKind(type);
+        return output;
+    }
+
+    static bool nameHandle(IWbemObjectAccess * const access, long &handle) {
+        CIMTYPE type;
+        return SUCCEEDED(access->GetPropertyHandle(L"Name", &type, &handle)) && type == CIM_STRING;
+    }
+
+    static uint32_t readDword(IWbemObjectAccess * const access, const long handle) {
+        DWORD value;
+        checkResult(access->ReadDWORD(handle, &value), "Could not read DWORD.");
+        return value;
+    }
+
+    static uint64_t readQword(IWbemObjectAccess * const access, const long handle) {
+        unsigned long long value;
+        checkResult(access->ReadQWORD(handle, &value), "Could not read QWORD.");
+        return value;
+    }
+
+    static bool readString(IWbemObjectAccess * const access, const long handle, wchar_t * const buffer, const size_t capacity, size_t &length) {
+        LONG bytes = 0;
+        const HRESULT hres = access->ReadPropertyValue(handle, capacity * sizeof(wchar_t), &bytes, reinterpret_cast<BYTE *>(buffer));
+        length = bytes / sizeof(wchar_t);
+        if (hres == WBEM_E_BUFFER_TOO_SMALL) {
+            return false;
+        }
+        checkResult(hres, "Could not read instance name.");
+        return true;
+    }
+};
+
+/** A single class registered with a sampler's refresher.
+ */
+struct SamplerClass : SampledClass<WbemSampleTraits> {
+    std::wstring className;
+    ComPointer<IWbemHiPerfEnum> hiPerfEnum;
+    LONG id = 0;
+};
+
+/** Implementation of the public sampler class.
+ */
+struct WmiSampler {
+    std::optional<std::string> error;
+    std::optional<Services> services;
+    ComPointer<IWbemRefresher> refresher;
+    ComPointer<IWbemConfigureRefresher> configure;
+    std::vector<SamplerClass> classes;
+};
+
+/** Where a scheduled job's results go.
+ */
+struct SchedulerDelivery {
+    WmiSchedulerCallback callback;
+    void *userData;
+};
+
+/** Implementation of the public scheduler class.  A single thread sleeps until
+ * the earliest job is due, then runs every job due within the coalescing
+ * window in one pass, which enumerates each class at most once no matter how
+ * many jobs want it.  The timing and coalescing are in Schedule and
+ * runSchedulePass, which don't depend on the clock or on WMI.
+ */
+struct WmiScheduler {
+    using Clock = Schedule::Clock;
+
+    WmiSession * const session;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    Schedule schedule;
+    // By job id.
+    std::unordered_map<size_t, SchedulerDelivery> deliveries;
+    bool stopping = false;
+
+    uint64_t passes = 0;
+    uint64_t jobRuns = 0;
+    uint64_t classRequests = 0;
+    uint64_t classFetches = 0;
+
+    std::thread thread;
+
+    WmiScheduler(WmiSession * const session) : session(session) {
+        thread = std::thread([this]() {
+            run();
+        });
+    }
+
+    WmiScheduler(const WmiScheduler &) = delete;
+    WmiScheduler &operator=(const WmiScheduler &) = delete;
+
+    ~WmiScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            const auto earliest = schedule.earliest();
+            if (!earliest) {
+                wake.wait(lock);
+                continue;
+            }
+            if (Clock::now() < *earliest) {
+                wake.wait_until(lock, *earliest);
+                continue;
+            }
+            auto due = schedule.takeDue(Clock::now());
+            std::vector<SchedulerDelivery> targets;
+            targets.reserve(due.size());
+            for (const auto &job: due) {
+                targets.push_back(deliveries.at(job.id));
+            }
+            lock.unlock();
+            runPass(due, targets);
+            lock.lock();
+        }
+    }
+
+    /** Run one coalesced pass over the given jobs, and deliver each job its own
+     * WmiEnum.
+     */
+    void runPass(const std::vector<ScheduledJob> &due, const std::vector<SchedulerDelivery> &targets) {
+        std::vector<std::unique_ptr<WmiEnum>> outputs;
+        for (size_t i = 0; i < due.size(); ++i) {
+            outputs.push_back(std::make_unique<WmiEnum>());
+        }
+        PassCounts counts;
+        try {
+            ComLibrary library;
+            auto services = ConnectionPools::instance().get().checkout();
+            auto enumClasses = EnumWbemClasses::classEnum(*services);
+            std::optional<std::vector<WbemClass>> items = std::make_optional<std::vector<WbemClass>>();
+            size_t item = 0;
+            const auto nextClass = [&enumClasses, &items, &item](std::wstring &className) {
+                while (item >= items->size()) {
+                    items = enumClasses.next();
+                    item = 0;
+                    if (!items) {
+                        return false;
+                    }
+                }
+                auto rawClassName = (*items)[item++].get(L"__CLASS").value();
+                className.assign(rawClassName.variant.bstrVal, SysStringLen(rawClassName.variant.bstrVal));
+                return true;
+            };
+            const auto fetch = [this, &due, &outputs, &services](const std::wstring &className, const PassClass &wanting) {
+                if (session && session->emptyClasses.contains(className)) {
+                    return false;
+                }
+                PropertyFilter filter;
+                for (const size_t job: wanting.patterns) {
+                    filter.add(due[job].pRegex, due[job].propertyPattern);
+                }
+                _bstr_t bClassName(className.c_str());
+                auto result = fetchClass(session, *services, bClassName.GetBSTR(), className, filter, nullptr);
+                if (!result) {
+                    return true;
+                }
+
+                for (const size_t job: wanting.jobs) {
+                    if (wanting.patterns.size() == 1) {
+                        // Every job got exactly what it asked for, so the
+                        // result can be shared.
+                        outputs[job]->add(result);
+                        continue;
+                    }
+                    auto filtered = std::make_shared<ClassResult>();
+                    filtered->instances.reserve(result->instances.size());
+                    for (const auto &instance: result->instances) {
+                        WmiInstance &copy = filtered->instances.emplace_back();
+                        copy.className = instance.className;
+                        copy.path = instance.path;
+                        for (const auto &property: instance.properties) {
+                            if (std::regex_match(std::get<0>(property), due[job].pRegex)) {
+                                copy.properties.push_back(property);
+                            }
+                        }
+                        filtered->bytes += copy.size();
+                    }
+                    outputs[job]->add(std::move(filtered));
+                }
+                return true;
+            };
+            counts = runSchedulePass(due, nextClass, fetch);
+        } catch (const std::exception &e) {
+            for (auto &output: outputs) {
+                output->error = std::make_optional<std::string>(e.what());
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++passes;
+            jobRuns += due.size();
+            classRequests += counts.classRequests;
+            classFetches += counts.classFetches;
+        }
+        for (size_t job = 0; job < due.size(); ++job) {
+            targets[job].callback(outputs[job].release(), targets[job].userData);
+        }
+    }
+};
+
+/** A cooked instance, with one value per counter that could be computed.
+ */
+struct CookedInstance {
+    std::wstring className;
+    std::wstring path;
+    std::vector<std::tuple<std::wstring, double>> values;
+};
+
+/** Implementation of the public cooker class.
+ */
+struct WmiCooker {
+    std::optional<std::string> error;
+
+    // The counter types of each class, by property name.  Only properties with
+    // a type that can be cooked are included.
+    std::unordered_map<std::wstring, std::unordered_map<std::wstring, uint32_t>> counterTypes;
+
+    // The CIM types of each class's properties, by property name, for the
+    // classes whose schema has been loaded.
+    std::unordered_map<std::wstring, std::unordered_map<std::wstring, CIMTYPE>> cimTypes;
+
+    // The raw values of every instance in the previous sample, by identity.
+    std::unordered_map<std::wstring, std::unordered_map<std::wstring, uint64_t>> previous;
+
+    std::vector<CookedInstance> instances;
+
+    /** Load the counter types of a class from the CounterType qualifiers in its
+     * schema.
+     */
+    void loadCounterTypes(Connection &services, const std::wstring &className) {
+        std::unordered_map<std::wstring, uint32_t> types;
+        std::unordered_map<std::wstring, CIMTYPE> propertyTypes;
+        _bstr_t bClassName(className.c_str());
+        IWbemClassObject *classObject = nullptr;
+        checkResult(services.pSvc->GetObject(bClassName.GetBSTR(), 0, nullptr, &classObject, nullptr),
+                "Could not get class.");
+        WbemClass wbemClass(classObject);
+        wbemClass.beginEnumeration();
+        std::wstring key;
+        Variant value;
+        CIMTYPE cimType;
+        while (wbemClass.next(key, value, nullptr, &cimType)) {
+            propertyTypes.emplace(key, cimType);
+            IWbemQualifierSet *qualifiers = nullptr;
+            if (FAILED(classObject->GetPropertyQualifierSet(key.c_str(), &qualifiers))) {
+                continue;
+            }
+            ComPointer<IWbemQualifierSet> qualifierSet(qualifiers);
+            Variant counterType;
+            if (SUCCEEDED(qualifierSet->Get(L"CounterType", 0, counterType, nullptr)) && counterType.variant.vt == VT_I4) {
+                const uint32_t type = counterType.variant.lVal;
+                if (perfCounterSupported(type)) {
+                    types.emplace(key, type);
+                }
+            }
+        }
+        counterTypes[className] = std::move(types);
+        cimTypes[className] = std::move(propertyTypes);
+    }
+
+    /** Parse the text of a raw value of a property of className.  Unsigned
+     * 32-bit properties arrive as VT_I4, so those of 2^31 and up are
+     * formatted as negative numbers, and are masked back to 32 bits here.
+     * 64-bit values arrive as strings, so a negative value of a property
+     * whose schema isn't known is taken to be one of these.
+     */
+    uint64_t parseRaw(const std::wstring &className, const std::wstring &key, const wchar_t * const text) const {
+        const bool negative = text[0] == L'-';
+        bool narrow = negative;
+        const auto types = cimTypes.find(className);
+        if (types != cimTypes.end()) {
+            const auto type = types->second.find(key);
+            if (type != types->second.end()) {
+                switch (type->second) {
+                    case CIM_UINT8:
+                    case CIM_SINT8:
+                    case CIM_UINT16:
+                    case CIM_SINT16:
+                    case CIM_UINT32:
+                    case CIM_SINT32:
+                        narrow = true;
+                        break;
+                    default:
+                        narrow = false;
+                        break;
+                }
+            }
+        }
+        const uint64_t value = negative ? static_cast<uint64_t>(std::wcstoll(text, nullptr, 10)) : std::wcstoull(text, nullptr, 10);
+        return narrow ? static_cast<uint32_t>(value) : value;
+    }
+};
+
+/** Implementation of the public live cache class.
+ */
+struct WmiLive {
+    std::optional<std::string> error;
+    std::optional<Services> services;
+    std::shared_ptr<LiveInstances> table = std::make_shared<LiveInstances>();
+    LiveSink *sink = nullptr;
+
+    WmiLive() = default;
+    WmiLive(const WmiLive &) = delete;
+    WmiLive &operator=(const WmiLive &) = delete;
+
+    ~WmiLive() {
+        if (sink) {
+            services->pSvc->CancelAsyncCall(sink);
+            sink->Release();
+        }
+    }
+};
+
+/** Simple RAII wrapper around an auto-reset Win32 event.
+ */
+struct Event {
+        HANDLE handle;
+
+        Event() {
+            handle = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+            checkWin32(handle != nullptr, "Could not create event.");
+        }
+
+        Event(const Event &) = delete;
+        Event &operator=(const Event &) = delete;
+
+        ~Event() {
+            CloseHandle(handle);
+        }
+
+        void set() {
+            SetEvent(handle);
+        }
+
+        /** Returns true if the event was set within milliseconds.
+         */
+        bool wait(const DWORD milliseconds) {
+            return WaitForSingleObject(handle, milliseconds) == WAIT_OBJECT_0;
+        }
+};
+
+/** What an AsyncSink reports for one class: either a batch of instances, or
+ * the completion of the call.
+ */
+struct AsyncMessage {
+    size_t index = 0;
+    std::vector<WbemClass> objects;
+    bool complete = false;
+    HRESULT status = S_OK;
+};
+
+/** The queue that all of an async enumeration's sinks feed.  Shared with the
+ * sinks, because WMI may still hold them for a short time after the calls are
+ * cancelled.
+ */
+struct AsyncQueue {
+    MpscQueue<AsyncMessage> messages;
+    Event ready;
+};
+
+/** IWbemObjectSink for one class of an async enumeration.  It does no work on
+ * WMI's threads beyond queueing what it is given.
+ */
+class AsyncSink : public IWbemObjectSink {
+    private:
+        std::atomic<ULONG> references{1};
+        const std::shared_ptr<AsyncQueue> queue;
+        const size_t index;
+
+    public:
+        AsyncSink(std::shared_ptr<AsyncQueue> queue, const size_t index) : queue(std::move(queue)), index(index) {
+        }
+
+        virtual ~AsyncSink() = default;
+
+        ULONG STDMETHODCALLTYPE AddRef() override {
+            return ++references;
+        }
+
+        ULONG STDMETHODCALLTYPE Release() override {
+            const ULONG count = --references;
+            if (count == 0) {
+                delete this;
+            }
+            return count;
+        }
+
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void ** const ppv) override {
+            if (riid == IID_IUnknown || riid == IID_IWbemObjectSink) {
+                *ppv = static_cast<IWbemObjectSink *>(this);
+                AddRef();
+                return WBEM_S_NO_ERROR;
+            }
+            *ppv = nullptr;
+            return E_NOINTERFACE;
+        }
+
+        HRESULT STDMETHODCALLTYPE Indicate(const LONG count, IWbemClassObject ** const objects) override {
+            try {
+                AsyncMessage message;
+                message.index = index;
+                message.objects.reserve(count);
+                for (LONG i = 0; i < count; ++i) {
+                    // The array is only borrowed, so take a reference for the
+                    // wrapper to release.
+                    objects[i]->AddRef();
+                    message.objects.emplace_back(objects[i]);
+                }
+                queue->messages.push(std::move(message));
+                queue->ready.set();
+            } catch (const std::bad_alloc &) {
+                return WBEM_E_OUT_OF_MEMORY;
+            }
+            return WBEM_S_NO_ERROR;
+        }
+
+        HRESULT STDMETHODCALLTYPE SetStatus(const LONG flags, const HRESULT result, BSTR, IWbemClassObject *) override {
+            if (flags == WBEM_STATUS_COMPLETE) {
+                AsyncMessage message;
+                message.index = index;
+                message.complete = true;
+                message.status = result;
+                queue->messages.push(std::move(message));
+                queue->ready.set();
+            }
+            return WBEM_S_NO_ERROR;
+        }
+};
+
+/** Implementation of the public async enumeration.  A single thread lists the
+ * matching classes, keeps up to maxOutstanding CreateInstanceEnumAsync calls
+ * in flight on one pooled connection, and converts everything the sinks queue
+ * up.
+ */
+struct WmiAsync {
+    static constexpr size_t maxOutstanding = 32;
+
+    const std::wstring classRegex;
+    const std::wstring propertyRegex;
+    const WmiOptions options;
+    const WmiAsyncCallback callback;
+    void * const userData;
+
+    std::atomic<bool> cancelled{false};
+    std::shared_ptr<AsyncQueue> queue = std::make_shared<AsyncQueue>();
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+    std::unique_ptr<WmiEnum> result;
+
+    std::thread thread;
+
+    WmiAsync(std::wstring classRegex, std::wstring propertyRegex, const WmiOptions &options, const WmiAsyncCallback callback, void * const userData) :
+            classRegex(std::move(classRegex)),
+            propertyRegex(std::move(propertyRegex)),
+            options(options),
+            callback(callback),
+            userData(userData) {
+        thread = std::thread([this]() {
+            run();
+        });
+    }
+
+    WmiAsync(const WmiAsync &) = delete;
+    WmiAsync &operator=(const WmiAsync &) = delete;
+
+    ~WmiAsync() {
+        cancel();
+        thread.join();
+    }
+
+    void cancel() {
+        cancelled = true;
+        queue->ready.set();
+    }
+
+    void run() {
+        auto output = std::make_unique<WmiEnum>();
+        std::optional<ProgressReporter> progressReporter;
+        if (options.progress) {
+            progressReporter.emplace(options);
+        }
+        ProgressReporter * const progress = progressReporter ? &*progressReporter : nullptr;
+        try {
+            ComLibrary library;
+            enumerate(*output, progress);
+        } catch (const std::exception &e) {
+            output->error = std::make_optional<std::string>(e.what());
+        }
+        if (progress) {
+            progress->report(true);
+        }
+        if (callback) {
+            callback(output.release(), userData);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            result = std::move(output);
+            done = true;
+        }
+        finished.notify_all();
+    }
+
+    void enumerate(WmiEnum &output, ProgressReporter * const progress) {
+        using Clock = std::chrono::steady_clock;
+        const std::wregex cRegex(classRegex), pRegex(propertyRegex);
+        WmiStats * const enumStats = output.addStats(options.stats, L"");
+        ScopedTimer enumTimer(enumStats ? &enumStats->totalTime : nullptr);
+        auto lease = ConnectionPools::instance().get().checkout();
+        const std::vector<std::wstring> classNames = matchingClasses(*lease, cRegex, nullptr, enumStats, options.cancel, progress);
+
+        struct Pending {
+            ComPointer<AsyncSink> sink;
+            std::shared_ptr<ClassResult> result = std::make_shared<ClassResult>();
+            WmiStats *stats = nullptr;
+            Clock::time_point start;
+        };
+        std::vector<Pending> pending(classNames.size());
+        for (size_t i = 0; i < classNames.size(); ++i) {
+            pending[i].stats = output.addStats(options.stats, classNames[i]);
+        }
+
+        size_t issued = 0;
+        size_t completed = 0;
+        const auto issue = [&]() {
+            while (issued < classNames.size() && issued - completed < maxOutstanding) {
+                auto &entry = pending[issued];
+                entry.start = Clock::now();
+                entry.sink = ComPointer<AsyncSink>(new AsyncSink(queue, issued));
+                if (entry.stats) {
+                    ++entry.stats->createEnumCalls;
+                }
+                _bstr_t bClassName(classNames[issued].c_str());
+                ++issued;
+                checkResult(lease->pSvc->CreateInstanceEnumAsync(bClassName.GetBSTR(), WBEM_FLAG_BIDIRECTIONAL, nullptr, entry.sink.pointer),
+                        "Could not create async instance enum.");
+                entry.result->calls = 1;
+            }
+        };
+        // Calls still in flight when this gives up are cancelled, and their
+        // sinks only live on until WMI lets go of them.
+        const auto cancelOutstanding = [&]() {
+            for (size_t i = 0; i < issued; ++i) {
+                if (pending[i].sink.pointer) {
+                    lease->pSvc->CancelAsyncCall(pending[i].sink.pointer);
+                    pending[i].sink = ComPointer<AsyncSink>();
+                }
+            }
+        };
+
+        try {
+            issue();
+            while (completed < classNames.size()) {
+                queue->ready.wait(cancelInterval);
+                if (cancelled || (options.cancel && options.cancel->signalled)) {
+                    throw CancelledError("Enumeration cancelled.");
+                }
+                while (auto message = queue->messages.pop()) {
+                    auto &entry = pending[message->index];
+                    if (message->complete) {
+                        entry.sink = ComPointer<AsyncSink>();
+                        ++completed;
+                        if (entry.stats) {
+                            entry.stats->totalTime += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - entry.start).count();
+                        }
+                        if (progress) {
+                            ++progress->classesCompleted;
+                            progress->report();
+                        }
+                        checkResult(message->status, "Async instance enum failed.");
+                        issue();
+                        continue;
+                    }
+                    ++entry.result->calls;
+                    if (entry.stats) {
+                        ++entry.stats->nextCalls;
+                        entry.stats->objects += message->objects.size();
+                    }
+                    size_t properties = 0;
+                    size_t bytes = 0;
+                    for (auto &object: message->objects) {
+                        WmiInstance wmiInstance = convertInstance(object, classNames[message->index], pRegex, entry.stats, options.conversion);
+                        bytes += wmiInstance.size();
+                        properties += wmiInstance.properties.size();
+                        entry.result->instances.emplace_back(std::move(wmiInstance));
+                    }
+                    entry.result->bytes += bytes;
+                    if (progress) {
+                        progress->instances += message->objects.size();
+                        progress->properties += properties;
+                        progress->bytes += bytes;
+                        progress->report();
+                    }
+                }
+            }
+        } catch (...) {
+            cancelOutstanding();
+            // Whatever was fetched is kept, as with the synchronous entry
+            // points.
+            for (auto &entry: pending) {
+                output.add(std::move(entry.result));
+            }
+            throw;
+        }
+        for (auto &entry: pending) {
+            output.add(std::move(entry.result));
+        }
+    }
+};
+
+const char *WmiEnum_error(const WmiEnum * const wmiEnum) {
+    if (wmiEnum->error) {
+        return wmiEnum->error.value().c_str();
+    } else {
+        return nullptr;
+    }
+}
+
+void WmiEnum_free(WmiEnum * const wmiEnum) {
+    delete wmiEnum;
+}
+
+size_t WmiEnum_instanceCount(const WmiEnum * const wmiEnum) {
+    if (wmiEnum->snapshot) {
+        return wmiEnum->snapshot->instanceCount();
+    }
+    return wmiEnum->instances.size();
+}
+
+const wchar_t *WmiEnum_instanceClassName(const WmiEnum * const wmiEnum, const size_t instance) {
+    if (wmiEnum->snapshot) {
+        if (const auto i = wmiEnum->snapshot->instance(instance)) {
+            return wmiEnum->snapshot->string(i->className);
+        }
+        return nullptr;
+    }
+    if (instance < wmiEnum->instances.size()) {
+        return wmiEnum->instances[instance]->className.c_str();
+    }
+    return nullptr;
+}
+
+static const ClassIndex &indexClasses(const WmiEnum * const wmiEnum) {
+    std::call_once(wmiEnum->classIndexOnce, [wmiEnum]() {
+        ClassIndex &index = wmiEnum->classIndex.emplace();
+        if (const auto &snapshot = wmiEnum->snapshot) {
+            // Classes out of instance order can only come from a corrupt
+            // snapshot, and are left out so that the ranges stay sorted.
+            // Null names are indexed as empty.
+            size_t end = 0;
+            for (size_t i = 0; i < snapshot->classCount(); ++i) {
+                const SnapshotClass * const snapshotClass = snapshot->snapshotClass(i);
+                if (snapshotClass && snapshotClass->instanceCount > 0 && snapshotClass->firstInstance >= end) {
+                    end = snapshotClass->firstInstance + snapshotClass->instanceCount;
+                    index.add(orEmpty(snapshot->string(snapshotClass->className)), snapshotClass->firstInstance, end);
+                }
+            }
+            return;
+        }
+        for (size_t instance = 0; instance < wmiEnum->instances.size(); ++instance) {
+            const wchar_t * const name = wmiEnum->instances[instance]->className.c_str();
+            if (!index.ranges.empty() && namesEqual(index.ranges.back().className, name)) {
+                index.ranges.back().end = instance + 1;
+            } else {
+                index.add(name, instance, instance + 1);
+            }
+        }
+    });
+    return *wmiEnum->classIndex;
+}
+
+size_t WmiEnum_classCount(const WmiEnum * const wmiEnum) {
+    return indexClasses(wmiEnum).ranges.size();
+}
+
+const wchar_t *WmiEnum_className(const WmiEnum * const wmiEnum, const size_t classIndex) {
+    const auto &ranges = indexClasses(wmiEnum).ranges;
+    if (classIndex < ranges.size()) {
+        return ranges[classIndex].className;
+    }
+    return nullptr;
+}
+
+/** Get the key index of a class's range, building it on first use.
+ */
+static const KeyIndex &indexKeys(const WmiEnum * const wmiEnum, const ClassIndex::Range &range) {
+    std::call_once(range.keysOnce, [wmiEnum, &range]() {
+        KeyIndex &keys = range.keys.emplace();
+        const size_t count = WmiEnum_instancePropertyCount(wmiEnum, range.begin);
+        for (size_t property = 0; property < count; ++property) {
+            keys.byName.emplace(ClassIndex::key(orEmpty(WmiEnum_instancePropertyKey(wmiEnum, range.begin, property))), property);
+        }
+        for (size_t instance = range.begin + 1; keys.uniform && instance < range.end; ++instance) {
+            if (WmiEnum_instancePropertyCount(wmiEnum, instance) != count) {
+                keys.uniform = false;
+                break;
+            }
+            for (size_t property = 0; property < count; ++property) {
+                if (std::wcscmp(orEmpty(WmiEnum_instancePropertyKey(wmiEnum, instance, property)), orEmpty(WmiEnum_instancePropertyKey(wmiEnum, range.begin, property))) != 0) {
+                    keys.uniform = false;
+                    break;
+                }
+            }
+        }
+    });
+    return *range.keys;
+}
+
+int WmiEnum_classInstanceRange(const WmiEnum * const wmiEnum, const wchar_t * const className, size_t * const begin, size_t * const end) {
+    const auto &index = indexClasses(wmiEnum);
+    const auto it = index.byName.find(ClassIndex::key(className));
+    if (it == index.byName.end()) {
+        return 0;
+    }
+    const auto &range = index.ranges[it->second];
+    *begin = range.begin;
+    *end = range.end;
+    return 1;
+}
+
+size_t WmiEnum_resolveKey(const WmiEnum * const wmiEnum, const wchar_t * const className, const wchar_t * const key) {
+    const auto &index = indexClasses(wmiEnum);
+    const auto it = index.byName.find(ClassIndex::key(className));
+    if (it == index.byName.end()) {
+        return SIZE_MAX;
+    }
+    const KeyIndex &keys = indexKeys(wmiEnum, index.ranges[it->second]);
+    if (!keys.uniform) {
+        return SIZE_MAX;
+    }
+    const auto property = keys.byName.find(ClassIndex::key(key));
+    return property == keys.byName.end() ? SIZE_MAX : property->second;
+}
+
+size_t WmiEnum_instancePropertyIndex(const WmiEnum * const wmiEnum, const size_t instance, const wchar_t * const key) {
+    const auto &ranges = indexClasses(wmiEnum).ranges;
+    // The ranges are in instance order, so the last one starting at or before
+    // instance holds it.
+    const auto range = std::upper_bound(ranges.begin(), ranges.end(), instance, [](const size_t instance, const ClassIndex::Range &range) {
+        return instance < range.begin;
+    });
+    if (range == ranges.begin() || instance >= std::prev(range)->end) {
+        return SIZE_MAX;
+    }
+    const KeyIndex &keys = indexKeys(wmiEnum, *std::prev(range));
+    if (keys.uniform) {
+        const auto property = keys.byName.find(ClassIndex::key(key));
+        return property == keys.byName.end() ? SIZE_MAX : property->second;
+    }
+    const size_t count = WmiEnum_instancePropertyCount(wmiEnum, instance);
+    for (size_t property = 0; property < count; ++property) {
+        if (namesEqual(orEmpty(WmiEnum_instancePropertyKey(wmiEnum, instance, property)), key)) {
+            return property;
+        }
+    }
+    return SIZE_MAX;
+}
+
+const wchar_t *WmiEnum_instancePath(const WmiEnum * const wmiEnum, const size_t instance) {
+    if (wmiEnum->snapshot) {
+        if (const auto i = wmiEnum->snapshot->instance(instance)) {
+            return wmiEnum->snapshot->string(i->path);
+        }
+        return nullptr;
+    }
+    if (instance < wmiEnum->instances.size()) {
+        return wmiEnum->instances[instance]->path.c_str();
+    }
+    return nullptr;
+}
+
+size_t WmiEnum_instancePropertyCount(const WmiEnum * const wmiEnum, const size_t instance) {
+    if (wmiEnum->snapshot) {
+        if (const auto i = wmiEnum->snapshot->instance(instance)) {
+            return i->propertyCount;
+        }
+        return 0;
+    }
+    if (instance < wmiEnum->instances.size()) {
+        return wmiEnum->instances[instance]->properties.size();
+    }
+    return 0;
+}
+const wchar_t *WmiEnum_instancePropertyKey(const WmiEnum * const wmiEnum, const size_t instance, const size_t property) {
+    if (wmiEnum->snapshot) {
+        if (const auto i = wmiEnum->snapshot->instance(instance)) {
+            if (const auto p = wmiEnum->snapshot->property(*i, property)) {
+                return wmiEnum->snapshot->string(p->key);
+            }
+        }
+        return nullptr;
+    }
+    if (instance < wmiEnum->instances.size()) {
+        const auto &i = *wmiEnum->instances[instance];
+        if (property < i.properties.size()) {
+            return std::get<0>(i.properties[property]).c_str();
+        }
+    }
+    return nullptr;
+}
+const wchar_t *WmiEnum_instancePropertyValue(const WmiEnum * const wmiEnum, const size_t instance, const size_t property) {
+    if (wmiEnum->snapshot) {
+        if (const auto i = wmiEnum->snapshot->instance(instance)) {
+            if (const auto p = wmiEnum->snapshot->property(*i, property)) {
+                return wmiEnum->snapshot->string(p->value);
+            }
+        }
+        return nullptr;
+    }
+    if (instance < wmiEnum->instances.size()) {
+        const auto &i = *wmiEnum->instances[instance];
+        if (property < i.properties.size()) {
+            return std::get<1>(i.properties[property]).c_str();
+        }
+    }
+    return nullptr;
+}
+
+WmiDatetime WmiEnum_instancePropertyDatetime(const WmiEnum * const wmiEnum, const size_t instance, const size_t property, int64_t * const microseconds) {
+    if (wmiEnum->snapshot || instance >= wmiEnum->instances.size()) {
+        return WMI_DATETIME_NONE;
+    }
+    const auto &i = *wmiEnum->instances[instance];
+    if (property >= i.properties.size()) {
+        return WMI_DATETIME_NONE;
+    }
+    const auto &value = std::get<1>(i.properties[property]);
+    if (value.datetime != WMI_DATETIME_NONE && microseconds) {
+        *microseconds = value.microseconds;
+    }
+    return value.datetime;
+}
+
+int WmiEnum_save(const WmiEnum * const wmiEnum, const wchar_t * const path) {
+    try {
+        // Goes through the public accessors, so that loaded snapshots can be
+        // saved as well.  Instances are written class by class, which for
+        // anything but a corrupt snapshot is all of them, in order.
+        const auto &ranges = indexClasses(wmiEnum).ranges;
+        size_t instanceCount = 0;
+        size_t propertyCount = 0;
+        for (const auto &range: ranges) {
+            instanceCount += range.end - range.begin;
+            for (size_t instance = range.begin; instance < range.end; ++instance) {
+                propertyCount += WmiEnum_instancePropertyCount(wmiEnum, instance);
+            }
+        }
+
+        const auto utf16 = [](const wchar_t * const string) {
+            return reinterpret_cast<const char16_t *>(string);
+        };
+        SnapshotWriter writer(ranges.size(), instanceCount, propertyCount);
+        for (const auto &range: ranges) {
+            writer.addClass(utf16(range.className), range.end - range.begin);
+            for (size_t instance = range.begin; instance < range.end; ++instance) {
+                const size_t count = WmiEnum_instancePropertyCount(wmiEnum, instance);
+                writer.addInstance(utf16(WmiEnum_instanceClassName(wmiEnum, instance)), utf16(WmiEnum_instancePath(wmiEnum, instance)), count);
+                for (size_t property = 0; property < count; ++property) {
+                    writer.addProperty(utf16(WmiEnum_instancePropertyKey(wmiEnum, instance, property)), utf16(WmiEnum_instancePropertyValue(wmiEnum, instance, property)));
+                }
+            }
+        }
+        writeFileAtomically(path, writer.finish());
+        return 1;
+    } catch (const std::exception &) {
+        return 0;
+    }
+}
+
+WmiEnum *WmiEnum_load(const wchar_t * const path) {
+    WmiEnum *output = new WmiEnum();
+    try {
+        output->snapshot = std::make_unique<const MappedSnapshot>(path);
+    } catch (const std::exception &e) {
+        output->error = std::make_optional<std::string>(e.what());
+    }
+    return output;
+}
+
+size_t WmiEnum_statsCount(const WmiEnum * const wmiEnum) {
+    return wmiEnum->stats.size();
+}
+
+const WmiStats *WmiEnum_statsAt(const WmiEnum * const wmiEnum, const size_t index) {
+    if (index < wmiEnum->stats.size()) {
+        return &wmiEnum->stats[index].stats;
+    }
+    return nullptr;
+}
+
+const char *WmiEnum_statsJson(const WmiEnum * const wmiEnum) {
+    if (!wmiEnum->statsJson) {
+        std::ostringstream oss;
+        oss << '[';
+        bool first = true;
+        for (const auto &entry: wmiEnum->stats) {
+            if (!first) {
+                oss << ',';
+            }
+            first = false;
+            const WmiStats &stats = entry.stats;
+            oss << "{\"className\":";
+            jsonString(oss, entry.className);
+            oss
+                << ",\"createEnumCalls\":" << stats.createEnumCalls
+                << ",\"createEnumTime\":" << stats.createEnumTime
+                << ",\"nextCalls\":" << stats.nextCalls
+                << ",\"nextTime\":" << stats.nextTime
+                << ",\"objects\":" << stats.objects
+                << ",\"properties\":" << stats.properties
+                << ",\"propertyTime\":" << stats.propertyTime
+                << ",\"conversions\":" << stats.conversions
+                << ",\"conversionTime\":" << stats.conversionTime
+                << ",\"regexMatches\":" << stats.regexMatches
+                << ",\"regexTime\":" << stats.regexTime
+                << ",\"totalTime\":" << stats.totalTime
+                << ",\"emptyClassesSkipped\":" << stats.emptyClassesSkipped
+                << ",\"resultCacheHits\":" << stats.resultCacheHits
+                << ",\"bytesSaved\":" << stats.bytesSaved
+                << ",\"callsSaved\":" << stats.callsSaved
+                << ",\"predictedTime\":" << stats.predictedTime
+                << ",\"outlier\":" << (stats.outlier ? "true" : "false")
+                << ",\"breakerState\":" << stats.breakerState
+                << ",\"failed\":" << (stats.failed ? "true" : "false")
+                << ",\"hedged\":" << (stats.hedged ? "true" : "false")
+                << ",\"hedgeWon\":" << (stats.hedgeWon ? "true" : "false")
+                << ",\"batchSizeMin\":" << stats.batchSizeMin
+                << ",\"batchSizeMax\":" << stats.batchSizeMax
+                << ",\"batchSizeLast\":" << stats.batchSizeLast
+                << '}';
+        }
+        oss << ']';
+        wmiEnum->statsJson = oss.str();
+    }
+    return wmiEnum->statsJson->c_str();
+}
+
+WmiOptions *WmiOptions_new() {
+    return new WmiOptions();
+}
+
+void WmiOptions_free(WmiOptions * const options) {
+    delete options;
+}
+
+void WmiOptions_setStats(WmiOptions * const options, const int enabled) {
+    options->stats = enabled;
+}
+
+WmiSession *WmiSession_new() {
+    return new WmiSession();
+}
+
+void WmiSession_free(WmiSession * const session) {
+    delete session;
+}
+
+WmiEnum *WmiSession_enumerate(WmiSession * const session, const wchar_t * const classRegex, const wchar_t * const propertyRegex, const WmiOptions * const options) {
+    return enumerate(classRegex, propertyRegex, options, session);
+}
+
+void WmiSession_setEmptyClassTtl(WmiSession * const session, const uint32_t milliseconds) {
+    std::lock_guard<std::mutex> lock(session->emptyClasses.mutex);
+    session->emptyClasses.ttl = std::chrono::milliseconds(milliseconds);
+    if (milliseconds == 0) {
+        session->emptyClasses.expiries.clear();
+    }
+}
+
+void WmiSession_emptyClassCacheStats(const WmiSession * const session, uint64_t * const hits, uint64_t * const misses) {
+    std::lock_guard<std::mutex> lock(session->emptyClasses.mutex);
+    if (hits) {
+        *hits = session->emptyClasses.hits;
+    }
+    if (misses) {
+        *misses = session->emptyClasses.misses;
+    }
+}
+
+int WmiSession_setResultTtl(WmiSession * const session, const wchar_t * const classRegex, const uint32_t milliseconds) {
+    try {
+        session->results.setRule(classRegex, std::chrono::milliseconds(milliseconds));
+        return 1;
+    } catch (const std::regex_error &) {
+        return 0;
+    }
+}
+
+void WmiSession_resultCacheStats(const WmiSession * const session, uint64_t * const hits, uint64_t * const misses, uint64_t * const bytesSaved, uint64_t * const callsSaved) {
+    std::lock_guard<std::mutex> lock(session->results.mutex);
+    if (hits) {
+        *hits = session->results.hits;
+    }
+    if (misses) {
+        *misses = session->results.misses;
+    }
+    if (bytesSaved) {
+        *bytesSaved = session->results.bytesSaved;
+    }
+    if (callsSaved) {
+        *callsSaved = session->results.callsSaved;
+    }
+}
+
+WmiDiff *WmiEnum_diff(const WmiEnum * const previous, const WmiEnum * const current) {
+    const DiffIndex previousIndex = previous ? DiffIndex(EnumDiffSource(previous)) : DiffIndex();
+    return diff(previous, previousIndex, current, DiffIndex(EnumDiffSource(current)));
+}
+
+WmiEnum *WmiSession_enumerateDiff(WmiSession * const session, const wchar_t * const classRegex, const wchar_t * const propertyRegex, const WmiOptions * const options, WmiDiff ** const diffOutput) {
+    WmiEnum * const output = enumerate(classRegex, propertyRegex, options, session);
+    // A failed poll says nothing about what was removed, so it doesn't become
+    // the new baseline.
+    if (output->error) {
+        *diffOutput = new WmiDiff();
+        return output;
+    }
+
+    std::wstring key(classRegex);
+    key.push_back(L'\0');
+    key.append(propertyRegex);
+
+    DiffIndex index{EnumDiffSource(output)};
+    auto copy = std::make_unique<WmiEnum>();
+    copy->instances = output->instances;
+
+    std::lock_guard<std::mutex> lock(session->diffs.mutex);
+    auto &previous = session->diffs.previous[key];
+    *diffOutput = diff(previous.wmiEnum.get(), previous.index, output, index);
+    previous.wmiEnum = std::move(copy);
+    previous.index = std::move(index);
+    return output;
+}
+
+void WmiDiff_free(WmiDiff * const diff) {
+    delete diff;
+}
+
+size_t WmiDiff_count(const WmiDiff * const diff) {
+    return diff->changes.size();
+}
+
+WmiChange WmiDiff_change(const WmiDiff * const diff, const size_t change) {
+    if (change < diff->changes.size()) {
+        return static_cast<WmiChange>(diff->changes[change].change);
+    }
+    return WMI_UNCHANGED;
+}
+
+const wchar_t *WmiDiff_className(const WmiDiff * const diff, const size_t change) {
+    if (change < diff->changes.size()) {
+        return diff->changes[change].className.c_str();
+    }
+    return nullptr;
+}
+
+const wchar_t *WmiDiff_path(const WmiDiff * const diff, const size_t change) {
+    if (change < diff->changes.size()) {
+        return diff->changes[change].path.c_str();
+    }
+    return nullptr;
+}
+
+size_t WmiDiff_propertyCount(const WmiDiff * const diff, const size_t change) {
+    if (change < diff->changes.size()) {
+        return diff->changes[change].properties.size();
+    }
+    return 0;
+}
+
+const wchar_t *WmiDiff_propertyKey(const WmiDiff * const diff, const size_t change, const size_t property) {
+    if (change < diff->changes.size()) {
+        const auto &c = diff->changes[change];
+        if (property < c.properties.size()) {
+            return std::get<0>(c.properties[property]).c_str();
+        }
+    }
+    return nullptr;
+}
+
+const wchar_t *WmiDiff_propertyValue(const WmiDiff * const diff, const size_t change, const size_t property) {
+    if (change < diff->changes.size()) {
+        const auto &c = diff->changes[change];
+        if (property < c.properties.size()) {
+            const auto &value = std::get<1>(c.properties[property]);
+            if (value) {
+                return value->c_str();
+            }
+        }
+    }
+    return nullptr;
+}
+
+WmiLive *WmiLive_new(const wchar_t * const className, const wchar_t * const propertyRegex, const uint32_t withinSeconds) {
+    WmiLive *output = new WmiLive();
+    try {
+        const std::wregex pRegex(propertyRegex);
+        output->services.emplace();
+        auto &services = *output->services;
+        services.setProxyBlanket();
+
+        // Subscribe before the initial enumeration, so nothing that happens in
+        // between is missed.
+        std::wostringstream query;
+        query
+            << L"SELECT * FROM __InstanceOperationEvent WITHIN " << withinSeconds
+            << L" WHERE TargetInstance ISA '" << className << L"'";
+        output->sink = new LiveSink(output->table, pRegex);
+        _bstr_t language(L"WQL");
+        _bstr_t queryString(query.str().c_str());
+        const HRESULT hres = services.pSvc->ExecNotificationQueryAsync(language.GetBSTR(), queryString.GetBSTR(), WBEM_FLAG_SEND_STATUS, nullptr, output->sink);
+        if (FAILED(hres)) {
+            output->sink->Release();
+            output->sink = nullptr;
+            checkResult(hres, "Could not subscribe to instance events.");
+        }
+
+        // The enumeration is deep, so subclasses come back under their own
+        // names, just as the events name them.
+        _bstr_t bClassName(className);
+        ClassControl control;
+        control.conversion.ownClassName = true;
+        auto result = enumerateClass(services, bClassName.GetBSTR(), className, pRegex, nullptr, control);
+
+        std::vector<std::pair<std::wstring, std::shared_ptr<const WmiInstance>>> seed;
+        seed.reserve(result->instances.size());
+        for (const auto &instance: result->instances) {
+            seed.emplace_back(instance.path, std::shared_ptr<const WmiInstance>(result, &instance));
+        }
+        output->table->seed(seed);
+    } catch (const std::exception &e) {
+        output->error = std::make_optional<std::string>(e.what());
+    }
+    return output;
+}
+
+const char *WmiLive_error(const WmiLive * const live) {
+    if (live->error) {
+        return live->error.value().c_str();
+    }
+    return live->table->error();
+}
+
+void WmiLive_free(WmiLive * const live) {
+    delete live;
+}
+
+WmiEnum *WmiLive_snapshot(const WmiLive * const live) {
+    WmiEnum *output = new WmiEnum();
+    if (const char * const error = WmiLive_error(live)) {
+        output->error = std::make_optional<std::string>(error);
+    }
+    output->instances = live->table->snapshot();
+    // The table is in no particular order, but an enum keeps the instances of
+    // a class together.
+    std::stable_sort(output->instances.begin(), output->instances.end(), [](const auto &a, const auto &b) {
+        return a->className < b->className;
+    });
+    return output;
+}
+
+WmiSampler *WmiSampler_new(const wchar_t * const classRegex, const wchar_t * const propertyRegex) {
+    WmiSampler *output = new WmiSampler();
+    try {
+        const std::wregex cRegex(classRegex), pRegex(propertyRegex);
+        output->services.emplace();
+        auto &services = *output->services;
+        services.setProxyBlanket();
+
+        checkResult(CoCreateInstance(CLSID_WbemRefresher, nullptr, CLSCTX_INPROC_SERVER, IID_IWbemRefresher, reinterpret_cast<void **>(&output->refresher.pointer)),
+                "Could not create refresher.");
+        checkResult(output->refresher->QueryInterface(IID_IWbemConfigureRefresher, reinterpret_cast<void **>(&output->configure.pointer)),
+                "Could not configure refresher.");
+
+        auto enumClasses = EnumWbemClasses::classEnum(services);
+        for (auto items = enumClasses.next(); items; items = enumClasses.next()) {
+            for (auto &item: items.value()) {
+                auto rawClassName = item.get(L"__CLASS").value();
+                auto bClassName = rawClassName.variant.bstrVal;
+                const std::wstring className(bClassName, SysStringLen(bClassName));
+                if (!std::regex_match(className, cRegex)) {
+                    continue;
+                }
+
+                SamplerClass samplerClass;
+                samplerClass.className = className;
+                item.beginEnumeration();
+                std::wstring key;
+                Variant value;
+                while (item.next(key, value)) {
+                    if (!std::regex_match(key, pRegex)) {
+                        continue;
+                    }
+                    CIMTYPE type;
+                    if (FAILED(item.obj->Get(key.c_str(), 0, nullptr, &type, nullptr))) {
+                        continue;
+                    }
+                    switch (type) {
+                        case CIM_UINT32:
+                        case CIM_SINT32:
+                        case CIM_UINT64:
+                        case CIM_SINT64:
+                            samplerClass.keys.push_back(key);
+                            samplerClass.kinds.push_back(sampleKind(type));
+                            break;
+                        default:
+                            break;
+                    }
+                }
+
+                // Only high-performance classes can be added to a refresher,
+                // and anything else is simply not sampled.
+                if (SUCCEEDED(output->configure->AddEnum(services.pSvc, className.c_str(), 0, nullptr, samplerClass.hiPerfEnum, &samplerClass.id))) {
+                    output->classes.push_back(std::move(samplerClass));
+                }
+            }
+        }
+    } catch (const std::exception &e) {
+        output->error = std::make_optional<std::string>(e.what());
+        // A sampler that failed to build can't be refreshed, which keeps its
+        // error from being cleared.
+        output->refresher = ComPointer<IWbemRefresher>();
+    }
+    return output;
+}
+
+const char *WmiSampler_error(const WmiSampler * const sampler) {
+    if (sampler->error) {
+        return sampler->error.value().c_str();
+    }
+    return nullptr;
+}
+
+void WmiSampler_free(WmiSampler * const sampler) {
+    delete sampler;
+}
+
+int WmiSampler_refresh(WmiSampler * const sampler) {
+    if (!sampler->refresher.pointer) {
+        return 0;
+    }
+    try {
+        checkResult(sampler->refresher->Refresh(WBEM_FLAG_REFRESH_AUTO_RECONNECT), "Could not refresh.");
+        for (auto &samplerClass: sampler->classes) {
+            samplerClass.refresh(*samplerClass.hiPerfEnum.pointer);
+        }
+        sampler->error.reset();
+        return 1;
+    } catch (const std::exception &e) {
+        sampler->error = std::make_optional<std::string>(e.what());
+        return 0;
+    }
+}
+
+size_t WmiSampler_classCount(const WmiSampler * const sampler) {
+    return sampler->classes.size();
+}
+
+const wchar_t *WmiSampler_className(const WmiSampler * const sampler, const size_t samplerClass) {
+    if (samplerClass < sampler->classes.size()) {
+        return sampler->classes[samplerClass].className.c_str();
+    }
+    return nullptr;
+}
+
+size_t WmiSampler_propertyCount(const WmiSampler * const sampler, const size_t samplerClass) {
+    if (samplerClass < sampler->classes.size()) {
+        return sampler->classes[samplerClass].keys.size();
+    }
+    return 0;
+}
+
+const wchar_t *WmiSampler_propertyKey(const WmiSampler * const sampler, const size_t samplerClass, const size_t property) {
+    if (samplerClass < sampler->classes.size()) {
+        const auto &c = sampler->classes[samplerClass];
+        if (property < c.keys.size()) {
+            return c.keys[property].c_str();
+        }
+    }
+    return nullptr;
+}
+
+size_t WmiSampler_instanceCount(const WmiSampler * const sampler, const size_t samplerClass) {
+    if (samplerClass < sampler->classes.size()) {
+        return sampler->classes[samplerClass].instanceCount;
+    }
+    return 0;
+}
+
+const wchar_t *WmiSampler_instanceName(const WmiSampler * const sampler, const size_t samplerClass, const size_t instance) {
+    if (samplerClass < sampler->classes.size()) {
+        const auto &c = sampler->classes[samplerClass];
+        if (c.hasName && instance < c.instanceCount) {
+            return c.names[instance].c_str();
+        }
+    }
+    return nullptr;
+}
+
+uint64_t WmiSampler_value(const WmiSampler * const sampler, const size_t samplerClass, const size_t instance, const size_t property) {
+    if (samplerClass < sampler->classes.size()) {
+        const auto &c = sampler->classes[samplerClass];
+        if (instance < c.instanceCount && property < c.keys.size()) {
+            return c.values[instance * c.keys.size() + property];
+        }
+    }
+    return 0;
+}
+
+WmiCooker *WmiCooker_new() {
+    return new WmiCooker();
+}
+
+const char *WmiCooker_error(const WmiCooker * const cooker) {
+    if (cooker->error) {
+        return cooker->error.value().c_str();
+    }
+    return nullptr;
+}
+
+void WmiCooker_free(WmiCooker * const cooker) {
+    delete cooker;
+}
+
+int WmiCooker_setCounterType(WmiCooker * const cooker, const wchar_t * const className, const wchar_t * const property, const uint32_t type) {
+    if (!perfCounterSupported(type)) {
+        return 0;
+    }
+    cooker->counterTypes[className][property] = type;
+    return 1;
+}
+
+int WmiCooker_update(WmiCooker * const cooker, const WmiEnum * const raw) {
+    try {
+        cooker->error.reset();
+        const size_t instanceCount = WmiEnum_instanceCount(raw);
+
+        // Only connect if there is a class whose schema hasn't been seen yet.
+        std::optional<ComLibrary> library;
+        std::optional<ConnectionPool::Lease> services;
+        for (size_t instance = 0; instance < instanceCount; ++instance) {
+            const std::wstring className(orEmpty(WmiEnum_instanceClassName(raw, instance)));
+            if (cooker->counterTypes.find(className) == cooker->counterTypes.end()) {
+                if (!services) {
+                    library.emplace();
+                    services.emplace(ConnectionPools::instance().get().checkout());
+                }
+                cooker->loadCounterTypes(**services, className);
+            }
+        }
+
+        std::unordered_map<std::wstring, std::unordered_map<std::wstring, uint64_t>> current;
+        current.reserve(instanceCount);
+        std::vector<CookedInstance> instances;
+        instances.reserve(instanceCount);
+
+        const EnumDiffSource rawSource(raw);
+        for (size_t instance = 0; instance < instanceCount; ++instance) {
+            const std::wstring className(orEmpty(WmiEnum_instanceClassName(raw, instance)));
+            const auto &types = cooker->counterTypes[className];
+            if (types.empty()) {
+                continue;
+            }
+
+            auto &values = current[instanceIdentity(rawSource, instance, 0)];
+            const size_t propertyCount = WmiEnum_instancePropertyCount(raw, instance);
+            for (size_t property = 0; property < propertyCount; ++property) {
+                std::wstring key(orEmpty(WmiEnum_instancePropertyKey(raw, instance, property)));
+                const uint64_t value = cooker->parseRaw(className, key, orEmpty(WmiEnum_instancePropertyValue(raw, instance, property)));
+                values.emplace(std::move(key), value);
+            }
+
+            const auto previous = cooker->previous.find(instanceIdentity(rawSource, instance, 0));
+            const auto get = [](const std::unordered_map<std::wstring, uint64_t> &map, const std::wstring &key) -> uint64_t {
+                const auto it = map.find(key);
+                return it == map.end() ? 0 : it->second;
+            };
+            const auto sample = [&get](const std::unordered_map<std::wstring, uint64_t> &map, const std::wstring &key) {
+                PerfRawSample output;
+                output.value = get(map, key);
+                output.base = get(map, key + L"_Base");
+                output.perfTime = get(map, L"Timestamp_PerfTime");
+                output.perfFrequency = get(map, L"Frequency_PerfTime");
+                output.sys100NsTime = get(map, L"Timestamp_Sys100NS");
+                output.sys100NsFrequency = get(map, L"Frequency_Sys100NS");
+                output.objectTime = get(map, L"Timestamp_Object");
+                output.objectFrequency = get(map, L"Frequency_Object");
+                return output;
+            };
+
+            CookedInstance cooked;
+            cooked.className = className;
+            cooked.path = orEmpty(WmiEnum_instancePath(raw, instance));
+            // Iterate the raw properties rather than the types, so the cooked
+            // values come out in the same order as the raw ones.
+            for (size_t property = 0; property < propertyCount; ++property) {
+                const std::wstring key(orEmpty(WmiEnum_instancePropertyKey(raw, instance, property)));
+                const auto type = types.find(key);
+                if (type == types.end()) {
+                    continue;
+                }
+                if (perfCounterNeedsPrevious(type->second) && (previous == cooker->previous.end() || previous->second.find(key) == previous->second.end())) {
+                    continue;
+                }
+                const PerfRawSample currentSample = sample(values, key);
+                const PerfRawSample previousSample = previous == cooker->previous.end() ? PerfRawSample() : sample(previous->second, key);
+                if (const auto value = perfCounterCook(type->second, previousSample, currentSample)) {
+                    cooked.values.emplace_back(key, *value);
+                }
+            }
+            instances.push_back(std::move(cooked));
+        }
+
+        cooker->previous = std::move(current);
+        cooker->instances = std::move(instances);
+        return 1;
+    } catch (const std::exception &e) {
+        cooker->error = std::make_optional<std::string>(e.what());
+        return 0;
+    }
+}
+
+size_t WmiCooker_instanceCount(const WmiCooker * const cooker) {
+    return cooker->instances.size();
+}
+
+const wchar_t *WmiCooker_instanceClassName(const WmiCooker * const cooker, const size_t instance) {
+    if (instance < cooker->instances.size()) {
+        return cooker->instances[instance].className.c_str();
+    }
+    return nullptr;
+}
+
+const wchar_t *WmiCooker_instancePath(const WmiCooker * const cooker, const size_t instance) {
+    if (instance < cooker->instances.size()) {
+        return cooker->instances[instance].path.c_str();
+    }
+    return nullptr;
+}
+
+size_t WmiCooker_instancePropertyCount(const WmiCooker * const cooker, const size_t instance) {
+    if (instance < cooker->instances.size()) {
+        return cooker->instances[instance].values.size();
+    }
+    return 0;
+}
+
+const wchar_t *WmiCooker_instancePropertyKey(const WmiCooker * const cooker, const size_t instance, const size_t property) {
+    if (instance < cooker->instances.size()) {
+        const auto &i = cooker->instances[instance];
+        if (property < i.values.size()) {
+            return std::get<0>(i.values[property]).c_str();
+        }
+    }
+    return nullptr;
+}
+
+double WmiCooker_instancePropertyValue(const WmiCooker * const cooker, const size_t instance, const size_t property) {
+    if (instance < cooker->instances.size()) {
+        const auto &i = cooker->instances[instance];
+        if (property < i.values.size()) {
+            return std::get<1>(i.values[property]);
+        }
+    }
+    return 0.0;
+}
+
+WmiScheduler *WmiScheduler_new(WmiSession * const session) {
+    return new WmiScheduler(session);
+}
+
+void WmiScheduler_free(WmiScheduler * const scheduler) {
+    delete scheduler;
+}
+
+size_t WmiScheduler_addJob(WmiScheduler * const scheduler, const wchar_t * const classRegex, const wchar_t * const propertyRegex, const uint32_t intervalMilliseconds, const WmiSchedulerCallback callback, void * const userData) {
+    if (intervalMilliseconds == 0 || !callback) {
+        return 0;
+    }
+    try {
+        size_t id;
+        {
+            std::lock_guard<std::mutex> lock(scheduler->mutex);
+            id = scheduler->schedule.add(classRegex, propertyRegex, std::chrono::milliseconds(intervalMilliseconds), WmiScheduler::Clock::now());
+            scheduler->deliveries.emplace(id, SchedulerDelivery{callback, userData});
+        }
+        scheduler->wake.notify_all();
+        return id;
+    } catch (const std::regex_error &) {
+        return 0;
+    }
+}
+
+int WmiScheduler_removeJob(WmiScheduler * const scheduler, const size_t job) {
+    std::lock_guard<std::mutex> lock(scheduler->mutex);
+    if (!scheduler->schedule.remove(job)) {
+        return 0;
+    }
+    scheduler->deliveries.erase(job);
+    return 1;
+}
+
+void WmiScheduler_setCoalesceWindow(WmiScheduler * const scheduler, const uint32_t milliseconds) {
+    std::lock_guard<std::mutex> lock(scheduler->mutex);
+    scheduler->schedule.window = std::chrono::milliseconds(milliseconds);
+}
+
+void WmiScheduler_setJitter(WmiScheduler * const scheduler, const uint32_t milliseconds) {
+    std::lock_guard<std::mutex> lock(scheduler->mutex);
+    scheduler->schedule.jitter = std::chrono::milliseconds(milliseconds);
+}
+
+void WmiScheduler_stats(WmiScheduler * const scheduler, uint64_t * const passes, uint64_t * const jobRuns, uint64_t * const classRequests, uint64_t * const classFetches) {
+    std::lock_guard<std::mutex> lock(scheduler->mutex);
+    if (passes) {
+        *passes = scheduler->passes;
+    }
+    if (jobRuns) {
+        *jobRuns = scheduler->jobRuns;
+    }
+    if (classRequests) {
+        *classRequests = scheduler->classRequests;
+    }
+    if (classFetches) {
+        *classFetches = scheduler->classFetches;
+    }
+}
+
+void WmiOptions_setWorkers(WmiOptions * const options, const unsigned workers) {
+    options->workers = std::max(1u, workers);
+}
+
+void WmiOptions_setConverters(WmiOptions * const options, const unsigned converters) {
+    options->converters = converters;
+}
+
+void WmiOptions_setPrefetch(WmiOptions * const options, const unsigned depth) {
+    options->prefetch = depth;
+}
+
+void WmiOptions_setBatchSize(WmiOptions * const options, const uint32_t minimum, const uint32_t maximum, const uint32_t targetMilliseconds) {
+    options->batches.configure(minimum, maximum, std::chrono::milliseconds(targetMilliseconds));
+}
+
+void WmiOptions_setAdoptStrings(WmiOptions * const options, const int adopt) {
+    options->conversion.adoptStrings = adopt;
+}
+
+void WmiOptions_setInvariantFormat(WmiOptions * const options, const int invariant) {
+    options->conversion.invariantFormat = invariant;
+}
+
+void WmiOptions_setProgress(WmiOptions * const options, const WmiProgressCallback callback, void * const userData, const uint32_t intervalMilliseconds) {
+    options->progress = callback;
+    options->progressUserData = userData;
+    options->progressInterval = std::chrono::milliseconds(intervalMilliseconds);
+}
+
+WmiCancel *WmiCancel_new() {
+    return new WmiCancel();
+}
+
+void WmiCancel_free(WmiCancel * const cancel) {
+    delete cancel;
+}
+
+void WmiCancel_signal(WmiCancel * const cancel) {
+    cancel->signalled = true;
+}
+
+void WmiCancel_reset(WmiCancel * const cancel) {
+    cancel->signalled = false;
+}
+
+int WmiCancel_signalled(const WmiCancel * const cancel) {
+    return cancel->signalled;
+}
+
+void WmiOptions_setCancel(WmiOptions * const options, const WmiCancel * const cancel) {
+    options->cancel = cancel;
+}
+
+uint64_t WmiSession_predictedTime(const WmiSession * const session, const wchar_t * const className) {
+    return session->costs.predict(className);
+}
+
+int WmiSession_saveCostModel(const WmiSession * const session, const wchar_t * const path) {
+    try {
+        const std::string data = session->costs.save();
+        writeFileAtomically(path, {{data.data(), data.size()}});
+        return 1;
+    } catch (const std::exception &) {
+        return 0;
+    }
+}
+
+int WmiSession_loadCostModel(WmiSession * const session, const wchar_t * const path) {
+    try {
+        session->costs.load(readFile(path));
+        return 1;
+    } catch (const std::exception &) {
+        return 0;
+    }
+}
+
+void WmiSession_setCircuitBreaker(WmiSession * const session, const uint32_t failures, const uint32_t timeoutMilliseconds, const uint32_t backoffMilliseconds, const uint32_t maxBackoffMilliseconds) {
+    auto &breakers = session->breakers;
+    std::lock_guard<std::mutex> lock(breakers.mutex);
+    breakers.threshold = failures;
+    breakers.timeout = std::chrono::milliseconds(timeoutMilliseconds);
+    breakers.backoff = std::chrono::milliseconds(std::max<uint32_t>(1, backoffMilliseconds));
+    breakers.maxBackoff = std::chrono::milliseconds(std::max(backoffMilliseconds, maxBackoffMilliseconds));
+    if (failures == 0) {
+        breakers.breakers.clear();
+    }
+}
+
+WmiBreakerState WmiSession_circuitBreakerState(const WmiSession * const session, const wchar_t * const className) {
+    return static_cast<WmiBreakerState>(session->breakers.state(className, std::chrono::steady_clock::now()));
+}
+
+int WmiSession_setHedgeClasses(WmiSession * const session, const wchar_t * const classRegex) {
+    std::optional<std::wregex> regex;
+    if (classRegex && *classRegex) {
+        try {
+            regex.emplace(classRegex);
+        } catch (const std::regex_error &) {
+            return 0;
+        }
+    }
+    std::lock_guard<std::mutex> lock(session->hedging.mutex);
+    session->hedging.classRegex = std::move(regex);
+    return 1;
+}
+
+void WmiSession_hedgeStats(const WmiSession * const session, uint64_t * const eligible, uint64_t * const hedges, uint64_t * const wins) {
+    std::lock_guard<std::mutex> lock(session->hedging.mutex);
+    if (eligible) {
+        *eligible = session->hedging.eligible;
+    }
+    if (hedges) {
+        *hedges = session->hedging.hedges;
+    }
+    if (wins) {
+        *wins = session->hedging.wins;
+    }
+}
+
+void WmiPool_setMaxSize(const unsigned maxSize) {
+    auto &pools = ConnectionPools::instance();
+    std::lock_guard<std::mutex> lock(pools.mutex);
+    pools.maxSize = std::max(1u, maxSize);
+    for (auto &entry: pools.pools) {
+        auto &pool = *entry.second;
+        {
+            std::lock_guard<std::mutex> poolLock(pool.mutex);
+            pool.maxSize = pools.maxSize;
+        }
+        pool.available.notify_all();
+    }
+}
+
+void WmiPool_clear() {
+    auto &pools = ConnectionPools::instance();
+    std::lock_guard<std::mutex> lock(pools.mutex);
+    for (auto &entry: pools.pools) {
+        entry.second->clear();
+    }
+}
+
+void WmiPool_stats(uint64_t * const open, uint64_t * const created, uint64_t * const reused, uint64_t * const discarded) {
+    uint64_t totals[4] = {};
+    auto &pools = ConnectionPools::instance();
+    std::lock_guard<std::mutex> lock(pools.mutex);
+    for (auto &entry: pools.pools) {
+        auto &pool = *entry.second;
+        std::lock_guard<std::mutex> poolLock(pool.mutex);
+        totals[0] += pool.open;
+        totals[1] += pool.created;
+        totals[2] += pool.reused;
+        totals[3] += pool.discarded;
+    }
+    uint64_t * const outputs[4] = {open, created, reused, discarded};
+    for (size_t i = 0; i < 4; ++i) {
+        if (outputs[i]) {
+            *outputs[i] = totals[i];
+        }
+    }
+}
+
+WmiAsync *WmiAsync_start(const wchar_t * const classRegex, const wchar_t * const propertyRegex, const WmiOptions * const options, const WmiAsyncCallback callback, void * const userData) {
+    static const WmiOptions defaultOptions;
+    return new WmiAsync(classRegex, propertyRegex, options ? *options : defaultOptions, callback, userData);
+}
+
+void WmiAsync_free(WmiAsync * const async) {
+    delete async;
+}
+
+void WmiAsync_cancel(WmiAsync * const async) {
+    async->cancel();
+}
+
+int WmiAsync_wait(WmiAsync * const async, const uint32_t milliseconds) {
+    std::unique_lock<std::mutex> lock(async->mutex);
+    const auto isDone = [async]() { return async->done; };
+    if (milliseconds == UINT32_MAX) {
+        async->finished.wait(lock, isDone);
+        return 1;
+    }
+    return async->finished.wait_for(lock, std::chrono::milliseconds(milliseconds), isDone);
+}
+
+WmiEnum *WmiAsync_take(WmiAsync * const async) {
+    std::lock_guard<std::mutex> lock(async->mutex);
+    return async->result.release();
 }
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 #include <windows.h>
 
 #ifdef __cplusplus
@@ -16,10 +17,250 @@ extern "C" {
 #define WMIENUMALL_API extern WINAPI __declspec(dllimport)
 #endif
     struct WmiEnum;
+    struct WmiOptions;
+    struct WmiCancel;
+    struct WmiAsync;
+    struct WmiSession;
+    struct WmiDiff;
+    struct WmiLive;
+    struct WmiSampler;
+    struct WmiCooker;
+    struct WmiScheduler;
+
+    struct WmiProgress;
+
+    /** Called with progress through an enumeration.  progress is only valid
+     * during the call.
+     */
+    typedef void (*WmiProgressCallback)(const WmiProgress *progress, void *userData);
+
+    /** Called with the result of an async enumeration, on its thread.  The
+     * callback owns the WmiEnum, and must free it with WmiEnum_free.
+     */
+    typedef void (*WmiAsyncCallback)(WmiEnum *wmiEnum, void *userData);
+
+    /** Called with the results of a scheduled job.  The callback owns the
+     * WmiEnum, and must free it with WmiEnum_free.
+     */
+    typedef void (*WmiSchedulerCallback)(WmiEnum *wmiEnum, void *userData);
+
+    /// The kind of change to an instance in a WmiDiff.
+    enum WmiChange {
+        WMI_UNCHANGED = 0,
+        WMI_ADDED = 1,
+        WMI_REMOVED = 2,
+        WMI_MODIFIED = 3
+    };
+
+    /// What a property's CIM_DATETIME value holds.
+    enum WmiDatetime {
+        /// Not a CIM_DATETIME, or not parseable, such as with wildcard fields.
+        WMI_DATETIME_NONE = 0,
+        /// A point in time, in microseconds since the UNIX epoch in UTC.
+        WMI_DATETIME_TIMESTAMP = 1,
+        /// A duration, in microseconds.
+        WMI_DATETIME_INTERVAL = 2
+    };
+
+    /// The state of a class's circuit breaker in a session.
+    enum WmiBreakerState {
+        /// Enumerated normally.
+        WMI_BREAKER_CLOSED = 0,
+        /// Quarantined after failing, and skipped.
+        WMI_BREAKER_OPEN = 1,
+        /// Done with its backoff, and enumerated once as a probe.
+        WMI_BREAKER_HALF_OPEN = 2
+    };
+
+    /** Timings and counters for a single class, collected when stats are
+     * enabled in the options.  All times are in nanoseconds.
+     */
+    struct WmiStats {
+        /// The class name, or an empty string for the class enumeration itself.
+        const wchar_t *className;
+
+        /// CreateClassEnum or CreateInstanceEnum calls.
+        uint64_t createEnumCalls;
+        uint64_t createEnumTime;
+
+        /// Batched IEnumWbemClassObject::Next calls.
+        uint64_t nextCalls;
+        uint64_t nextTime;
+
+        /// Instances (or classes, for the class enumeration) returned.
+        uint64_t objects;
+
+        /// Properties iterated with IWbemClassObject::Next, and the time spent
+        /// doing so.
+        uint64_t properties;
+        uint64_t propertyTime;
+
+        /// Values converted to strings, and the time spent converting.
+        uint64_t conversions;
+        uint64_t conversionTime;
+
+        /// Regex matches against class or property names.
+        uint64_t regexMatches;
+        uint64_t regexTime;
+
+        /// Wall time from the start to the end of the whole class.
+        uint64_t totalTime;
+
+        /// Matched classes skipped because the session knows they are empty.
+        /// Only set on the class enumeration entry.
+        uint64_t emptyClassesSkipped;
+
+        /// 1 if the class was served from the session's result cache, along
+        /// with the approximate bytes and COM calls that this saved.
+        uint64_t resultCacheHits;
+        uint64_t bytesSaved;
+        uint64_t callsSaved;
+
+        /// The session's predicted time for the class before it was
+        /// enumerated, or 0 if it had never been seen.
+        uint64_t predictedTime;
+
+        /// Nonzero if the enumeration took far longer than the session's
+        /// model expected.
+        int outlier;
+
+        /// The state of the class's circuit breaker when it was reached, as a
+        /// WmiBreakerState.  An open class was skipped.
+        int breakerState;
+
+        /// Nonzero if the class failed or timed out, and the failure was
+        /// recorded by the session's circuit breaker instead of failing the
+        /// whole enumeration.
+        int failed;
+
+        /// Nonzero if the class ran past its learned 95th percentile latency
+        /// and a hedge enumeration was started, and if the hedge finished
+        /// first and its result was used.
+        int hedged;
+        int hedgeWon;
+
+        /// The smallest, largest, and last batch sizes asked of Next.
+        uint64_t batchSizeMin;
+        uint64_t batchSizeMax;
+        uint64_t batchSizeLast;
+    };
+
+    /** Progress through an enumeration, so far.
+     */
+    struct WmiProgress {
+        /// Classes seen in the class enumeration, and how many of them matched.
+        uint64_t classesScanned;
+        uint64_t classesMatched;
+
+        /// Matched classes which are finished.
+        uint64_t classesCompleted;
+
+        /// Instances, properties, and approximate bytes stored.
+        uint64_t instances;
+        uint64_t properties;
+        uint64_t bytes;
+
+        /// The class most recently started, or empty before the first.
+        const wchar_t *currentClass;
+    };
 
     /// Always returns a WmiEnum, even in the case of error.
     WMIENUMALL_API WmiEnum *WmiEnum_new(const wchar_t *classRegex, const wchar_t *propertyRegex);
 
+    /** Like WmiEnum_new, but with options.  options may be NULL, in which case
+     * this behaves exactly like WmiEnum_new.  The options are not retained
+     * after this call returns.
+     */
+    WMIENUMALL_API WmiEnum *WmiEnum_newEx(const wchar_t *classRegex, const wchar_t *propertyRegex, const WmiOptions *options);
+
+    /// Create a new set of options, with everything disabled.
+    WMIENUMALL_API WmiOptions *WmiOptions_new();
+
+    /// Free a set of options.
+    WMIENUMALL_API void WmiOptions_free(WmiOptions *options);
+
+    /** Enable or disable stats collection.  When disabled, the timers cost no
+     * more than a branch each.
+     */
+    WMIENUMALL_API void WmiOptions_setStats(WmiOptions *options, int enabled);
+
+    /** Set the number of worker threads which enumerate classes in parallel,
+     * each with its own connection.  The default is 1, which enumerates on the
+     * calling thread.  Instances still come out in class enumeration order.
+     * With a session, a single worker takes the cheapest classes first, and
+     * several workers take the most expensive first.
+     */
+    WMIENUMALL_API void WmiOptions_setWorkers(WmiOptions *options, unsigned workers);
+
+    /** Set the number of converter threads.  They are started once per
+     * enumeration and shared by every class and worker.  With any, the thread
+     * fetching a class only fetches, and hands each raw batch to the
+     * converters through a bounded queue, so provider latency and conversion
+     * overlap.  Instances still come out in order.  The default is 0, which
+     * converts on the fetching thread.
+     */
+    WMIENUMALL_API void WmiOptions_setConverters(WmiOptions *options, unsigned converters);
+
+    /** Set how many batches of each class are fetched ahead on a background
+     * thread, so that the provider works on the next batch while the current
+     * one is converted.  1 is double buffering.  The default is 0, which only
+     * fetches a batch when it is needed.
+     */
+    WMIENUMALL_API void WmiOptions_setPrefetch(WmiOptions *options, unsigned depth);
+
+    /** Make the number of instances asked of each Next call adaptive.  It
+     * starts at 128 clamped to the bounds, grows while the time per instance
+     * keeps falling, and halves whenever a call takes longer than the target.
+     * With a cancel token or prefetching, calls only wait a short while, and a
+     * batch that isn't filled in time halves the size if its objects arrived
+     * too slowly to fill it within the target.  Both bounds are clamped to 1
+     * to 4096.  The default is a fixed 128.
+     */
+    WMIENUMALL_API void WmiOptions_setBatchSize(WmiOptions *options, uint32_t minimum, uint32_t maximum, uint32_t targetMilliseconds);
+
+    /** Keep scalar string values as the BSTRs WMI returned them in, rather
+     * than copying them, which matters for large values.  The pointers from
+     * WmiEnum_instancePropertyValue are then those BSTRs, and are freed by
+     * WmiEnum_free.  Off by default.
+     */
+    WMIENUMALL_API void WmiOptions_setAdoptStrings(WmiOptions *options, int adopt);
+
+    /** Format numbers and booleans the same way regardless of the thread
+     * locale: integers in plain decimal, floating point values as the
+     * shortest text that reads back exactly, and booleans as True or False.
+     * Off by default, which formats through VariantChangeType.
+     */
+    WMIENUMALL_API void WmiOptions_setInvariantFormat(WmiOptions *options, int invariant);
+
+    /** Report progress through callback, at batch granularity but at most
+     * once per interval, and once more at the end.  With several workers it
+     * may be called from any of their threads, but never concurrently.  A NULL
+     * callback, the default, disables it.
+     */
+    WMIENUMALL_API void WmiOptions_setProgress(WmiOptions *options, WmiProgressCallback callback, void *userData, uint32_t intervalMilliseconds);
+
+    /** A cancel token, which stops enumerations using it once signalled from
+     * any thread.  Classes are abandoned within about 50 milliseconds, and the
+     * cancelled WmiEnum gets an error along with what it had already fetched.
+     */
+    WMIENUMALL_API WmiCancel *WmiCancel_new(void);
+    WMIENUMALL_API void WmiCancel_free(WmiCancel *cancel);
+
+    /// Signal the token.  Safe to call from any thread.
+    WMIENUMALL_API void WmiCancel_signal(WmiCancel *cancel);
+
+    /// Clear the token, so that it may be used again.
+    WMIENUMALL_API void WmiCancel_reset(WmiCancel *cancel);
+
+    /// Returns nonzero if the token has been signalled.
+    WMIENUMALL_API int WmiCancel_signalled(const WmiCancel *cancel);
+
+    /** Make enumerations with these options stop when cancel is signalled.
+     * The token must outlive those enumerations.  NULL, the default, removes
+     * it.
+     */
+    WMIENUMALL_API void WmiOptions_setCancel(WmiOptions *options, const WmiCancel *cancel);
+
     /// Returns null if no error.  This is how error is checked for.
     WMIENUMALL_API const char *WmiEnum_error(const WmiEnum *wmiEnum);
 
@@ -36,6 +277,38 @@ extern "C" {
      */
     WMIENUMALL_API const wchar_t *WmiEnum_instanceClassName(const WmiEnum *wmiEnum, size_t instance);
 
+    /** Get the number of distinct classes, used for iterating.  The instances
+     * of each class are always next to each other.
+     */
+    WMIENUMALL_API size_t WmiEnum_classCount(const WmiEnum *wmiEnum);
+
+    /** Get a class's name based on its index.
+     * Returns NULL on bad index.
+     */
+    WMIENUMALL_API const wchar_t *WmiEnum_className(const WmiEnum *wmiEnum, size_t classIndex);
+
+    /** Get the instances of a class, by case-insensitive name, as the
+     * half-open range of instance indices [begin, end).  The lookup is by
+     * hash, so this doesn't scan the instances.  Returns zero if the enum has
+     * no instances of the class.
+     */
+    WMIENUMALL_API int WmiEnum_classInstanceRange(const WmiEnum *wmiEnum, const wchar_t *className, size_t *begin, size_t *end);
+
+    /** Resolve a property's case-insensitive key to the property index it
+     * has in every instance of a class, to be passed straight to the other
+     * property accessors.  Each class's keys are indexed once, on first use.
+     * Returns SIZE_MAX if the class or the property isn't there, or if the
+     * class's instances don't all share one layout, in which case
+     * WmiEnum_instancePropertyIndex still works per instance.
+     */
+    WMIENUMALL_API size_t WmiEnum_resolveKey(const WmiEnum *wmiEnum, const wchar_t *className, const wchar_t *key);
+
+    /** Get an instance's __RELPATH based on its index, which identifies it
+     * within its class.  This is an empty string for classes with no path.
+     * Returns NULL on bad index.
+     */
+    WMIENUMALL_API const wchar_t *WmiEnum_instancePath(const WmiEnum *wmiEnum, size_t instance);
+
     /** Get an instance's property count based on its index.
      * Returns 0 on bad index.
      */
@@ -46,10 +319,441 @@ extern "C" {
      */
     WMIENUMALL_API const wchar_t *WmiEnum_instancePropertyKey(const WmiEnum *wmiEnum, size_t instance, size_t property);
 
+    /** Get the index of an instance's property by its case-insensitive key,
+     * through its class's key index rather than by scanning the keys.
+     * Returns SIZE_MAX on bad index or if the instance has no such property.
+     */
+    WMIENUMALL_API size_t WmiEnum_instancePropertyIndex(const WmiEnum *wmiEnum, size_t instance, const wchar_t *key);
+
     /** Get an instance's property's value based on its index.
      * Returns NULL on bad index.
      */
     WMIENUMALL_API const wchar_t *WmiEnum_instancePropertyValue(const WmiEnum *wmiEnum, size_t instance, size_t property);
+
+    /** Get an instance's CIM_DATETIME property's value, parsed when it was
+     * fetched, into microseconds.  Returns which form it is in, setting
+     * microseconds unless it is WMI_DATETIME_NONE.  Snapshots don't keep
+     * parsed values, so these always give WMI_DATETIME_NONE.
+     */
+    WMIENUMALL_API WmiDatetime WmiEnum_instancePropertyDatetime(const WmiEnum *wmiEnum, size_t instance, size_t property, int64_t *microseconds);
+
+    /** Save the WmiEnum to a snapshot file, which can be loaded with
+     * WmiEnum_load.  The file is written next to path and then moved over it,
+     * so a reader never sees a partial snapshot.  A snapshot which is
+     * currently loaded can't be replaced, so save to a different path or free
+     * it first.
+     * Returns 0 on failure, nonzero otherwise.
+     */
+    WMIENUMALL_API int WmiEnum_save(const WmiEnum *wmiEnum, const wchar_t *path);
+
+    /** Load a snapshot saved by WmiEnum_save.  The file is memory-mapped, and
+     * all of the accessors are served directly from the mapping, so loading
+     * costs the same regardless of snapshot size.  The snapshot keeps a table
+     * of its classes, so the class accessors don't read every instance
+     * either.  This is meant for serving the last known results at startup
+     * while a fresh WmiEnum_new runs on another thread.  Snapshots saved by
+     * earlier versions can't be loaded.
+     * Always returns a WmiEnum, even in the case of error.  A loaded WmiEnum
+     * has no stats.
+     */
+    WMIENUMALL_API WmiEnum *WmiEnum_load(const wchar_t *path);
+
+    /** Get the number of stats entries.  This is 0 if stats were not enabled,
+     * otherwise one for the class enumeration plus one per matched class.
+     */
+    WMIENUMALL_API size_t WmiEnum_statsCount(const WmiEnum *wmiEnum);
+
+    /** Get a stats entry by index.  The first entry is always the class
+     * enumeration itself.
+     * Returns NULL on bad index.
+     */
+    WMIENUMALL_API const WmiStats *WmiEnum_statsAt(const WmiEnum *wmiEnum, size_t index);
+
+    /** Get all stats as a JSON array of objects, one per entry, encoded in
+     * UTF-8.  The string is owned by the WmiEnum.
+     */
+    WMIENUMALL_API const char *WmiEnum_statsJson(const WmiEnum *wmiEnum);
+
+    /** Create a new session, which carries caches and other state between
+     * polls.  A session may be shared between threads.
+     */
+    WMIENUMALL_API WmiSession *WmiSession_new();
+
+    /// Free a session.  No enumeration may be running on it.
+    WMIENUMALL_API void WmiSession_free(WmiSession *session);
+
+    /** Like WmiEnum_newEx, but using and updating the session's state.
+     * Always returns a WmiEnum, even in the case of error.
+     */
+    WMIENUMALL_API WmiEnum *WmiSession_enumerate(WmiSession *session, const wchar_t *classRegex, const wchar_t *propertyRegex, const WmiOptions *options);
+
+    /** Set how long a class that returned no instances is skipped for before
+     * it is enumerated again.  0, the default, disables the cache.
+     */
+    WMIENUMALL_API void WmiSession_setEmptyClassTtl(WmiSession *session, uint32_t milliseconds);
+
+    /** Get the empty class cache hit and miss counts over the lifetime of the
+     * session.  Either pointer may be NULL.
+     */
+    WMIENUMALL_API void WmiSession_emptyClassCacheStats(const WmiSession *session, uint64_t *hits, uint64_t *misses);
+
+    /** Cache the results of classes matching classRegex for the given time,
+     * for classes that don't change between polls.  If several rules match a
+     * class, the most recently set one wins.  Setting a rule again for the
+     * same classRegex replaces it, and 0 turns caching off for the matching
+     * classes.  Results are cached per property regex, string
+     * adoption setting, and format setting, and are shared with the returned
+     * WmiEnums rather than copied.  Setting a rule drops all
+     * cached results.
+     * Returns 0 if classRegex is not a valid regex, nonzero otherwise.
+     */
+    WMIENUMALL_API int WmiSession_setResultTtl(WmiSession *session, const wchar_t *classRegex, uint32_t milliseconds);
+
+    /** Get the result cache counters over the lifetime of the session.  Any
+     * pointer may be NULL.
+     */
+    WMIENUMALL_API void WmiSession_resultCacheStats(const WmiSession *session, uint64_t *hits, uint64_t *misses, uint64_t *bytesSaved, uint64_t *callsSaved);
+
+    /** Get the session's predicted enumeration time of a class in nanoseconds,
+     * learned as a moving average over its polls, or 0 if it has never been
+     * seen.
+     */
+    WMIENUMALL_API uint64_t WmiSession_predictedTime(const WmiSession *session, const wchar_t *className);
+
+    /** Save the session's cost model, so that a restarted process can start
+     * with it.
+     * Returns 0 on failure, nonzero otherwise.
+     */
+    WMIENUMALL_API int WmiSession_saveCostModel(const WmiSession *session, const wchar_t *path);
+
+    /** Replace the session's cost model with one saved by
+     * WmiSession_saveCostModel.
+     * Returns 0 on failure, nonzero otherwise.
+     */
+    WMIENUMALL_API int WmiSession_loadCostModel(WmiSession *session, const wchar_t *path);
+
+    /** Enable per-class circuit breakers in the session.  After failures
+     * consecutive failures or timeouts, a class is skipped for the backoff,
+     * which doubles each time the class trips again up to maxBackoff.  Once
+     * the backoff is over, a single enumeration is let through as a probe,
+     * which closes the breaker if it succeeds or reopens it if it fails.
+     *
+     * While enabled, a failing class no longer fails the whole enumeration;
+     * it is left out, and marked in its stats.  A nonzero timeout fails any
+     * class which takes longer than that to enumerate.  failures of 0, the
+     * default, disables the breakers and resets their state.
+     */
+    WMIENUMALL_API void WmiSession_setCircuitBreaker(WmiSession *session, uint32_t failures, uint32_t timeoutMilliseconds, uint32_t backoffMilliseconds, uint32_t maxBackoffMilliseconds);
+
+    /// Get the current state of a class's circuit breaker.
+    WMIENUMALL_API WmiBreakerState WmiSession_circuitBreakerState(const WmiSession *session, const wchar_t *className);
+
+    /** Hedge the classes matching classRegex.  Once the session has learned a
+     * class's latency, an enumeration of it which runs past its 95th
+     * percentile starts a duplicate enumeration on another connection, and
+     * whichever finishes first is used.  NULL or an empty regex, the default,
+     * disables hedging.
+     * Returns 0 if the regex is invalid, nonzero otherwise.
+     */
+    WMIENUMALL_API int WmiSession_setHedgeClasses(WmiSession *session, const wchar_t *classRegex);
+
+    /** Get the number of hedgeable enumerations, how many of them were hedged,
+     * and how many of those the hedge won, over the lifetime of the session.
+     * Any pointer may be NULL.
+     */
+    WMIENUMALL_API void WmiSession_hedgeStats(const WmiSession *session, uint64_t *eligible, uint64_t *hedges, uint64_t *wins);
+
+    /** Compute the changes from previous to current.  Instances are matched by
+     * class name and __RELPATH, and compared by a hash of their properties
+     * first, so unchanged instances are cheap.  Instances with no path are only
+     * matched when identical.  previous may be NULL, in which case every
+     * instance is added.  The diff copies what it needs, so both enums may be
+     * freed independently of it.
+     */
+    WMIENUMALL_API WmiDiff *WmiEnum_diff(const WmiEnum *previous, const WmiEnum *current);
+
+    /** Like WmiSession_enumerate, but also sets *diff to the changes since the
+     * last call with the same regexes on this session.  The first call reports
+     * every instance as added.  A poll which fails is not used as the baseline
+     * for the next one, and gets an empty diff.  The diff must be freed with
+     * WmiDiff_free.
+     */
+    WMIENUMALL_API WmiEnum *WmiSession_enumerateDiff(WmiSession *session, const wchar_t *classRegex, const wchar_t *propertyRegex, const WmiOptions *options, WmiDiff **diff);
+
+    /// Free a diff.
+    WMIENUMALL_API void WmiDiff_free(WmiDiff *diff);
+
+    /// Get the number of changed instances.
+    WMIENUMALL_API size_t WmiDiff_count(const WmiDiff *diff);
+
+    /** Get the kind of a change.
+     * Returns WMI_UNCHANGED on bad index.
+     */
+    WMIENUMALL_API WmiChange WmiDiff_change(const WmiDiff *diff, size_t change);
+
+    /** Get the class name of a changed instance.
+     * Returns NULL on bad index.
+     */
+    WMIENUMALL_API const wchar_t *WmiDiff_className(const WmiDiff *diff, size_t change);
+
+    /** Get the __RELPATH of a changed instance.
+     * Returns NULL on bad index.
+     */
+    WMIENUMALL_API const wchar_t *WmiDiff_path(const WmiDiff *diff, size_t change);
+
+    /** Get the property count of a change.  This is every property for an
+     * added instance, none for a removed one, and only the changed properties
+     * for a modified one.
+     * Returns 0 on bad index.
+     */
+    WMIENUMALL_API size_t WmiDiff_propertyCount(const WmiDiff *diff, size_t change);
+
+    /** Get a changed property's key.
+     * Returns NULL on bad index.
+     */
+    WMIENUMALL_API const wchar_t *WmiDiff_propertyKey(const WmiDiff *diff, size_t change, size_t property);
+
+    /** Get a changed property's new value.
+     * Returns NULL on bad index, or if the property no longer exists.
+     */
+    WMIENUMALL_API const wchar_t *WmiDiff_propertyValue(const WmiDiff *diff, size_t change, size_t property);
+
+    /** Create a live cache of all instances of a class, which is enumerated
+     * once and then kept up to date by instance creation, modification and
+     * deletion events, checked by WMI every withinSeconds.  Subclasses of
+     * className are included, under their own class names.  Properties are filtered by propertyRegex as
+     * with WmiEnum_new.
+     * Always returns a WmiLive, even in the case of error.  WmiLive_new and
+     * WmiLive_free must be called on the same thread.
+     */
+    WMIENUMALL_API WmiLive *WmiLive_new(const wchar_t *className, const wchar_t *propertyRegex, uint32_t withinSeconds);
+
+    /** Returns null if no error.  This includes errors from the event
+     * subscription after it was created, after which the cache is stale.
+     */
+    WMIENUMALL_API const char *WmiLive_error(const WmiLive *live);
+
+    /// Cancel the subscription and free the live cache.
+    WMIENUMALL_API void WmiLive_free(WmiLive *live);
+
+    /** Cut a WmiEnum from the current state of the live cache.  This makes no
+     * WMI calls, and shares the instances rather than copying them.  The
+     * WmiEnum is independent of the live cache, and must be freed with
+     * WmiEnum_free.  Its error is set if the live cache has one.
+     */
+    WMIENUMALL_API WmiEnum *WmiLive_snapshot(const WmiLive *live);
+
+    /** Create a sampler for high-performance classes, such as the
+     * Win32_PerfRawData and Win32_PerfFormattedData classes.  Matching classes
+     * are registered once with an IWbemRefresher, and only their integer
+     * properties matching propertyRegex are sampled.  Classes which can't be
+     * added to a refresher are skipped.  No values are available until the
+     * first WmiSampler_refresh.
+     * Always returns a WmiSampler, even in the case of error.  WmiSampler_new
+     * and WmiSampler_free must be called on the same thread.
+     */
+    WMIENUMALL_API WmiSampler *WmiSampler_new(const wchar_t *classRegex, const wchar_t *propertyRegex);
+
+    /// Returns null if no error, including from the last refresh.
+    WMIENUMALL_API const char *WmiSampler_error(const WmiSampler *sampler);
+
+    /// Free a sampler.
+    WMIENUMALL_API void WmiSampler_free(WmiSampler *sampler);
+
+    /** Take a new sample of every class.  Values are read through property
+     * handles straight into preallocated storage, with no string conversion.
+     * Returns 0 on failure, nonzero otherwise.
+     */
+    WMIENUMALL_API int WmiSampler_refresh(WmiSampler *sampler);
+
+    /// Get the number of sampled classes.
+    WMIENUMALL_API size_t WmiSampler_classCount(const WmiSampler *sampler);
+
+    /** Get a sampled class's name.
+     * Returns NULL on bad index.
+     */
+    WMIENUMALL_API const wchar_t *WmiSampler_className(const WmiSampler *sampler, size_t samplerClass);
+
+    /** Get the number of sampled properties of a class, which is the same for
+     * all of its instances.
+     * Returns 0 on bad index.
+     */
+    WMIENUMALL_API size_t WmiSampler_propertyCount(const WmiSampler *sampler, size_t samplerClass);
+
+    /** Get a sampled property's key.
+     * Returns NULL on bad index.
+     */
+    WMIENUMALL_API const wchar_t *WmiSampler_propertyKey(const WmiSampler *sampler, size_t samplerClass, size_t property);
+
+    /** Get the number of instances of a class in the last sample.
+     * Returns 0 on bad index.
+     */
+    WMIENUMALL_API size_t WmiSampler_instanceCount(const WmiSampler *sampler, size_t samplerClass);
+
+    /** Get an instance's Name property in the last sample.
+     * Returns NULL on bad index, or if the class has no Name.
+     */
+    WMIENUMALL_API const wchar_t *WmiSampler_instanceName(const WmiSampler *sampler, size_t samplerClass, size_t instance);
+
+    /** Get a value in the last sample.  Signed values are sign-extended, so
+     * they can be cast to int64_t.
+     * Returns 0 on bad index.
+     */
+    WMIENUMALL_API uint64_t WmiSampler_value(const WmiSampler *sampler, size_t samplerClass, size_t instance, size_t property);
+
+    /** Create a cooker, which computes formatted counter values from two
+     * successive WmiEnums of Win32_PerfRawData classes, the same way that the
+     * Win32_PerfFormattedData classes do, without the provider having to
+     * sample twice per request.
+     */
+    WMIENUMALL_API WmiCooker *WmiCooker_new();
+
+    /// Returns null if no error from the last update.
+    WMIENUMALL_API const char *WmiCooker_error(const WmiCooker *cooker);
+
+    /// Free a cooker.
+    WMIENUMALL_API void WmiCooker_free(WmiCooker *cooker);
+
+    /** Set the counter type of a property by hand, with a PERF_* counter type
+     * from winperf.h.  Classes with any counter type set this way are never
+     * looked up in WMI, so this can also be used to cook data from elsewhere.
+     * Returns 0 if the counter type can't be cooked, nonzero otherwise.
+     */
+    WMIENUMALL_API int WmiCooker_setCounterType(WmiCooker *cooker, const wchar_t *className, const wchar_t *property, uint32_t type);
+
+    /** Cook a new raw sample against the previous one.  Counter types come from
+     * the CounterType qualifiers in the class schemas, which are looked up
+     * once per class.  The raw enum must include the Timestamp_*, Frequency_*
+     * and *_Base properties, so a property regex of ".*" is simplest.
+     * Counters which need two samples have no value on the first update, and
+     * instances are matched between samples by __RELPATH.  The raw enum is not
+     * retained.
+     * Returns 0 on failure, nonzero otherwise.
+     */
+    WMIENUMALL_API int WmiCooker_update(WmiCooker *cooker, const WmiEnum *raw);
+
+    /// Get the number of cooked instances from the last update.
+    WMIENUMALL_API size_t WmiCooker_instanceCount(const WmiCooker *cooker);
+
+    /** Get a cooked instance's class name.
+     * Returns NULL on bad index.
+     */
+    WMIENUMALL_API const wchar_t *WmiCooker_instanceClassName(const WmiCooker *cooker, size_t instance);
+
+    /** Get a cooked instance's __RELPATH.
+     * Returns NULL on bad index.
+     */
+    WMIENUMALL_API const wchar_t *WmiCooker_instancePath(const WmiCooker *cooker, size_t instance);
+
+    /** Get the number of cooked values of an instance.
+     * Returns 0 on bad index.
+     */
+    WMIENUMALL_API size_t WmiCooker_instancePropertyCount(const WmiCooker *cooker, size_t instance);
+
+    /** Get a cooked value's key.
+     * Returns NULL on bad index.
+     */
+    WMIENUMALL_API const wchar_t *WmiCooker_instancePropertyKey(const WmiCooker *cooker, size_t instance, size_t property);
+
+    /** Get a cooked value.
+     * Returns 0 on bad index.
+     */
+    WMIENUMALL_API double WmiCooker_instancePropertyValue(const WmiCooker *cooker, size_t instance, size_t property);
+
+    /** Create a scheduler, which runs periodic jobs on its own thread.  Jobs
+     * which come due within the coalescing window of each other are run in a
+     * single pass, which enumerates each class at most once and gives each job
+     * only the classes and properties it asked for.  session may be NULL;
+     * otherwise its caches are used and it must outlive the scheduler.
+     */
+    WMIENUMALL_API WmiScheduler *WmiScheduler_new(WmiSession *session);
+
+    /** Stop and free a scheduler.  This waits for a running pass to finish,
+     * and must not be called from a callback.
+     */
+    WMIENUMALL_API void WmiScheduler_free(WmiScheduler *scheduler);
+
+    /** Add a job that enumerates like WmiEnum_new every intervalMilliseconds,
+     * and delivers the results to callback on the scheduler's thread.  The
+     * first run happens at a random point within the first interval, so that
+     * many agents started together don't all poll at once.
+     * Returns an id for WmiScheduler_removeJob, or 0 if a regex is invalid,
+     * the interval is 0, or callback is NULL.
+     */
+    WMIENUMALL_API size_t WmiScheduler_addJob(WmiScheduler *scheduler, const wchar_t *classRegex, const wchar_t *propertyRegex, uint32_t intervalMilliseconds, WmiSchedulerCallback callback, void *userData);
+
+    /** Remove a job.  A pass that is already running still delivers to it.
+     * Returns 0 if there is no such job, nonzero otherwise.
+     */
+    WMIENUMALL_API int WmiScheduler_removeJob(WmiScheduler *scheduler, size_t job);
+
+    /** Set how far ahead of their due time jobs may be pulled into a pass with
+     * an earlier job.  The default is 500 milliseconds.
+     */
+    WMIENUMALL_API void WmiScheduler_setCoalesceWindow(WmiScheduler *scheduler, uint32_t milliseconds);
+
+    /** Set the maximum random delay added to every job's next run, so that a
+     * fleet of agents drifts apart instead of hitting shared infrastructure at
+     * the same moment.  The default is 0.
+     */
+    WMIENUMALL_API void WmiScheduler_setJitter(WmiScheduler *scheduler, uint32_t milliseconds);
+
+    /** Get the scheduler's counters.  classRequests counts each class once per
+     * job that wanted it in a pass, and classFetches once per pass, so the
+     * difference is the work saved by coalescing.  Any pointer may be NULL.
+     */
+    WMIENUMALL_API void WmiScheduler_stats(WmiScheduler *scheduler, uint64_t *passes, uint64_t *jobRuns, uint64_t *classRequests, uint64_t *classFetches);
+    /** Set the maximum number of connections per namespace in the process-wide
+     * connection pool, which all enumerations share.  Enumerations wait for a
+     * connection beyond that.  The default is 8.
+     */
+    WMIENUMALL_API void WmiPool_setMaxSize(unsigned maxSize);
+
+    /** Release all idle pooled connections, such as before unloading the
+     * library.  Connections in use are kept.
+     */
+    WMIENUMALL_API void WmiPool_clear(void);
+
+    /** Get the number of open pooled connections, and how many connections
+     * have been created, reused, and discarded as unhealthy or surplus.  Any
+     * pointer may be NULL.
+     */
+    WMIENUMALL_API void WmiPool_stats(uint64_t *open, uint64_t *created, uint64_t *reused, uint64_t *discarded);
+
+    /** Start an enumeration in the background, and return immediately.  Up to
+     * 32 classes at a time are enumerated with CreateInstanceEnumAsync on a
+     * single pooled connection, and a single thread converts all of their
+     * instances, so one thread drives many outstanding provider requests.  The
+     * options are copied, but the cancel token and progress user data they
+     * point to must outlive the enumeration.
+     *
+     * If callback is not NULL, it receives the result once finished, and
+     * must not free the WmiAsync itself.  Otherwise, the result is taken with
+     * WmiAsync_take.
+     */
+    WMIENUMALL_API WmiAsync *WmiAsync_start(const wchar_t *classRegex, const wchar_t *propertyRegex, const WmiOptions *options, WmiAsyncCallback callback, void *userData);
+
+    /// Cancel the enumeration if it is still running, and wait for it.
+    WMIENUMALL_API void WmiAsync_free(WmiAsync *async);
+
+    /** Cancel the enumeration.  Outstanding calls are cancelled with
+     * CancelAsyncCall, and the result gets an error, along with whatever had
+     * already been fetched.
+     */
+    WMIENUMALL_API void WmiAsync_cancel(WmiAsync *async);
+
+    /** Wait up to milliseconds for the enumeration to finish, or forever with
+     * UINT32_MAX.
+     * Returns nonzero if it has finished, 0 otherwise.
+     */
+    WMIENUMALL_API int WmiAsync_wait(WmiAsync *async, uint32_t milliseconds);
+
+    /** Take the result of a finished enumeration, which the caller must free
+     * with WmiEnum_free.  Returns NULL if it hasn't finished, if it was already
+     * taken, or if it went to the callback.
+     */
+    WMIENUMALL_API WmiEnum *WmiAsync_take(WmiAsync *async);
+
 #ifdef __cplusplus
 }
 #endif